@@ -50,107 +50,95 @@ bool Assembler::is_register(const std::string& token, uint16_t& reg) {
     return false;
 }
 
-bool Assembler::is_number(const std::string& token, int32_t& value) {
-    if (token.empty()) return false;
-    try {
-        value = parse_number(token);
-        return true;
-    } catch (...) {
-        return false;
-    }
-}
-
-int32_t Assembler::parse_number(const std::string& token) {
-    std::string t = token;
+// Decimal by default, 0x hex, 0o octal, optional leading '-'. Returns false
+// rather than throwing: it is tried on every symbol operand.
+static bool parse_value(const std::string& token, int32_t& value) {
+    size_t i = 0;
     int sign = 1;
-    if (!t.empty() && t[0] == '-') {
+    if (i < token.size() && token[i] == '-') {
         sign = -1;
-        t = t.substr(1);
+        ++i;
     }
 
-    int base = 8;
-    if (t.rfind("0x", 0) == 0 || t.rfind("0X", 0) == 0) {
-        base = 16;
-        t = t.substr(2);
-    } else if (t.rfind("0o", 0) == 0 || t.rfind("0O", 0) == 0) {
-        base = 8;
-        t = t.substr(2);
-    } else {
-        base = 10;
+    int base = 10;
+    if (token.size() - i >= 2 && token[i] == '0') {
+        char p = token[i + 1];
+        if (p == 'x' || p == 'X') {
+            base = 16;
+            i += 2;
+        } else if (p == 'o' || p == 'O') {
+            base = 8;
+            i += 2;
+        }
     }
 
-    int32_t value = 0;
-    for (char c : t) {
+    int32_t v = 0;
+    for (; i < token.size(); ++i) {
+        char c = token[i];
         int digit = 0;
         if (c >= '0' && c <= '9') digit = c - '0';
         else if (c >= 'A' && c <= 'F') digit = 10 + (c - 'A');
         else if (c >= 'a' && c <= 'f') digit = 10 + (c - 'a');
-        else throw std::runtime_error("Invalid number: " + token);
-        if (digit >= base) throw std::runtime_error("Invalid number: " + token);
-        value = value * base + digit;
+        else return false;
+        if (digit >= base) return false;
+        v = v * base + digit;
     }
 
-    return sign * value;
+    value = sign * v;
+    return true;
 }
 
-std::vector<Assembler::Line> Assembler::parse_lines(const std::string& source) {
-    std::vector<Line> lines;
-    std::istringstream in(source);
-    std::string line;
-    int line_no = 0;
+bool Assembler::is_number(const std::string& token, int32_t& value) {
+    return !token.empty() && parse_value(token, value);
+}
 
-    while (std::getline(in, line)) {
-        ++line_no;
-        std::string raw = line;
-        auto comment_pos = line.find(';');
-        if (comment_pos != std::string::npos) {
-            line = line.substr(0, comment_pos);
-        }
-        line = trim(line);
-        if (line.empty()) continue;
+int32_t Assembler::parse_number(const std::string& token) {
+    int32_t value = 0;
+    if (!parse_value(token, value)) {
+        throw std::runtime_error("Invalid number: " + token);
+    }
+    return value;
+}
 
-        Line l;
-        l.line_no = line_no;
-        l.raw = raw;
+bool Assembler::parse_line(const std::string& text, Line& l) {
+    static const char* const kSpace = " \t\r\n\v\f";
+    l.label.clear();
+    l.opcode.clear();
+    l.operands.clear();
 
-        auto colon = line.find(':');
-        if (colon != std::string::npos) {
-            l.label = trim(line.substr(0, colon));
-            line = trim(line.substr(colon + 1));
-        }
+    size_t first = text.find_first_not_of(kSpace);
+    if (first == std::string::npos || text[first] == ';') return false; // skip comments without copying
 
-        if (line.empty()) {
-            lines.push_back(l);
-            continue;
-        }
+    std::string line = trim(text.substr(0, text.find(';')));
+    if (line.empty()) return false;
 
-        std::istringstream ss(line);
-        ss >> l.opcode;
-        if (l.opcode.empty()) {
-            lines.push_back(l);
-            continue;
-        }
-        l.opcode = upper(l.opcode);
-
-        std::string rest;
-        std::getline(ss, rest);
-        rest = trim(rest);
-        if (!rest.empty()) {
-            auto ops = split_operands(rest);
-            for (auto& op : ops) {
-                l.operands.push_back(trim(op));
-            }
-        }
+    auto colon = line.find(':');
+    if (colon != std::string::npos) {
+        l.label = trim(line.substr(0, colon));
+        line = trim(line.substr(colon + 1));
+    }
+    if (line.empty()) return true;
 
-        lines.push_back(l);
+    size_t op_end = line.find_first_of(kSpace);
+    l.opcode = upper(line.substr(0, op_end));
+    if (op_end == std::string::npos) return true;
+
+    std::string rest = trim(line.substr(op_end));
+    for (const auto& op : split_operands(rest)) {
+        l.operands.push_back(trim(op));
     }
+    return true;
+}
 
-    return lines;
+const Assembler::Symbol* Assembler::reference(SymbolTable& symbols, const std::string& name) {
+    Symbol& sym = symbols[upper(name)];
+    if (sym.spelling.empty()) {
+        sym.spelling = name;
+    }
+    return &sym;
 }
 
-Assembler::OperandEnc Assembler::encode_operand(const std::string& token, uint16_t pc,
-                                                const std::unordered_map<std::string, uint16_t>& symbols,
-                                                bool allow_undefined) {
+Assembler::OperandEnc Assembler::encode_operand(const std::string& token, uint16_t pc, SymbolTable& symbols) {
     OperandEnc enc{};
     std::string t = trim(token);
 
@@ -158,6 +146,18 @@ Assembler::OperandEnc Assembler::encode_operand(const std::string& token, uint16
         throw std::runtime_error("Empty operand");
     }
 
+    // Extension word: a number now, or a symbol patched at the end.
+    auto set_extra = [&](const std::string& value, int32_t base) {
+        enc.has_extra = true;
+        int32_t number = 0;
+        if (value.empty() || is_number(value, number)) {
+            enc.extra = number - base;
+        } else {
+            enc.symbol = reference(symbols, value);
+            enc.base = base;
+        }
+    };
+
     uint16_t reg = 0;
     if (is_register(t, reg)) {
         enc.spec = reg; // mode 0
@@ -193,41 +193,21 @@ Assembler::OperandEnc Assembler::encode_operand(const std::string& token, uint16
 
     if (t.rfind("#", 0) == 0) {
         std::string value = trim(t.substr(1));
-        int32_t imm = 0;
-        if (!is_number(value, imm)) {
-            auto it = symbols.find(upper(value));
-            if (it == symbols.end()) {
-                if (!allow_undefined) {
-                    throw std::runtime_error("Undefined symbol: " + value);
-                }
-                imm = 0;
-            } else {
-                imm = it->second;
-            }
+        if (value.empty()) {
+            throw std::runtime_error("Undefined symbol: " + value);
         }
         enc.spec = static_cast<uint16_t>((2 << 3) | 7); // autoinc PC
-        enc.has_extra = true;
-        enc.extra = imm;
+        set_extra(value, 0);
         return enc;
     }
 
     if (t.rfind("@#", 0) == 0) {
         std::string value = trim(t.substr(2));
-        int32_t imm = 0;
-        if (!is_number(value, imm)) {
-            auto it = symbols.find(upper(value));
-            if (it == symbols.end()) {
-                if (!allow_undefined) {
-                    throw std::runtime_error("Undefined symbol: " + value);
-                }
-                imm = 0;
-            } else {
-                imm = it->second;
-            }
+        if (value.empty()) {
+            throw std::runtime_error("Undefined symbol: " + value);
         }
         enc.spec = static_cast<uint16_t>((3 << 3) | 7); // autoinc deferred PC
-        enc.has_extra = true;
-        enc.extra = imm;
+        set_extra(value, 0);
         return enc;
     }
 
@@ -238,40 +218,14 @@ Assembler::OperandEnc Assembler::encode_operand(const std::string& token, uint16
         if (!is_register(inner, reg)) {
             throw std::runtime_error("Invalid index: " + t);
         }
-        int32_t value = 0;
-        if (!disp.empty() && !is_number(disp, value)) {
-            auto it = symbols.find(upper(disp));
-            if (it == symbols.end()) {
-                if (!allow_undefined) {
-                    throw std::runtime_error("Undefined symbol: " + disp);
-                }
-                value = 0;
-            } else {
-                value = it->second;
-            }
-        }
         enc.spec = static_cast<uint16_t>((6 << 3) | reg);
-        enc.has_extra = true;
-        enc.extra = value;
+        set_extra(disp, 0); // no displacement means 0
         return enc;
     }
 
     // Symbol or number as PC-relative
-    int32_t value = 0;
-    if (!is_number(t, value)) {
-        auto it = symbols.find(upper(t));
-        if (it == symbols.end()) {
-            if (!allow_undefined) {
-                throw std::runtime_error("Undefined symbol: " + t);
-            }
-            value = 0;
-        } else {
-            value = it->second;
-        }
-    }
     enc.spec = static_cast<uint16_t>((6 << 3) | 7); // index PC
-    enc.has_extra = true;
-    enc.extra = value - static_cast<int32_t>(pc + 4); // PC after extension
+    set_extra(t, static_cast<int32_t>(pc + 4));     // PC after extension
     return enc;
 }
 
@@ -311,121 +265,90 @@ uint16_t Assembler::encode_single_op(const std::string& opcode) {
 }
 
 AsmResult Assembler::assemble(const std::string& source) {
-    auto lines = parse_lines(source);
-
-    std::unordered_map<std::string, uint16_t> symbols;
+    // One pass: code is emitted as each line is read. Operands naming a
+    // symbol leave a fixup, patched below once every label is known.
+    SymbolTable symbols;
+    std::vector<Fixup> fixups;
+    std::vector<uint16_t> words;
+    std::vector<int> word_lines;
+    std::vector<bool> instr_starts;
+    words.reserve(1024);
+    word_lines.reserve(1024);
+    instr_starts.reserve(1024);
     uint16_t pc = 0;
     uint16_t start = 0;
 
-    for (const auto& line : lines) {
-        if (!line.label.empty()) {
-            symbols[upper(line.label)] = pc;
-        }
-
-        if (line.opcode.empty()) {
-            continue;
-        }
-
-        if (line.opcode == ".ORIG") {
-            if (line.operands.size() != 1) {
-                throw std::runtime_error(".ORIG requires one operand");
-            }
-            int32_t value = parse_number(line.operands[0]);
-            pc = static_cast<uint16_t>(value);
-            start = pc;
-            continue;
+    Line line;
+    std::string text;
+    int line_no = 0;
+    for (size_t pos = 0; pos < source.size();) {
+        size_t end = source.find('\n', pos);
+        if (end == std::string::npos) {
+            end = source.size();
         }
-
-        if (line.opcode == ".WORD") {
-            pc = static_cast<uint16_t>(pc + 2);
+        text.assign(source, pos, end - pos);
+        pos = end + 1;
+        ++line_no;
+        if (!parse_line(text, line)) {
             continue;
         }
+        line.line_no = line_no;
 
-        if (line.opcode == "HALT" || line.opcode == "RTS" || line.opcode == "TRAP") {
+        auto emit = [&](uint16_t word, bool is_start) {
+            words.push_back(word);
+            word_lines.push_back(line.line_no);
+            instr_starts.push_back(is_start);
             pc = static_cast<uint16_t>(pc + 2);
-            continue;
-        }
-
-        uint16_t base = encode_double_op(line.opcode);
-        if (base != 0) {
-            if (line.operands.size() != 2) {
-                throw std::runtime_error("Expected two operands on line " + std::to_string(line.line_no));
+        };
+        auto emit_extra = [&](const OperandEnc& enc) {
+            if (!enc.has_extra) {
+                return;
             }
-            auto src = encode_operand(line.operands[0], pc, symbols, true);
-            auto dst = encode_operand(line.operands[1], pc + (src.has_extra ? 2 : 0), symbols, true);
-            pc = static_cast<uint16_t>(pc + 2 + (src.has_extra ? 2 : 0) + (dst.has_extra ? 2 : 0));
-            continue;
-        }
-
-        base = encode_single_op(line.opcode);
-        if (base != 0) {
-            if (line.operands.size() != 1) {
-                throw std::runtime_error("Expected one operand on line " + std::to_string(line.line_no));
+            if (enc.symbol) {
+                fixups.push_back({words.size(), enc.symbol, enc.base, false, line.line_no});
             }
-            auto dst = encode_operand(line.operands[0], pc, symbols, true);
-            pc = static_cast<uint16_t>(pc + 2 + (dst.has_extra ? 2 : 0));
-            continue;
-        }
+            emit(static_cast<uint16_t>(enc.extra), false);
+        };
 
-        if (line.opcode == "BR" || line.opcode == "BEQ" || line.opcode == "BNE") {
-            pc = static_cast<uint16_t>(pc + 2);
-            continue;
+        if (!line.label.empty()) {
+            Symbol& sym = symbols[upper(line.label)];
+            sym.value = pc;
+            sym.defined = true;
         }
 
-        if (line.opcode == "JSR") {
-            if (line.operands.size() != 2) {
-                throw std::runtime_error("JSR requires two operands");
-            }
-            uint16_t reg = 0;
-            if (!is_register(line.operands[0], reg)) {
-                throw std::runtime_error("JSR first operand must be register");
-            }
-            auto dst = encode_operand(line.operands[1], pc, symbols, true);
-            pc = static_cast<uint16_t>(pc + 2 + (dst.has_extra ? 2 : 0));
+        if (line.opcode.empty()) {
             continue;
         }
 
-        throw std::runtime_error("Unknown opcode on line " + std::to_string(line.line_no) + ": " + line.opcode);
-    }
-
-    std::vector<uint16_t> words;
-    words.reserve(1024);
-    pc = start;
-
-    for (const auto& line : lines) {
         if (line.opcode == ".ORIG") {
-            pc = static_cast<uint16_t>(parse_number(line.operands[0]));
-            continue;
-        }
-
-        if (!line.label.empty()) {
-            // already recorded
-        }
-
-        if (line.opcode.empty()) {
+            if (line.operands.size() != 1) {
+                throw std::runtime_error(".ORIG requires one operand");
+            }
+            int32_t value = parse_number(line.operands[0]);
+            pc = static_cast<uint16_t>(value);
+            start = pc;
             continue;
         }
 
         if (line.opcode == ".WORD") {
-            int32_t value = 0;
             if (line.operands.size() != 1) {
                 throw std::runtime_error(".WORD requires one operand");
             }
+            int32_t value = 0;
             if (!is_number(line.operands[0], value)) {
-                auto it = symbols.find(upper(line.operands[0]));
-                if (it == symbols.end()) {
-                    throw std::runtime_error("Undefined symbol: " + line.operands[0]);
-                }
-                value = it->second;
+                fixups.push_back({words.size(), reference(symbols, line.operands[0]), 0, false, line.line_no});
             }
-            words.push_back(static_cast<uint16_t>(value));
-            pc = static_cast<uint16_t>(pc + 2);
+            emit(static_cast<uint16_t>(value), false);
             continue;
         }
 
         if (line.opcode == "HALT") {
-            words.push_back(0x0000);
-            pc = static_cast<uint16_t>(pc + 2);
+            emit(0x0000, true);
+            continue;
+        }
+
+        if (line.opcode == "WAIT" || line.opcode == "RTI" || line.opcode == "RTT") {
+            emit(line.opcode == "WAIT" ? 0000001 : (line.opcode == "RTI" ? 0000002 : 0000006), true);
             continue;
         }
 
@@ -444,8 +367,7 @@ AsmResult Assembler::assemble(const std::string& source) {
             if (value < 0 || value > 255) {
                 throw std::runtime_error("TRAP vector out of range");
             }
-            words.push_back(static_cast<uint16_t>(0104000 | (value & 0xFF)));
-            pc = static_cast<uint16_t>(pc + 2);
+            emit(static_cast<uint16_t>(0104000 | (value & 0xFF)), true);
             continue;
         }
 
@@ -457,38 +379,31 @@ AsmResult Assembler::assemble(const std::string& source) {
             if (!is_register(line.operands[0], reg)) {
                 throw std::runtime_error("RTS operand must be register");
             }
-            words.push_back(static_cast<uint16_t>(0000020 | reg));
-            pc = static_cast<uint16_t>(pc + 2);
+            emit(static_cast<uint16_t>(0000020 | reg), true);
             continue;
         }
 
         uint16_t base = encode_double_op(line.opcode);
         if (base != 0) {
-            auto src = encode_operand(line.operands[0], pc, symbols, false);
-            uint16_t pc_after_src = static_cast<uint16_t>(pc + 2 + (src.has_extra ? 2 : 0));
-            auto dst = encode_operand(line.operands[1], pc_after_src - 2, symbols, false);
-
-            uint16_t instr = static_cast<uint16_t>(base | (src.spec << 6) | dst.spec);
-            words.push_back(instr);
-            if (src.has_extra) {
-                words.push_back(static_cast<uint16_t>(src.extra));
-            }
-            if (dst.has_extra) {
-                words.push_back(static_cast<uint16_t>(dst.extra));
+            if (line.operands.size() != 2) {
+                throw std::runtime_error("Expected two operands on line " + std::to_string(line.line_no));
             }
-            pc = static_cast<uint16_t>(pc + 2 + (src.has_extra ? 2 : 0) + (dst.has_extra ? 2 : 0));
+            auto src = encode_operand(line.operands[0], pc, symbols);
+            auto dst = encode_operand(line.operands[1], pc + (src.has_extra ? 2 : 0), symbols);
+            emit(static_cast<uint16_t>(base | (src.spec << 6) | dst.spec), true);
+            emit_extra(src);
+            emit_extra(dst);
             continue;
         }
 
         base = encode_single_op(line.opcode);
         if (base != 0) {
-            auto dst = encode_operand(line.operands[0], pc, symbols, false);
-            uint16_t instr = static_cast<uint16_t>(base | dst.spec);
-            words.push_back(instr);
-            if (dst.has_extra) {
-                words.push_back(static_cast<uint16_t>(dst.extra));
+            if (line.operands.size() != 1) {
+                throw std::runtime_error("Expected one operand on line " + std::to_string(line.line_no));
             }
-            pc = static_cast<uint16_t>(pc + 2 + (dst.has_extra ? 2 : 0));
+            auto dst = encode_operand(line.operands[0], pc, symbols);
+            emit(static_cast<uint16_t>(base | dst.spec), true);
+            emit_extra(dst);
             continue;
         }
 
@@ -496,49 +411,70 @@ AsmResult Assembler::assemble(const std::string& source) {
             if (line.operands.size() != 1) {
                 throw std::runtime_error("Branch requires one operand");
             }
-            int32_t target = 0;
-            if (!is_number(line.operands[0], target)) {
-                auto it = symbols.find(upper(line.operands[0]));
-                if (it == symbols.end()) {
-                    throw std::runtime_error("Undefined symbol: " + line.operands[0]);
-                }
-                target = it->second;
-            }
-            int32_t offset = (target - static_cast<int32_t>(pc + 2)) / 2;
-            if (offset < -128 || offset > 127) {
-                throw std::runtime_error("Branch out of range on line " + std::to_string(line.line_no));
-            }
             uint16_t op = 0;
             if (line.opcode == "BR") op = 0000400;
             if (line.opcode == "BNE") op = 0001000;
             if (line.opcode == "BEQ") op = 0001400;
-            words.push_back(static_cast<uint16_t>(op | (offset & 0xFF)));
-            pc = static_cast<uint16_t>(pc + 2);
+            int32_t target = 0;
+            if (is_number(line.operands[0], target)) {
+                int32_t offset = (target - static_cast<int32_t>(pc + 2)) / 2;
+                if (offset < -128 || offset > 127) {
+                    throw std::runtime_error("Branch out of range on line " + std::to_string(line.line_no));
+                }
+                op = static_cast<uint16_t>(op | (offset & 0xFF));
+            } else {
+                fixups.push_back({words.size(), reference(symbols, line.operands[0]), static_cast<int32_t>(pc + 2),
+                                  true, line.line_no});
+            }
+            emit(op, true);
             continue;
         }
 
         if (line.opcode == "JSR") {
+            if (line.operands.size() != 2) {
+                throw std::runtime_error("JSR requires two operands");
+            }
             uint16_t reg = 0;
             if (!is_register(line.operands[0], reg)) {
                 throw std::runtime_error("JSR first operand must be register");
             }
-            auto dst = encode_operand(line.operands[1], pc, symbols, false);
-            uint16_t instr = static_cast<uint16_t>(0004000 | (reg << 6) | dst.spec);
-            words.push_back(instr);
-            if (dst.has_extra) {
-                words.push_back(static_cast<uint16_t>(dst.extra));
-            }
-            pc = static_cast<uint16_t>(pc + 2 + (dst.has_extra ? 2 : 0));
+            auto dst = encode_operand(line.operands[1], pc, symbols);
+            emit(static_cast<uint16_t>(0004000 | (reg << 6) | dst.spec), true);
+            emit_extra(dst);
             continue;
         }
 
         throw std::runtime_error("Unknown opcode on line " + std::to_string(line.line_no) + ": " + line.opcode);
     }
 
+    for (const Fixup& f : fixups) {
+        if (!f.symbol->defined) {
+            throw std::runtime_error("Undefined symbol: " + f.symbol->spelling);
+        }
+        int32_t value = static_cast<int32_t>(f.symbol->value) - f.base;
+        if (!f.branch) {
+            words[f.word] = static_cast<uint16_t>(value);
+            continue;
+        }
+        int32_t offset = value / 2;
+        if (offset < -128 || offset > 127) {
+            throw std::runtime_error("Branch out of range on line " + std::to_string(f.line_no));
+        }
+        words[f.word] = static_cast<uint16_t>(words[f.word] | (offset & 0xFF));
+    }
+
     AsmResult result;
     result.start = start;
     result.words = std::move(words);
-    result.symbols = std::move(symbols);
+    result.word_lines = std::move(word_lines);
+    result.instr_starts = std::move(instr_starts);
+    result.symbols.reserve(symbols.size());
+    while (!symbols.empty()) {
+        auto node = symbols.extract(symbols.begin());
+        if (node.mapped().defined) {
+            result.symbols.emplace(std::move(node.key()), node.mapped().value);
+        }
+    }
     return result;
 }
 
@@ -11,6 +11,8 @@ struct AsmResult {
     uint16_t start = 0;
     std::vector<uint16_t> words;
     std::unordered_map<std::string, uint16_t> symbols;
+    std::vector<int> word_lines;    // source line that produced each word
+    std::vector<bool> instr_starts; // true where a word begins an instruction
 };
 
 class Assembler {
@@ -24,10 +26,11 @@ private:
         std::string label;
         std::string opcode;
         std::vector<std::string> operands;
-        std::string raw;
     };
 
-    std::vector<Line> parse_lines(const std::string& source);
+    // Splits one source line into label, opcode and operands. False when it
+    // holds nothing but a comment or whitespace.
+    static bool parse_line(const std::string& text, Line& l);
     static std::string trim(const std::string& s);
     static std::string upper(const std::string& s);
 
@@ -35,15 +38,35 @@ private:
     static bool is_number(const std::string& token, int32_t& value);
     static int32_t parse_number(const std::string& token);
 
+    // Symbols are referenced before they are defined; their nodes stay put
+    // in the map, so fixups can point at them.
+    struct Symbol {
+        uint16_t value = 0;
+        bool defined = false;
+        std::string spelling; // as first written, for errors
+    };
+    using SymbolTable = std::unordered_map<std::string, Symbol>;
+
+    // A word that depends on a symbol, patched once the whole source has been
+    // read: value - base, or for branches the offset to value from base.
+    struct Fixup {
+        size_t word; // index into words
+        const Symbol* symbol;
+        int32_t base;
+        bool branch;
+        int line_no;
+    };
+
     struct OperandEnc {
         uint16_t spec = 0;
         bool has_extra = false;
         int32_t extra = 0;
+        const Symbol* symbol = nullptr; // extra is then symbol - base
+        int32_t base = 0;
     };
 
-    OperandEnc encode_operand(const std::string& token, uint16_t pc,
-                              const std::unordered_map<std::string, uint16_t>& symbols,
-                              bool allow_undefined);
+    static const Symbol* reference(SymbolTable& symbols, const std::string& name);
+    OperandEnc encode_operand(const std::string& token, uint16_t pc, SymbolTable& symbols);
 
     uint16_t encode_double_op(const std::string& opcode);
     uint16_t encode_single_op(const std::string& opcode);
@@ -0,0 +1,112 @@
+#include "async_io.h"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <unistd.h>
+
+namespace pdp11 {
+
+AsyncIO::AsyncIO() : worker_([this]() { worker_loop(); }) {}
+
+AsyncIO::~AsyncIO() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    worker_.join();
+    for (auto& req : queue_) {
+        ::close(req.fd);
+    }
+}
+
+void AsyncIO::submit(Request req) {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        running_.push_back(req.id);
+        queue_.push_back(std::move(req));
+    }
+    work_cv_.notify_one();
+}
+
+void AsyncIO::collect(std::vector<Request>& out, int wait_id) {
+    std::unique_lock<std::mutex> lock(mu_);
+    if (wait_id == kWaitAll) {
+        done_cv_.wait(lock, [&]() { return running_.empty(); });
+    } else if (wait_id != kNoWait) {
+        done_cv_.wait(lock, [&]() {
+            return std::find(running_.begin(), running_.end(), static_cast<uint16_t>(wait_id)) ==
+                   running_.end();
+        });
+    }
+    for (auto& req : done_) {
+        out.push_back(std::move(req));
+    }
+    done_.clear();
+}
+
+size_t AsyncIO::in_flight() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return running_.size() + done_.size();
+}
+
+void AsyncIO::perform(Request& req) {
+    if (!req.write) {
+        req.data.resize(req.len);
+    }
+    size_t done = 0;
+    while (done < req.len) {
+        ssize_t n = 0;
+        off_t off = static_cast<off_t>(req.offset + done);
+        if (req.write) {
+            n = req.seekable ? ::pwrite(req.fd, req.data.data() + done, req.len - done, off)
+                             : ::write(req.fd, req.data.data() + done, req.len - done);
+        } else {
+            n = req.seekable ? ::pread(req.fd, req.data.data() + done, req.len - done, off)
+                             : ::read(req.fd, req.data.data() + done, req.len - done);
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            req.result = done > 0 ? static_cast<long>(done) : -1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+        if (!req.seekable && !req.write) {
+            break;
+        }
+    }
+    if (req.result >= 0) {
+        req.result = static_cast<long>(done);
+    }
+    if (!req.write) {
+        req.data.resize(req.result > 0 ? static_cast<size_t>(req.result) : 0);
+    }
+    ::close(req.fd);
+    req.fd = -1;
+}
+
+void AsyncIO::worker_loop() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (true) {
+        work_cv_.wait(lock, [&]() { return stop_ || !queue_.empty(); });
+        if (stop_) {
+            return;
+        }
+        Request req = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        perform(req);
+        lock.lock();
+        running_.erase(std::find(running_.begin(), running_.end(), req.id));
+        done_.push_back(std::move(req));
+        done_cv_.notify_all();
+    }
+}
+
+} // namespace pdp11
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pdp11 {
+
+// Background file I/O for the asynchronous TRAPs. Requests run in order on a
+// single worker thread against a private dup() of the guest's descriptor, so
+// the guest may close its handle while a request is in flight.
+class AsyncIO {
+public:
+    struct Request {
+        uint16_t id = 0;
+        int fd = -1;
+        bool write = false;
+        bool seekable = true;
+        uint64_t offset = 0;
+        uint32_t len = 0;
+        std::vector<uint8_t> data; // write payload, or bytes read
+        long result = 0;           // bytes transferred, -1 on error
+
+        // Where completion lands in guest memory.
+        uint8_t bank = 0;
+        uint16_t block = 0;
+        uint16_t buf_addr = 0;
+    };
+
+    AsyncIO();
+    ~AsyncIO();
+    AsyncIO(const AsyncIO&) = delete;
+    AsyncIO& operator=(const AsyncIO&) = delete;
+
+    void submit(Request req);
+    static constexpr int kNoWait = -1;
+    static constexpr int kWaitAll = 0xFFFF;
+
+    // Moves finished requests into `out`. Blocks first until request wait_id
+    // (or every request, for kWaitAll) has finished.
+    void collect(std::vector<Request>& out, int wait_id);
+    size_t in_flight() const;
+
+    static constexpr size_t kMaxInFlight = 64;
+
+private:
+    mutable std::mutex mu_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Request> queue_;
+    std::vector<Request> done_;
+    std::vector<uint16_t> running_;
+    bool stop_ = false;
+    std::thread worker_;
+
+    void worker_loop();
+    static void perform(Request& req);
+};
+
+} // namespace pdp11
@@ -0,0 +1,418 @@
+#include "batch.h"
+#include "assembler.h"
+#include "pdp11.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace pdp11 {
+
+std::vector<BatchJob> parse_manifest(std::istream& in, const std::string& base_dir) {
+    auto resolve = [&](const std::string& path) {
+        if (base_dir.empty() || path.empty() || path[0] == '/') {
+            return path;
+        }
+        return base_dir + "/" + path;
+    };
+    std::vector<BatchJob> jobs;
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        std::istringstream fields(line);
+        std::string program;
+        if (!(fields >> program) || program[0] == '#') {
+            continue;
+        }
+        BatchJob job;
+        job.program = resolve(program);
+        std::string input;
+        if (fields >> input && input != "-") {
+            job.input_path = resolve(input);
+        }
+        std::string steps;
+        if (fields >> steps) {
+            try {
+                job.max_steps = std::stoull(steps);
+            } catch (const std::exception&) {
+                throw std::runtime_error("Bad max_steps on manifest line " + std::to_string(line_no));
+            }
+        }
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned threads) : queues_(threads == 0 ? 1 : threads) {}
+
+bool WorkStealingPool::next(unsigned worker, size_t& index) {
+    {
+        Queue& own = queues_[worker];
+        std::lock_guard<std::mutex> lock(own.mu);
+        if (!own.items.empty()) {
+            index = own.items.back();
+            own.items.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        Queue& victim = queues_[(worker + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mu);
+        if (!victim.items.empty()) {
+            index = victim.items.front();
+            victim.items.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(size_t count, const std::function<void(size_t, unsigned)>& task) {
+    // Contiguous blocks keep each worker on the same programs where it can.
+    size_t per = (count + queues_.size() - 1) / queues_.size();
+    for (size_t w = 0; w < queues_.size(); ++w) {
+        std::lock_guard<std::mutex> lock(queues_[w].mu);
+        for (size_t i = w * per; i < std::min(count, (w + 1) * per); ++i) {
+            queues_[w].items.push_back(i);
+        }
+    }
+    auto work = [&](unsigned worker) {
+        size_t index = 0;
+        while (next(worker, index)) {
+            task(index, worker);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned w = 1; w < size(); ++w) {
+        threads.emplace_back(work, w);
+    }
+    work(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+namespace {
+
+struct Program {
+    AsmResult image;
+    std::string error;
+};
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open input: " + path);
+    }
+    std::ostringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+using ProgramMap = std::unordered_map<std::string, Program>;
+
+ProgramMap assemble_programs(const std::vector<BatchJob>& jobs) {
+    ProgramMap programs;
+    for (const auto& job : jobs) {
+        if (programs.count(job.program)) {
+            continue;
+        }
+        Program& prog = programs[job.program];
+        try {
+            Assembler asmblr;
+            prog.image = asmblr.assemble_file(job.program);
+        } catch (const std::exception& ex) {
+            prog.error = ex.what();
+        }
+    }
+    return programs;
+}
+
+// Runs one job on cpu, created on first use and reused after.
+void run_job(const BatchJob& job, const Program& prog, std::unique_ptr<CPU>& cpu_slot, BatchResult& result) {
+    if (!prog.error.empty()) {
+        result.error = prog.error;
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool started = false; // until reset(), icount is the previous job's
+    try {
+        std::string input = job.input_path.empty() ? std::string() : read_file(job.input_path);
+        if (!cpu_slot) {
+            cpu_slot = std::make_unique<CPU>();
+        }
+        CPU& cpu = *cpu_slot;
+        cpu.reset();
+        started = true;
+        std::memset(cpu.mem.data(), 0, cpu.mem.size());
+        cpu.r[7] = prog.image.start;
+        cpu.r[6] = 0xFFFE;
+        cpu.load_words(prog.image.start, prog.image.words);
+
+        size_t pos = 0;
+        cpu.console_in.clear();
+        cpu.console_in.poll_fd = -1;
+        cpu.console_in.source = [&](char* data, size_t len) -> long {
+            size_t n = std::min(len, input.size() - pos);
+            std::memcpy(data, input.data() + pos, n);
+            pos += n;
+            return static_cast<long>(n);
+        };
+        cpu.console_out.sink = [&](const char* data, size_t len) { result.output.append(data, len); };
+        cpu.run(job.max_steps);
+        result.halted = cpu.halted;
+    } catch (const std::exception& ex) {
+        result.error = ex.what();
+    }
+    if (cpu_slot) {
+        if (started) {
+            result.instructions = cpu_slot->icount;
+        }
+        // The closures refer to this job's locals.
+        cpu_slot->console_in.source = nullptr;
+        cpu_slot->console_out.sink = nullptr;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Process pool state, in one anonymous shared mapping laid out as the
+// header, one slot per job, then the arena holding output and error text.
+// Workers claim jobs by bumping next, so the queue needs no lock.
+struct SharedHeader {
+    std::atomic<uint64_t> next;
+    std::atomic<uint64_t> arena_used;
+};
+
+struct SharedSlot {
+    enum : uint32_t { Pending = 0, Running = 1, Done = 2 };
+    std::atomic<uint32_t> state;
+    int32_t worker;
+    uint8_t halted;
+    uint8_t truncated; // the arena was full
+    uint64_t instructions;
+    double seconds;
+    uint64_t output_off;
+    uint64_t output_len;
+    uint64_t error_off;
+    uint64_t error_len;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "shared counters must not need a lock");
+
+class SharedPool {
+public:
+    SharedPool(size_t jobs, size_t arena_bytes)
+        : jobs_(jobs), arena_bytes_(arena_bytes),
+          size_(sizeof(SharedHeader) + jobs * sizeof(SharedSlot) + arena_bytes) {
+        // NORESERVE: the arena is sized for the worst case but only the
+        // pages holding results are ever touched.
+        void* p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("Cannot allocate shared job queue");
+        }
+        base_ = static_cast<uint8_t*>(p);
+        new (base_) SharedHeader{};
+        for (size_t i = 0; i < jobs; ++i) {
+            new (&slot(i)) SharedSlot{};
+        }
+    }
+    ~SharedPool() { ::munmap(base_, size_); }
+    SharedPool(const SharedPool&) = delete;
+    SharedPool& operator=(const SharedPool&) = delete;
+
+    SharedHeader& header() { return *reinterpret_cast<SharedHeader*>(base_); }
+    SharedSlot& slot(size_t i) {
+        return reinterpret_cast<SharedSlot*>(base_ + sizeof(SharedHeader))[i];
+    }
+    char* arena() { return reinterpret_cast<char*>(base_ + sizeof(SharedHeader) + jobs_ * sizeof(SharedSlot)); }
+
+    // Copies text into the arena; false when it does not fit.
+    bool put(const std::string& text, uint64_t& off, uint64_t& len) {
+        off = header().arena_used.fetch_add(text.size());
+        if (off + text.size() > arena_bytes_) {
+            len = 0;
+            return false;
+        }
+        std::memcpy(arena() + off, text.data(), text.size());
+        len = text.size();
+        return true;
+    }
+
+private:
+    size_t jobs_;
+    size_t arena_bytes_;
+    size_t size_;
+    uint8_t* base_ = nullptr;
+};
+
+[[noreturn]] void worker_main(SharedPool& pool, const std::vector<BatchJob>& jobs, const ProgramMap& programs,
+                              int worker, uint64_t timeout_ms) {
+    std::signal(SIGALRM, SIG_DFL); // the timeout kills the worker outright
+    std::unique_ptr<CPU> cpu;
+    while (true) {
+        uint64_t index = pool.header().next.fetch_add(1);
+        if (index >= jobs.size()) {
+            ::_exit(0);
+        }
+        SharedSlot& slot = pool.slot(index);
+        slot.worker = worker;
+        slot.state.store(SharedSlot::Running, std::memory_order_release);
+        if (timeout_ms != 0) {
+            itimerval timer{};
+            timer.it_value.tv_sec = static_cast<time_t>(timeout_ms / 1000);
+            timer.it_value.tv_usec = static_cast<suseconds_t>(timeout_ms % 1000 * 1000);
+            ::setitimer(ITIMER_REAL, &timer, nullptr);
+        }
+        BatchResult result;
+        run_job(jobs[index], programs.at(jobs[index].program), cpu, result);
+        if (timeout_ms != 0) {
+            itimerval off{};
+            ::setitimer(ITIMER_REAL, &off, nullptr);
+        }
+        slot.halted = result.halted;
+        slot.instructions = result.instructions;
+        slot.seconds = result.seconds;
+        slot.truncated = !pool.put(result.output, slot.output_off, slot.output_len) ||
+                         !pool.put(result.error, slot.error_off, slot.error_len);
+        slot.state.store(SharedSlot::Done, std::memory_order_release);
+    }
+}
+
+std::string death_message(int status) {
+    if (WIFSIGNALED(status)) {
+        return "Worker died: signal " + std::to_string(WTERMSIG(status)) + " (" + strsignal(WTERMSIG(status)) + ")";
+    }
+    return "Worker died: exit status " + std::to_string(WEXITSTATUS(status));
+}
+
+// Reaps the next worker to exit and returns its pid. Other children of the
+// process are left for their owners: waitid(WNOWAIT) only peeks, and once
+// it turns up a foreign child this polls the workers' own pids instead.
+pid_t wait_worker(const std::unordered_map<pid_t, int>& workers, int& status) {
+    bool foreign = false;
+    while (true) {
+        if (!foreign) {
+            siginfo_t info{};
+            if (::waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) != 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Lost track of batch workers");
+            }
+            foreign = workers.count(info.si_pid) == 0;
+            if (!foreign) {
+                ::waitpid(info.si_pid, &status, 0);
+                return info.si_pid;
+            }
+        }
+        for (const auto& w : workers) {
+            pid_t pid = ::waitpid(w.first, &status, WNOHANG);
+            if (pid == w.first) {
+                return pid;
+            }
+            if (pid < 0 && errno != EINTR) {
+                throw std::runtime_error("Lost track of batch workers");
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+} // namespace
+
+std::vector<BatchResult> run_batch(const std::vector<BatchJob>& jobs, unsigned threads) {
+    ProgramMap programs = assemble_programs(jobs);
+    WorkStealingPool pool(threads);
+    std::vector<std::unique_ptr<CPU>> cpus(pool.size());
+    std::vector<BatchResult> results(jobs.size());
+    pool.run(jobs.size(), [&](size_t index, unsigned worker) {
+        run_job(jobs[index], programs.at(jobs[index].program), cpus[worker], results[index]);
+    });
+    return results;
+}
+
+std::vector<BatchResult> run_batch_processes(const std::vector<BatchJob>& jobs, const ProcessBatchOptions& options) {
+    ProgramMap programs = assemble_programs(jobs);
+    SharedPool pool(jobs.size(), options.arena_bytes);
+    std::vector<BatchResult> results(jobs.size());
+    std::vector<std::string> lost(jobs.size()); // why a job's worker died under it
+
+    std::fflush(nullptr); // children must not inherit unflushed output
+    unsigned count = std::max(1u, options.workers);
+    std::unordered_map<pid_t, int> workers;
+    auto spawn = [&](int worker) {
+        pid_t pid = ::fork();
+        if (pid < 0) {
+            throw std::runtime_error("Failed to start batch worker");
+        }
+        if (pid == 0) {
+            worker_main(pool, jobs, programs, worker, options.job_timeout_ms);
+        }
+        workers[pid] = worker;
+    };
+    for (unsigned w = 0; w < count && w < jobs.size(); ++w) {
+        spawn(static_cast<int>(w));
+    }
+
+    while (!workers.empty()) {
+        int status = 0;
+        auto it = workers.find(wait_worker(workers, status));
+        int worker = it->second;
+        workers.erase(it);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            continue;
+        }
+        // Fail whatever it was running; a job that killed one worker would
+        // kill its replacement too.
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            SharedSlot& slot = pool.slot(i);
+            if (slot.state.load(std::memory_order_acquire) == SharedSlot::Running && slot.worker == worker) {
+                slot.state.store(SharedSlot::Done, std::memory_order_relaxed);
+                lost[i] = death_message(status);
+            }
+        }
+        if (pool.header().next.load() < jobs.size()) {
+            spawn(worker);
+        }
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        SharedSlot& slot = pool.slot(i);
+        BatchResult& result = results[i];
+        if (!lost[i].empty()) {
+            result.error = lost[i];
+            continue;
+        }
+        if (slot.state.load(std::memory_order_acquire) != SharedSlot::Done) {
+            result.error = "Worker died before starting the job"; // between claim and mark
+            continue;
+        }
+        result.halted = slot.halted != 0;
+        result.instructions = slot.instructions;
+        result.seconds = slot.seconds;
+        result.output.assign(pool.arena() + slot.output_off, slot.output_len);
+        result.error.assign(pool.arena() + slot.error_off, slot.error_len);
+        if (slot.truncated && result.error.empty()) {
+            result.error = "Result arena full";
+        }
+    }
+    return results;
+}
+
+} // namespace pdp11
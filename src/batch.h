@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace pdp11 {
+
+struct BatchJob {
+    std::string program;    // assembly source path
+    std::string input_path; // console input; empty for none
+    uint64_t max_steps = 100000;
+};
+
+struct BatchResult {
+    bool halted = false;
+    std::string error; // assembler or runtime error; empty on success
+    std::string output;
+    uint64_t instructions = 0;
+    double seconds = 0.0;
+};
+
+// Manifest lines are "program [stdin_file|-] [max_steps]". Blank lines and
+// lines starting with '#' are skipped. Relative paths resolve against base_dir.
+std::vector<BatchJob> parse_manifest(std::istream& in, const std::string& base_dir = "");
+
+// Fixed set of worker threads, each with its own deque of task indices.
+// Workers take from the back of their own deque and steal from the front
+// of the others' when it runs dry. Tasks do not spawn tasks, so the pool
+// is finished once every deque is empty.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(unsigned threads);
+
+    unsigned size() const { return static_cast<unsigned>(queues_.size()); }
+    // Runs task(index, worker) for every index in [0, count) and returns
+    // when all have finished.
+    void run(size_t count, const std::function<void(size_t index, unsigned worker)>& task);
+
+private:
+    struct Queue {
+        std::mutex mu;
+        std::deque<size_t> items;
+    };
+    std::vector<Queue> queues_;
+
+    bool next(unsigned worker, size_t& index);
+};
+
+// Assembles each distinct program once, then runs the jobs on a pool with
+// one CPU per worker, reused across its jobs. Results are in job order.
+std::vector<BatchResult> run_batch(const std::vector<BatchJob>& jobs, unsigned threads);
+
+struct ProcessBatchOptions {
+    unsigned workers = 1;
+    uint64_t job_timeout_ms = 0;          // 0 = none; the worker is killed when one runs over
+    size_t arena_bytes = size_t{1} << 30; // output and error text of all jobs; reserved lazily
+};
+
+// Like run_batch, but the workers are forked processes that claim jobs from
+// a shared-memory queue and write results into a shared arena. A worker
+// that dies (a host crash, or the job timeout) fails only the job it was
+// running and is replaced while jobs remain.
+std::vector<BatchResult> run_batch_processes(const std::vector<BatchJob>& jobs, const ProcessBatchOptions& options);
+
+} // namespace pdp11
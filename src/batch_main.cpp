@@ -0,0 +1,103 @@
+#include "batch.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+using namespace pdp11;
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: pdp11batch <manifest> [--jobs=N] [--processes [--job-timeout=ms]] [--output-dir=dir] [--quiet]\n";
+        return 1;
+    }
+
+    std::string manifest_path = argv[1];
+    unsigned threads = std::thread::hardware_concurrency();
+    std::string output_dir;
+    bool quiet = false;
+    bool processes = false;
+    uint64_t job_timeout_ms = 0;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--jobs=", 0) == 0) {
+            threads = static_cast<unsigned>(std::stoul(arg.substr(7)));
+            continue;
+        }
+        if (arg.rfind("--output-dir=", 0) == 0) {
+            output_dir = arg.substr(13);
+            continue;
+        }
+        if (arg == "--processes") {
+            processes = true;
+            continue;
+        }
+        if (arg.rfind("--job-timeout=", 0) == 0) {
+            job_timeout_ms = std::stoull(arg.substr(14));
+            continue;
+        }
+        if (arg == "--quiet") {
+            quiet = true;
+            continue;
+        }
+        std::cerr << "Unknown option: " << arg << "\n";
+        return 1;
+    }
+
+    try {
+        std::ifstream manifest(manifest_path);
+        if (!manifest) {
+            throw std::runtime_error("Failed to open manifest: " + manifest_path);
+        }
+        auto slash = manifest_path.rfind('/');
+        std::string base_dir = slash == std::string::npos ? "" : manifest_path.substr(0, slash);
+        std::vector<BatchJob> jobs = parse_manifest(manifest, base_dir);
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<BatchResult> results;
+        if (processes) {
+            ProcessBatchOptions options;
+            options.workers = threads;
+            options.job_timeout_ms = job_timeout_ms;
+            results = run_batch_processes(jobs, options);
+        } else {
+            results = run_batch(jobs, threads);
+        }
+        double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        uint64_t total_instructions = 0;
+        size_t failed = 0;
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BatchResult& r = results[i];
+            total_instructions += r.instructions;
+            if (!r.error.empty()) {
+                ++failed;
+            }
+            if (!output_dir.empty()) {
+                std::ofstream out(output_dir + "/job-" + std::to_string(i) + ".out", std::ios::binary);
+                out << r.output;
+            }
+            if (!quiet) {
+                std::cout << i << " " << jobs[i].program << " "
+                          << (!r.error.empty() ? "ERROR" : (r.halted ? "HALT" : "LIMIT"))
+                          << " steps=" << r.instructions << " out=" << r.output.size()
+                          << " time=" << std::fixed << std::setprecision(6) << r.seconds;
+                if (!r.error.empty()) {
+                    std::cout << " error=" << r.error;
+                }
+                std::cout << "\n";
+            }
+        }
+        std::cout << "jobs=" << results.size() << " failed=" << failed
+                  << " instructions=" << total_instructions << std::fixed << std::setprecision(3)
+                  << " wall=" << wall << "s"
+                  << " jobs/s=" << (wall > 0 ? results.size() / wall : 0.0)
+                  << " MIPS=" << (wall > 0 ? total_instructions / wall / 1e6 : 0.0) << "\n";
+        return failed == 0 ? 0 : 2;
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 2;
+    }
+}
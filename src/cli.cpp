@@ -0,0 +1,81 @@
+#include "cli.h"
+
+#include <cctype>
+#include <stdexcept>
+
+namespace pdp11 {
+
+static bool has_radix_prefix(const std::string& s) {
+    return s.rfind("0x", 0) == 0 || s.rfind("0X", 0) == 0 || s.rfind("0o", 0) == 0 || s.rfind("0O", 0) == 0;
+}
+
+static unsigned long parse_number(const std::string& s, unsigned long max) {
+    int base = 10;
+    std::string digits = s;
+    if (has_radix_prefix(s)) {
+        base = (s[1] == 'x' || s[1] == 'X') ? 16 : 8;
+        digits = s.substr(2);
+    }
+    size_t used = 0;
+    unsigned long value = 0;
+    try {
+        value = std::stoul(digits, &used, base);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != digits.size() || value > max) {
+        throw std::runtime_error("Invalid number: " + s);
+    }
+    return value;
+}
+
+uint16_t parse_u16(const std::string& s) {
+    return static_cast<uint16_t>(parse_number(s, 0xFFFF));
+}
+
+uint32_t parse_u32(const std::string& s) {
+    return static_cast<uint32_t>(parse_number(s, 0xFFFFFFFF));
+}
+
+std::vector<std::string> split(const std::string& s, char sep) {
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (true) {
+        auto pos = s.find(sep, start);
+        out.push_back(s.substr(start, pos == std::string::npos ? std::string::npos : pos - start));
+        if (pos == std::string::npos) break;
+        start = pos + 1;
+    }
+    return out;
+}
+
+std::string upper(const std::string& s) {
+    std::string out = s;
+    for (char& c : out) {
+        if (c >= 'a' && c <= 'z') {
+            c = static_cast<char>(c - 'a' + 'A');
+        }
+    }
+    return out;
+}
+
+uint16_t resolve_address(const std::string& spec, const AsmResult& res, const std::string& what) {
+    if (!spec.empty() && (std::isdigit(static_cast<unsigned char>(spec[0])) || has_radix_prefix(spec))) {
+        return parse_u16(spec);
+    }
+    auto it = res.symbols.find(upper(spec));
+    if (it == res.symbols.end()) {
+        throw std::runtime_error("Unknown " + what + " label: " + spec);
+    }
+    return it->second;
+}
+
+uint16_t resolve_entry(const std::string& spec, const AsmResult& res) {
+    if (!spec.empty()) {
+        return resolve_address(spec, res, "entry");
+    }
+    auto it = res.symbols.find("ENTRY");
+    return it != res.symbols.end() ? it->second : res.start;
+}
+
+} // namespace pdp11
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "assembler.h"
+
+namespace pdp11 {
+
+// Argument parsing shared by the command-line tools.
+
+// Decimal, or hex/octal with a 0x/0o prefix. Throws unless the whole string
+// is a number that fits.
+uint16_t parse_u16(const std::string& s);
+uint32_t parse_u32(const std::string& s);
+
+std::vector<std::string> split(const std::string& s, char sep);
+std::string upper(const std::string& s);
+
+// A label (case-insensitive) or a numeric address. `what` names the
+// argument in the error, as in "Unknown breakpoint label: foo".
+uint16_t resolve_address(const std::string& spec, const AsmResult& res, const std::string& what);
+
+// The fork-server entry point: spec if given, else the label ENTRY if
+// defined, else the start address.
+uint16_t resolve_entry(const std::string& spec, const AsmResult& res);
+
+} // namespace pdp11
@@ -0,0 +1,166 @@
+#include "console.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+
+namespace pdp11 {
+
+OutputChannel::OutputChannel() : buf_(kBufferSize) {
+    sink = [](const char* data, size_t len) {
+        std::fwrite(data, 1, len, stdout);
+        std::fflush(stdout);
+    };
+}
+
+void OutputChannel::write(const char* data, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (used_ + len > buf_.size()) {
+        flush();
+        if (len >= buf_.size()) {
+            if (sink) {
+                sink(data, len);
+            }
+            return;
+        }
+    }
+    std::memcpy(buf_.data() + used_, data, len);
+    used_ += len;
+    if (!buffered) {
+        flush();
+    }
+}
+
+void OutputChannel::write_signed(int16_t value) {
+    char tmp[8];
+    size_t n = 0;
+    int32_t v = value;
+    bool neg = v < 0;
+    if (neg) {
+        v = -v;
+    }
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    if (neg) {
+        tmp[sizeof(tmp) - 1 - n++] = '-';
+    }
+    write(tmp + sizeof(tmp) - n, n);
+}
+
+void OutputChannel::write_unsigned(uint16_t value) {
+    char tmp[8];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = static_cast<char>('0' + value % 10);
+        value = static_cast<uint16_t>(value / 10);
+    } while (value != 0);
+    write(tmp + sizeof(tmp) - n, n);
+}
+
+void OutputChannel::write_hex(uint16_t value) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[8];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = digits[value & 0xF];
+        value = static_cast<uint16_t>(value >> 4);
+    } while (value != 0);
+    tmp[sizeof(tmp) - 1 - n++] = 'x';
+    tmp[sizeof(tmp) - 1 - n++] = '0';
+    write(tmp + sizeof(tmp) - n, n);
+}
+
+void OutputChannel::flush() {
+    if (used_ == 0) {
+        return;
+    }
+    if (sink) {
+        sink(buf_.data(), used_);
+    }
+    used_ = 0;
+}
+
+InputChannel::InputChannel() : poll_fd(STDIN_FILENO), buf_(kBufferSize) {
+    source = [](char* data, size_t len) -> long {
+        while (true) {
+            ssize_t n = ::read(STDIN_FILENO, data, len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return static_cast<long>(n);
+        }
+    };
+}
+
+void InputChannel::compact() {
+    size_t keep = mark_ == kNoMark ? pos_ : mark_; // first byte still needed
+    if (keep == 0) {
+        return;
+    }
+    std::memmove(buf_.data(), buf_.data() + keep, end_ - keep);
+    end_ -= keep;
+    pos_ -= keep;
+    if (mark_ != kNoMark) {
+        mark_ = 0;
+    }
+}
+
+size_t InputChannel::refill() {
+    compact();
+    if (!source || end_ == buf_.size()) {
+        return 0;
+    }
+    long n = source(buf_.data() + end_, buf_.size() - end_);
+    would_block_ = n == kWouldBlock;
+    if (would_block_) {
+        return 0;
+    }
+    if (n <= 0) {
+        eof_ = true;
+        return 0;
+    }
+    end_ += static_cast<size_t>(n);
+    return static_cast<size_t>(n);
+}
+
+void InputChannel::read_nonblocking(int fd) {
+    poll_fd = fd;
+    source = [fd](char* data, size_t len) -> long {
+        pollfd p{fd, POLLIN, 0};
+        while (true) {
+            int ready = ::poll(&p, 1, 0);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready == 0) {
+                return kWouldBlock;
+            }
+            ssize_t n = ::read(fd, data, len);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return kWouldBlock;
+            }
+            return static_cast<long>(n);
+        }
+    };
+}
+
+void InputChannel::feed(const char* data, size_t len) {
+    compact();
+    if (end_ + len > buf_.size()) {
+        buf_.resize(end_ + len);
+    }
+    std::memcpy(buf_.data() + end_, data, len);
+    end_ += len;
+}
+
+} // namespace pdp11
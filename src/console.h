@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace pdp11 {
+
+// Buffered console output. Guest output accumulates here and reaches the
+// sink in large writes: when the buffer fills, on flush(), and immediately
+// when `buffered` is false (used while tracing so logs stay in order).
+class OutputChannel {
+public:
+    using Sink = std::function<void(const char* data, size_t len)>;
+
+    static constexpr size_t kBufferSize = 64 * 1024;
+
+    OutputChannel();
+
+    Sink sink;
+    bool buffered = true;
+
+    void put(char c) {
+        if (used_ == buf_.size()) {
+            flush();
+        }
+        buf_[used_++] = c;
+        if (!buffered) {
+            flush();
+        }
+    }
+    void write(const char* data, size_t len);
+    void write_signed(int16_t value);
+    void write_unsigned(uint16_t value);
+    void write_hex(uint16_t value); // 0x prefix, lowercase, no padding
+    void flush();
+    size_t pending() const { return used_; }
+
+private:
+    std::vector<char> buf_;
+    size_t used_ = 0;
+};
+
+// Buffered console input. The source fills the buffer in blocks; TRAPs scan
+// and copy out of the buffer directly instead of pulling single characters.
+class InputChannel {
+public:
+    // Reads up to len bytes into data. Returns the count, kWouldBlock if no
+    // input is available yet, or 0 (or another negative value) at end of input.
+    using Source = std::function<long(char* data, size_t len)>;
+    static constexpr long kWouldBlock = -2;
+
+    static constexpr size_t kBufferSize = 64 * 1024;
+
+    InputChannel();
+
+    Source source;
+    // Descriptor the default source reads, polled by the DL11 model so WAIT can
+    // sleep until input arrives. Set to -1 when replacing the source; such a
+    // source is then assumed never to block.
+    int poll_fd;
+
+    // Buffered bytes not yet consumed.
+    const char* data() const { return buf_.data() + pos_; }
+    size_t available() const { return end_ - pos_; }
+    void consume(size_t n) { pos_ += n < available() ? n : available(); }
+
+    // Calls the source once into the free space; returns bytes added.
+    size_t refill();
+    // True if the last refill() found no input yet (not end of input).
+    bool would_block() const { return would_block_; }
+    // Replaces the source with non-blocking reads of fd, which is also
+    // polled by the DL11 model and the guest scheduler.
+    void read_nonblocking(int fd);
+    // While marked, consumed bytes are kept so rewind() can return to the
+    // mark; used to retry a TRAP that blocked part way through its input.
+    void mark() {
+        mark_ = pos_;
+        would_block_ = false;
+    }
+    void rewind() {
+        pos_ = mark_ == kNoMark ? pos_ : mark_;
+        mark_ = kNoMark;
+    }
+    void release() { mark_ = kNoMark; }
+    // Appends bytes as if the source had produced them.
+    void feed(const char* data, size_t len);
+    void clear() {
+        pos_ = end_ = 0;
+        mark_ = kNoMark;
+        eof_ = false;
+        would_block_ = false;
+    }
+    // True once the source has reported end of input.
+    bool eof() const { return eof_; }
+
+private:
+    std::vector<char> buf_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    static constexpr size_t kNoMark = static_cast<size_t>(-1);
+    size_t mark_ = kNoMark;
+    bool eof_ = false;
+    bool would_block_ = false;
+
+    void compact();
+};
+
+} // namespace pdp11
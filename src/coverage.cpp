@@ -0,0 +1,34 @@
+#include "coverage.h"
+
+#include <map>
+
+namespace pdp11 {
+
+void write_lcov(std::ostream& out, const std::string& source_path,
+                const AsmResult& res, const CPU& cpu) {
+    // line -> hit; only lines that begin at least one instruction are listed
+    std::map<int, bool> lines;
+    for (size_t i = 0; i < res.words.size() && i < res.word_lines.size(); ++i) {
+        if (i >= res.instr_starts.size() || !res.instr_starts[i]) {
+            continue;
+        }
+        uint16_t addr = static_cast<uint16_t>(res.start + i * 2);
+        bool& hit = lines[res.word_lines[i]];
+        hit = hit || cpu.covered(addr);
+    }
+
+    int hit_count = 0;
+    out << "TN:\n";
+    out << "SF:" << source_path << "\n";
+    for (const auto& kv : lines) {
+        out << "DA:" << kv.first << "," << (kv.second ? 1 : 0) << "\n";
+        if (kv.second) {
+            ++hit_count;
+        }
+    }
+    out << "LF:" << lines.size() << "\n";
+    out << "LH:" << hit_count << "\n";
+    out << "end_of_record\n";
+}
+
+} // namespace pdp11
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+
+#include "assembler.h"
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// Writes an lcov tracefile for the program in `res` (loaded at res.start)
+// using the coverage bitmap collected by `cpu`.
+void write_lcov(std::ostream& out, const std::string& source_path,
+                const AsmResult& res, const CPU& cpu);
+
+} // namespace pdp11
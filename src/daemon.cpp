@@ -0,0 +1,346 @@
+#include "daemon.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pdp11 {
+
+namespace {
+
+bool read_full(int fd, void* data, size_t len) {
+    auto* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = ::read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_full(int fd, const std::string& data) {
+    const char* p = data.data();
+    size_t len = data.size();
+    while (len > 0) {
+        ssize_t n = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+template <typename T>
+void put(std::string& out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+    }
+}
+
+template <typename T>
+bool get(int fd, T& value) {
+    uint8_t bytes[sizeof(T)];
+    if (!read_full(fd, bytes, sizeof(T))) {
+        return false;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        v |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+    value = static_cast<T>(v);
+    return true;
+}
+
+bool get_string(int fd, std::string& s) {
+    uint32_t len = 0;
+    if (!get(fd, len) || len > kMaxStringBytes) {
+        return false;
+    }
+    s.resize(len);
+    return len == 0 || read_full(fd, &s[0], len);
+}
+
+void put_string(std::string& out, const std::string& s) {
+    put(out, static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+} // namespace
+
+uint64_t program_hash(const std::string& source) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : source) {
+        h = (h ^ c) * 1099511628211ull;
+    }
+    return h;
+}
+
+uint64_t SimServer::load(const std::string& source) {
+    uint64_t hash = program_hash(source);
+    {
+        std::lock_guard<std::mutex> lock(programs_mu_);
+        uint64_t key = hash;
+        if (find_key(source, key)) {
+            return key;
+        }
+    }
+    Assembler asmblr;
+    auto res = std::make_shared<const AsmResult>(asmblr.assemble(source));
+    std::lock_guard<std::mutex> lock(programs_mu_);
+    uint64_t key = hash;
+    if (!find_key(source, key)) { // another load may have raced us here
+        programs_.emplace(key, Program{source, std::move(res)});
+    }
+    return key;
+}
+
+// Probes from key to the slot holding source (true) or to the first free
+// one (false), so a source whose hash collides gets the next free key.
+bool SimServer::find_key(const std::string& source, uint64_t& key) const {
+    for (;; ++key) {
+        auto it = programs_.find(key);
+        if (it == programs_.end()) {
+            return false;
+        }
+        if (it->second.source == source) {
+            return true;
+        }
+    }
+}
+
+std::unique_ptr<CPU> SimServer::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(pool_mu_);
+        if (!idle_.empty()) {
+            std::unique_ptr<CPU> cpu = std::move(idle_.back());
+            idle_.pop_back();
+            return cpu;
+        }
+    }
+    auto cpu = std::make_unique<CPU>();
+    cpu->track_dirty_pages(true);
+    return cpu;
+}
+
+void SimServer::release(std::unique_ptr<CPU> cpu) {
+    // Zero only what the job wrote (its program included), so the next job
+    // starts from all-zero memory without clearing 256K.
+    std::vector<uint32_t> pages;
+    cpu->take_dirty_pages(pages);
+    cpu->reset(); // also unmaps file banks and closes files
+    constexpr size_t kPage = size_t{1} << CPU::kDirtyPageShift;
+    for (uint32_t page : pages) {
+        std::memset(cpu->mem.data() + static_cast<size_t>(page) * kPage, 0, kPage);
+    }
+    cpu->track_dirty_pages(true);
+    std::lock_guard<std::mutex> lock(pool_mu_);
+    if (idle_.size() < max_idle_) {
+        idle_.push_back(std::move(cpu));
+    }
+}
+
+RunReply SimServer::run(uint64_t hash, const std::string& input, uint64_t max_steps) {
+    RunReply reply;
+    std::shared_ptr<const AsmResult> program;
+    {
+        std::lock_guard<std::mutex> lock(programs_mu_);
+        auto it = programs_.find(hash);
+        if (it != programs_.end()) {
+            program = it->second.image;
+        }
+    }
+    if (!program) {
+        reply.status = RunReply::UnknownProgram;
+        reply.data = "Unknown program hash";
+        return reply;
+    }
+
+    std::unique_ptr<CPU> cpu = acquire();
+    cpu->r[7] = program->start;
+    cpu->r[6] = 0xFFFE;
+    cpu->load_words(program->start, program->words);
+    size_t pos = 0;
+    cpu->console_in.clear();
+    cpu->console_in.poll_fd = -1;
+    cpu->console_in.source = [&](char* data, size_t len) -> long {
+        size_t n = std::min(len, input.size() - pos);
+        std::memcpy(data, input.data() + pos, n);
+        pos += n;
+        return static_cast<long>(n);
+    };
+    cpu->console_out.sink = [&](const char* data, size_t len) { reply.data.append(data, len); };
+    try {
+        cpu->run(max_steps);
+        reply.status = cpu->halted ? RunReply::Halted : RunReply::Limit;
+    } catch (const std::exception& ex) {
+        cpu->console_out.flush();
+        reply.status = RunReply::Error;
+        reply.data = ex.what();
+    }
+    reply.instructions = cpu->icount;
+    for (int i = 0; i < 8; ++i) {
+        reply.r[i] = cpu->r[i];
+    }
+    reply.psw = cpu->psw_word();
+    cpu->console_in.source = nullptr;
+    cpu->console_out.sink = nullptr;
+    release(std::move(cpu));
+    return reply;
+}
+
+void SimServer::serve_connection(int fd) {
+    // Runs on a detached thread: anything thrown here (say bad_alloc) must
+    // only cost this connection, never the server.
+    try {
+        while (true) {
+            uint8_t op = 0;
+            if (!get(fd, op)) {
+                break;
+            }
+            std::string out;
+            if (op == 'L') {
+                std::string source;
+                if (!get_string(fd, source)) {
+                    break;
+                }
+                try {
+                    uint64_t hash = load(source);
+                    put<uint8_t>(out, 0);
+                    put(out, hash);
+                } catch (const std::exception& ex) {
+                    put<uint8_t>(out, RunReply::Error);
+                    put_string(out, ex.what());
+                }
+            } else if (op == 'R') {
+                uint64_t hash = 0;
+                uint64_t max_steps = 0;
+                std::string input;
+                if (!get(fd, hash) || !get(fd, max_steps) || !get_string(fd, input)) {
+                    break;
+                }
+                RunReply reply = run(hash, input, max_steps);
+                put(out, reply.status);
+                put(out, reply.instructions);
+                for (uint16_t reg : reply.r) {
+                    put(out, reg);
+                }
+                put(out, reply.psw);
+                put_string(out, reply.data);
+            } else {
+                break; // unknown request: drop the connection
+            }
+            if (!write_full(fd, out)) {
+                break;
+            }
+        }
+    } catch (const std::exception&) {
+        // Dropped like a malformed request.
+    }
+    ::close(fd);
+}
+
+void SimServer::serve(int listen_fd) {
+    while (true) {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            throw std::runtime_error("Failed to accept connection");
+        }
+        std::thread([this, fd]() { serve_connection(fd); }).detach();
+    }
+}
+
+int SimServer::listen_unix(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int lfd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ::unlink(path.c_str());
+    if (lfd < 0 || ::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(lfd, 64) != 0) {
+        if (lfd >= 0) {
+            ::close(lfd);
+        }
+        throw std::runtime_error("Failed to listen on " + path);
+    }
+    return lfd;
+}
+
+SimClient::SimClient(const std::string& socket_path) {
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + socket_path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        throw std::runtime_error("Failed to connect to " + socket_path);
+    }
+}
+
+SimClient::~SimClient() {
+    ::close(fd_);
+}
+
+uint64_t SimClient::load(const std::string& source) {
+    std::string req;
+    put<uint8_t>(req, 'L');
+    put_string(req, source);
+    uint8_t status = 0;
+    if (!write_full(fd_, req) || !get(fd_, status)) {
+        throw std::runtime_error("Lost connection to server");
+    }
+    if (status != 0) {
+        std::string message;
+        get_string(fd_, message);
+        throw std::runtime_error(message);
+    }
+    uint64_t hash = 0;
+    if (!get(fd_, hash)) {
+        throw std::runtime_error("Lost connection to server");
+    }
+    return hash;
+}
+
+RunReply SimClient::run(uint64_t hash, const std::string& input, uint64_t max_steps) {
+    std::string req;
+    put<uint8_t>(req, 'R');
+    put(req, hash);
+    put(req, max_steps);
+    put_string(req, input);
+    RunReply reply;
+    bool ok = write_full(fd_, req) && get(fd_, reply.status) && get(fd_, reply.instructions);
+    for (int i = 0; ok && i < 8; ++i) {
+        ok = get(fd_, reply.r[i]);
+    }
+    if (!ok || !get(fd_, reply.psw) || !get_string(fd_, reply.data)) {
+        throw std::runtime_error("Lost connection to server");
+    }
+    return reply;
+}
+
+} // namespace pdp11
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "assembler.h"
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// Wire format (all integers little-endian), any number of requests per
+// connection:
+//   load:  'L' u32 len, source          -> u8 0, u64 hash | u8 2, u32 len, message
+//   run:   'R' u64 hash, u64 max_steps,
+//          u32 len, console input       -> u8 status, u64 instructions,
+//                                          u16 R0..R7, u16 PSW, u32 len, data
+// Run status: 0 halted, 1 step limit, 2 runtime error, 3 unknown program.
+// data is the console output, or the error message for status 2 and 3.
+// A string longer than kMaxStringBytes drops the connection.
+constexpr uint32_t kMaxStringBytes = 16u << 20;
+
+// FNV-1a of the assembly source. Programs are cached under it, or under the
+// next free key after it when a different source already holds it.
+uint64_t program_hash(const std::string& source);
+
+struct RunReply {
+    enum Status : uint8_t { Halted = 0, Limit = 1, Error = 2, UnknownProgram = 3 };
+    uint8_t status = Halted;
+    uint64_t instructions = 0;
+    uint16_t r[8]{};
+    uint16_t psw = 0;
+    std::string data;
+};
+
+// Keeps assembled programs and a pool of reset CPUs so a run request costs
+// only the guest's own execution. Connections are served on their own
+// threads; runs share the program cache and the CPU pool.
+class SimServer {
+public:
+    explicit SimServer(size_t max_idle_cpus = 64) : max_idle_(max_idle_cpus) {}
+
+    // Assembles source unless already cached and returns its key. Throws
+    // on assembly errors.
+    uint64_t load(const std::string& source);
+    RunReply run(uint64_t hash, const std::string& input, uint64_t max_steps);
+
+    // Handles requests on fd until the peer closes it, then closes it.
+    void serve_connection(int fd);
+    // Accepts connections forever, one thread each.
+    void serve(int listen_fd);
+    static int listen_unix(const std::string& path);
+
+private:
+    size_t max_idle_;
+    std::mutex programs_mu_;
+    // The source is kept to tell a hash collision from a repeat load.
+    struct Program {
+        std::string source;
+        std::shared_ptr<const AsmResult> image;
+    };
+    std::unordered_map<uint64_t, Program> programs_;
+    std::mutex pool_mu_;
+    std::vector<std::unique_ptr<CPU>> idle_;
+
+    bool find_key(const std::string& source, uint64_t& key) const;
+    std::unique_ptr<CPU> acquire();
+    void release(std::unique_ptr<CPU> cpu);
+};
+
+// Blocking client for the wire format above.
+class SimClient {
+public:
+    explicit SimClient(const std::string& socket_path);
+    ~SimClient();
+    SimClient(const SimClient&) = delete;
+    SimClient& operator=(const SimClient&) = delete;
+
+    uint64_t load(const std::string& source); // throws with the assembler message
+    RunReply run(uint64_t hash, const std::string& input, uint64_t max_steps);
+
+private:
+    int fd_ = -1;
+};
+
+} // namespace pdp11
@@ -0,0 +1,53 @@
+#include "daemon.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace pdp11;
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: pdp11d <socket-path> [--pool=N] [--preload=file.asm]...\n";
+        return 1;
+    }
+
+    std::string socket_path = argv[1];
+    size_t pool = 64;
+    std::vector<std::string> preload;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--pool=", 0) == 0) {
+            pool = std::stoul(arg.substr(7));
+            continue;
+        }
+        if (arg.rfind("--preload=", 0) == 0) {
+            preload.push_back(arg.substr(10));
+            continue;
+        }
+        std::cerr << "Unknown option: " << arg << "\n";
+        return 1;
+    }
+
+    try {
+        SimServer server(pool);
+        for (const auto& path : preload) {
+            std::ifstream in(path);
+            if (!in) {
+                throw std::runtime_error("Failed to open " + path);
+            }
+            std::stringstream source;
+            source << in.rdbuf();
+            uint64_t hash = server.load(source.str());
+            std::cout << path << " " << std::hex << std::setw(16) << std::setfill('0') << hash << std::dec
+                      << "\n";
+        }
+        int lfd = SimServer::listen_unix(socket_path);
+        std::cout << "Listening on " << socket_path << std::endl;
+        server.serve(lfd);
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+}
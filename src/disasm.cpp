@@ -74,6 +74,15 @@ std::string disassemble(const CPU& cpu, uint16_t pc) {
     if (instr == 0x0000) {
         return "HALT";
     }
+    if (instr == 0000001) {
+        return "WAIT";
+    }
+    if (instr == 0000002) {
+        return "RTI";
+    }
+    if (instr == 0000006) {
+        return "RTT";
+    }
 
     if ((instr & 0xFFC0) == 0000100) {
         return "JMP " + format_operand(cpu, instr & 0x3F, pc_next);
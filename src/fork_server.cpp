@@ -0,0 +1,92 @@
+#include "fork_server.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+
+namespace pdp11 {
+
+namespace {
+
+CPU::FileHandle duplicate(const CPU::FileHandle& fh) {
+    CPU::FileHandle copy(fh.is_open() ? ::fcntl(fh.fd, F_DUPFD_CLOEXEC, 0) : -1);
+    copy.offset = fh.offset;
+    copy.append = fh.append;
+    copy.seekable = fh.seekable;
+    return copy;
+}
+
+} // namespace
+
+ForkServer::ForkServer(CPU& cpu, uint16_t entry, uint64_t max_steps) : cpu_(cpu) {
+    cpu_.console_in.clear();
+    cpu_.console_in.poll_fd = -1;
+    cpu_.console_in.source = nullptr;
+    bool had_break = cpu_.breakpoints.count(entry) != 0;
+    cpu_.breakpoints.insert(entry);
+    if (cpu_.r[7] != entry) {
+        cpu_.run(max_steps);
+    }
+    if (!had_break) {
+        cpu_.breakpoints.erase(entry);
+    }
+    if (cpu_.r[7] != entry || cpu_.halted) {
+        throw std::runtime_error("Program did not reach the fork-server entry point");
+    }
+    cpu_.break_hit = false;
+    snapshot_ = cpu_.save_checkpoint();
+    for (const auto& fh : cpu_.files) {
+        files_.push_back(duplicate(fh));
+    }
+    cpu_.track_dirty_pages(true);
+}
+
+ForkServer::~ForkServer() {
+    cpu_.track_dirty_pages(false);
+}
+
+void ForkServer::restore_files() {
+    cpu_.files.resize(std::max(cpu_.files.size(), files_.size()));
+    for (size_t i = 0; i < cpu_.files.size(); ++i) {
+        cpu_.files[i].close();
+        if (i < files_.size() && files_[i].is_open()) {
+            cpu_.files[i] = duplicate(files_[i]);
+        }
+    }
+    cpu_.files.resize(files_.size());
+}
+
+ForkServer::Result ForkServer::run(const std::string& input, uint64_t max_steps) {
+    // A request left in flight by the previous input would otherwise
+    // complete into this one's memory.
+    cpu_.cancel_async();
+    cpu_.restore_dirty(snapshot_);
+    restore_files();
+    cpu_.break_hit = false;
+    cpu_.watch_hit = false;
+
+    Result result;
+    size_t pos = 0;
+    cpu_.console_in.clear();
+    cpu_.console_in.source = [&](char* data, size_t len) -> long {
+        size_t n = std::min(len, input.size() - pos);
+        std::memcpy(data, input.data() + pos, n);
+        pos += n;
+        return static_cast<long>(n);
+    };
+    cpu_.console_out.sink = [&](const char* data, size_t len) { result.output.append(data, len); };
+    try {
+        cpu_.run(max_steps);
+        result.halted = cpu_.halted;
+    } catch (const std::exception& ex) {
+        result.error = ex.what();
+    }
+    cpu_.console_out.flush();
+    result.instructions = cpu_.icount - snapshot_.icount;
+    cpu_.console_in.source = nullptr;
+    cpu_.console_out.sink = nullptr;
+    return result;
+}
+
+} // namespace pdp11
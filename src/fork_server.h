@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// Runs a program once up to an entry point and then serves any number of
+// inputs from that state. Each run starts by copying back only the pages
+// the previous run dirtied, so per-input cost is independent of assembly,
+// load and startup work.
+class ForkServer {
+public:
+    struct Result {
+        bool halted = false;
+        std::string error; // runtime error; empty on success
+        std::string output;
+        uint64_t instructions = 0; // executed after the entry point
+    };
+
+    // Runs cpu until the PC reaches entry, with no console input, and takes
+    // the snapshot there. Throws if the program halts or stops first.
+    ForkServer(CPU& cpu, uint16_t entry, uint64_t max_steps);
+    ~ForkServer();
+    ForkServer(const ForkServer&) = delete;
+    ForkServer& operator=(const ForkServer&) = delete;
+
+    // Restores the snapshot (memory, file mappings and open files) and runs
+    // with `input` as the console input. Asynchronous requests still in
+    // flight from the previous run are dropped undelivered.
+    Result run(const std::string& input, uint64_t max_steps);
+
+private:
+    CPU& cpu_;
+    CPU::Checkpoint snapshot_;
+    // Files open at the entry point, as duplicated descriptors; -1 if closed.
+    std::vector<CPU::FileHandle> files_;
+
+    void restore_files();
+};
+
+} // namespace pdp11
@@ -0,0 +1,195 @@
+#include "fuzz.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace pdp11 {
+
+namespace {
+
+// Hit counts fold into one bit per range, so a loop running a few more times
+// does not count as new coverage but 1 vs 2 vs many iterations does.
+struct BucketTable {
+    uint8_t bit[256];
+    BucketTable() {
+        for (int count = 0; count < 256; ++count) {
+            uint8_t b = 0;
+            if (count >= 128) {
+                b = 128;
+            } else if (count >= 32) {
+                b = 64;
+            } else if (count >= 16) {
+                b = 32;
+            } else if (count >= 8) {
+                b = 16;
+            } else if (count >= 4) {
+                b = 8;
+            } else if (count == 3) {
+                b = 4;
+            } else {
+                b = static_cast<uint8_t>(count); // 0, 1, 2
+            }
+            bit[count] = b;
+        }
+    }
+};
+
+const BucketTable kBuckets;
+
+const uint8_t kInteresting[] = {0, 1, 0x7F, 0x80, 0xFF, '\n', ' ', '-', '0', '9', 'A', 'z'};
+
+} // namespace
+
+Fuzzer::Fuzzer(ForkServer& server, CPU& cpu, FuzzOptions options)
+    : server_(server), cpu_(cpu), options_(std::move(options)), rng_(options_.seed),
+      trace_(CPU::kEdgeMapSize), seen_(CPU::kEdgeMapSize), seen_crash_(CPU::kEdgeMapSize) {
+    if (!options_.input_file.empty()) {
+        input_fd_ = ::open(options_.input_file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (input_fd_ < 0) {
+            throw std::runtime_error("Failed to open fuzz input file: " + options_.input_file);
+        }
+    }
+    cpu_.edge_map = trace_.data();
+}
+
+Fuzzer::~Fuzzer() {
+    cpu_.edge_map = nullptr;
+    if (input_fd_ >= 0) {
+        ::close(input_fd_);
+    }
+}
+
+bool Fuzzer::add_seed(const std::string& input) {
+    return execute(input.size() > options_.max_len ? input.substr(0, options_.max_len) : input);
+}
+
+bool Fuzzer::fuzz_one() {
+    return execute(mutate());
+}
+
+bool Fuzzer::execute(const std::string& input) {
+    if (input_fd_ >= 0) {
+        if (::ftruncate(input_fd_, 0) != 0 ||
+            ::pwrite(input_fd_, input.data(), input.size(), 0) != static_cast<ssize_t>(input.size())) {
+            throw std::runtime_error("Failed to write fuzz input file: " + options_.input_file);
+        }
+    }
+    std::memset(trace_.data(), 0, trace_.size());
+    ForkServer::Result result = server_.run(input, options_.max_steps);
+    ++stats_.execs;
+    if (!result.error.empty()) {
+        ++stats_.errors;
+        if (merge_new_bits(seen_crash_, nullptr) || crashes_.empty()) {
+            crashes_.push_back({input, result.error});
+            return true;
+        }
+        return false;
+    }
+    if (!result.halted) {
+        ++stats_.timeouts;
+        return false;
+    }
+    if (merge_new_bits(seen_, &stats_.edges)) {
+        corpus_.push_back(input);
+        return true;
+    }
+    return false;
+}
+
+bool Fuzzer::merge_new_bits(std::vector<uint8_t>& seen, size_t* edges) {
+    bool found = false;
+    for (size_t i = 0; i < trace_.size(); i += 8) {
+        uint64_t word;
+        std::memcpy(&word, &trace_[i], 8);
+        if (word == 0) {
+            continue; // most of the map is untouched
+        }
+        for (size_t j = i; j < i + 8; ++j) {
+            uint8_t bits = kBuckets.bit[trace_[j]];
+            if ((bits & ~seen[j]) == 0) {
+                continue;
+            }
+            if (edges && seen[j] == 0) {
+                ++*edges;
+            }
+            seen[j] |= bits;
+            found = true;
+        }
+    }
+    return found;
+}
+
+std::string Fuzzer::mutate() {
+    std::string data = corpus_.empty() ? std::string() : corpus_[below(corpus_.size())];
+    size_t ops = size_t{1} << (1 + below(4));
+    for (size_t i = 0; i < ops; ++i) {
+        size_t op = below(8);
+        if (data.empty() && op != 7) {
+            op = 5; // only insertion makes sense
+        }
+        switch (op) {
+        case 0: { // flip a bit
+            size_t bit = below(data.size() * 8);
+            data[bit >> 3] = static_cast<char>(data[bit >> 3] ^ (1 << (bit & 7)));
+            break;
+        }
+        case 1: // interesting byte
+            data[below(data.size())] = static_cast<char>(kInteresting[below(sizeof(kInteresting))]);
+            break;
+        case 2: // random byte
+            data[below(data.size())] = static_cast<char>(rng_());
+            break;
+        case 3: { // small add/subtract
+            size_t pos = below(data.size());
+            data[pos] = static_cast<char>(data[pos] + static_cast<int>(below(35)) - 17);
+            break;
+        }
+        case 4: { // delete a block
+            size_t pos = below(data.size());
+            data.erase(pos, 1 + below(std::min<size_t>(data.size() - pos, 16)));
+            break;
+        }
+        case 5: { // insert a copy of a block, or new bytes
+            size_t pos = below(data.size() + 1);
+            if (!data.empty() && below(2) == 0) {
+                size_t from = below(data.size());
+                size_t len = 1 + below(std::min<size_t>(data.size() - from, 16));
+                data.insert(pos, data.substr(from, len));
+            } else {
+                size_t len = 1 + below(4);
+                for (size_t k = 0; k < len; ++k) {
+                    char c = below(2) == 0 ? static_cast<char>(kInteresting[below(sizeof(kInteresting))])
+                                           : static_cast<char>(rng_());
+                    data.insert(data.begin() + static_cast<std::ptrdiff_t>(pos + k), c);
+                }
+            }
+            break;
+        }
+        case 6: { // overwrite a block with another part of the input
+            size_t from = below(data.size());
+            size_t to = below(data.size());
+            size_t len = 1 + below(std::min<size_t>(data.size() - std::max(from, to), 16));
+            data.replace(to, len, data.substr(from, len));
+            break;
+        }
+        default: { // splice with another corpus entry
+            if (corpus_.size() < 2) {
+                break;
+            }
+            const std::string& other = corpus_[below(corpus_.size())];
+            data = data.substr(0, below(data.size() + 1)) + other.substr(below(other.size() + 1));
+            break;
+        }
+        }
+    }
+    if (data.size() > options_.max_len) {
+        data.resize(options_.max_len);
+    }
+    return data;
+}
+
+} // namespace pdp11
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fork_server.h"
+#include "pdp11.h"
+
+namespace pdp11 {
+
+struct FuzzOptions {
+    uint64_t max_steps = 100000; // per input; runs that hit it are timeouts
+    size_t max_len = 4096;       // mutated inputs are truncated to this
+    uint64_t seed = 1;
+    // When set, each input is also written here before it runs, for guests
+    // that read it through the file TRAPs instead of the console.
+    std::string input_file;
+};
+
+// Coverage-guided mutational fuzzer over a ForkServer. Each execution
+// restores the entry-point snapshot, runs one input and collects the CPU's
+// edge map. Inputs whose bucketed edge counts set a bit no earlier input
+// set are kept in the corpus; runtime errors are kept as crashes.
+class Fuzzer {
+public:
+    struct Crash {
+        std::string input;
+        std::string error;
+    };
+    struct Stats {
+        uint64_t execs = 0;
+        uint64_t timeouts = 0;
+        uint64_t errors = 0; // all erroring runs, including duplicates
+        size_t edges = 0;    // distinct edges seen
+    };
+
+    // server must have been built on cpu. The fuzzer owns cpu.edge_map
+    // until it is destroyed.
+    Fuzzer(ForkServer& server, CPU& cpu, FuzzOptions options);
+    ~Fuzzer();
+    Fuzzer(const Fuzzer&) = delete;
+    Fuzzer& operator=(const Fuzzer&) = delete;
+
+    // Runs input unmodified; returns true if it was added to the corpus.
+    bool add_seed(const std::string& input);
+    // Mutates a corpus entry and runs it; returns true if it was added to
+    // the corpus or the crash list.
+    bool fuzz_one();
+
+    const std::vector<std::string>& corpus() const { return corpus_; }
+    const std::vector<Crash>& crashes() const { return crashes_; }
+    const Stats& stats() const { return stats_; }
+
+private:
+    ForkServer& server_;
+    CPU& cpu_;
+    FuzzOptions options_;
+    int input_fd_ = -1;
+    std::mt19937_64 rng_;
+    std::vector<uint8_t> trace_;      // this run's edge hit counts
+    std::vector<uint8_t> seen_;       // bucket bits seen by any kept input
+    std::vector<uint8_t> seen_crash_; // bucket bits seen by any crash
+    std::vector<std::string> corpus_;
+    std::vector<Crash> crashes_;
+    Stats stats_;
+
+    bool execute(const std::string& input);
+    // Adds this run's bucket bits to seen; true if any were new.
+    bool merge_new_bits(std::vector<uint8_t>& seen, size_t* edges);
+    std::string mutate();
+    size_t below(size_t n) { return n == 0 ? 0 : static_cast<size_t>(rng_() % n); }
+};
+
+} // namespace pdp11
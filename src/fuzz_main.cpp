@@ -0,0 +1,158 @@
+#include "assembler.h"
+#include "cli.h"
+#include "fork_server.h"
+#include "fuzz.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <dirent.h>
+
+using namespace pdp11;
+
+static std::vector<std::string> read_dir(const std::string& dir) {
+    std::vector<std::string> files;
+    DIR* d = ::opendir(dir.c_str());
+    if (!d) {
+        return files;
+    }
+    while (dirent* e = ::readdir(d)) {
+        if (e->d_name[0] != '.') {
+            files.push_back(dir + "/" + e->d_name);
+        }
+    }
+    ::closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static void write_file(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: pdp11fuzz <file.asm> [--entry=label|addr] [--corpus=dir] [--crashes=dir]"
+                     " [--input-file=path] [--max-steps=N] [--max-len=N] [--runs=N] [--seconds=N]"
+                     " [--seed=N]\n";
+        return 1;
+    }
+
+    std::string program = argv[1];
+    std::string entry_spec;
+    std::string corpus_dir;
+    std::string crash_dir;
+    FuzzOptions options;
+    uint64_t runs = 0;
+    double seconds = 0;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--entry=", 0) == 0) {
+            entry_spec = arg.substr(8);
+        } else if (arg.rfind("--corpus=", 0) == 0) {
+            corpus_dir = arg.substr(9);
+        } else if (arg.rfind("--crashes=", 0) == 0) {
+            crash_dir = arg.substr(10);
+        } else if (arg.rfind("--input-file=", 0) == 0) {
+            options.input_file = arg.substr(13);
+        } else if (arg.rfind("--max-steps=", 0) == 0) {
+            options.max_steps = std::stoull(arg.substr(12));
+        } else if (arg.rfind("--max-len=", 0) == 0) {
+            options.max_len = std::stoull(arg.substr(10));
+        } else if (arg.rfind("--runs=", 0) == 0) {
+            runs = std::stoull(arg.substr(7));
+        } else if (arg.rfind("--seconds=", 0) == 0) {
+            seconds = std::stod(arg.substr(10));
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.seed = std::stoull(arg.substr(7));
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        Assembler asmblr;
+        AsmResult res = asmblr.assemble_file(program);
+        CPU cpu;
+        cpu.reset();
+        cpu.r[7] = res.start;
+        cpu.r[6] = 0xFFFE;
+        cpu.load_words(res.start, res.words);
+        cpu.console_out.sink = [](const char* data, size_t len) { std::fwrite(data, 1, len, stderr); };
+
+        uint16_t entry = resolve_entry(entry_spec, res);
+        ForkServer server(cpu, entry, options.max_steps);
+        Fuzzer fuzzer(server, cpu, options);
+
+        size_t saved_corpus = 0;
+        size_t saved_crashes = 0;
+        auto save_new = [&]() {
+            for (; saved_corpus < fuzzer.corpus().size(); ++saved_corpus) {
+                if (!corpus_dir.empty()) {
+                    std::ostringstream name;
+                    name << corpus_dir << "/id-" << std::setw(6) << std::setfill('0') << saved_corpus;
+                    write_file(name.str(), fuzzer.corpus()[saved_corpus]);
+                }
+            }
+            for (; saved_crashes < fuzzer.crashes().size(); ++saved_crashes) {
+                const Fuzzer::Crash& crash = fuzzer.crashes()[saved_crashes];
+                std::cout << "crash " << saved_crashes << ": " << crash.error << "\n";
+                if (!crash_dir.empty()) {
+                    std::ostringstream name;
+                    name << crash_dir << "/crash-" << std::setw(6) << std::setfill('0') << saved_crashes;
+                    write_file(name.str(), crash.input);
+                }
+            }
+        };
+
+        std::vector<std::string> seeds = corpus_dir.empty() ? std::vector<std::string>() : read_dir(corpus_dir);
+        fuzzer.add_seed("");
+        for (const auto& path : seeds) {
+            std::ifstream in(path, std::ios::binary);
+            fuzzer.add_seed(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()));
+        }
+        // Seeds already on disk are not written back.
+        saved_corpus = fuzzer.corpus().size();
+        save_new();
+
+        auto start = std::chrono::steady_clock::now();
+        auto next_report = start + std::chrono::seconds(1);
+        auto report = [&](double elapsed) {
+            const Fuzzer::Stats& st = fuzzer.stats();
+            std::cout << "execs=" << st.execs << " corpus=" << fuzzer.corpus().size()
+                      << " edges=" << st.edges << " crashes=" << fuzzer.crashes().size()
+                      << " timeouts=" << st.timeouts << std::fixed << std::setprecision(0)
+                      << " execs/s=" << (elapsed > 0 ? st.execs / elapsed : 0.0) << "\n";
+        };
+        for (uint64_t n = 0; runs == 0 || n < runs; ++n) {
+            if (fuzzer.fuzz_one()) {
+                save_new();
+            }
+            if ((n & 1023) == 0) {
+                auto now = std::chrono::steady_clock::now();
+                double elapsed = std::chrono::duration<double>(now - start).count();
+                if (now >= next_report) {
+                    report(elapsed);
+                    next_report = now + std::chrono::seconds(1);
+                }
+                if (seconds > 0 && elapsed >= seconds) {
+                    break;
+                }
+            }
+        }
+        report(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        return fuzzer.crashes().empty() ? 0 : 2;
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << "\n";
+        return 1;
+    }
+}
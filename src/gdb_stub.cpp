@@ -0,0 +1,539 @@
+#include "gdb_stub.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pdp11 {
+
+static const char kHex[] = "0123456789abcdef";
+
+static int hex_val(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return 10 + (c - 'a');
+    if (c >= 'A' && c <= 'F') return 10 + (c - 'A');
+    return -1;
+}
+
+static uint32_t parse_hex(const std::string& s, size_t& pos) {
+    uint32_t v = 0;
+    while (pos < s.size() && hex_val(s[pos]) >= 0) {
+        v = (v << 4) | static_cast<uint32_t>(hex_val(s[pos]));
+        ++pos;
+    }
+    return v;
+}
+
+static void append_hex_byte(std::string& out, uint8_t b) {
+    out.push_back(kHex[b >> 4]);
+    out.push_back(kHex[b & 0xF]);
+}
+
+GdbStub::GdbStub(CPU& cpu, int fd) : cpu_(cpu), fd_(fd) {}
+
+int GdbStub::listen_and_accept(const std::string& spec) {
+    int lfd = -1;
+    if (spec.rfind("unix:", 0) == 0) {
+        std::string path = spec.substr(5);
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("GDB socket path too long: " + path);
+        }
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        ::unlink(path.c_str());
+        if (lfd < 0 || ::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("Failed to bind GDB socket: " + path);
+        }
+    } else {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(std::stoul(spec)));
+        lfd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        if (lfd >= 0) {
+            ::setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (lfd < 0 || ::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("Failed to bind GDB port: " + spec);
+        }
+    }
+    if (::listen(lfd, 1) != 0) {
+        ::close(lfd);
+        throw std::runtime_error("Failed to listen on GDB socket: " + spec);
+    }
+    std::fprintf(stderr, "Waiting for GDB on %s\n", spec.c_str());
+    int fd = ::accept(lfd, nullptr, nullptr);
+    ::close(lfd);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to accept GDB connection");
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+int GdbStub::read_byte(int timeout_ms) {
+    if (inpos_ < inbuf_.size()) {
+        return static_cast<uint8_t>(inbuf_[inpos_++]);
+    }
+    pollfd pfd{fd_, POLLIN, 0};
+    int rc = ::poll(&pfd, 1, timeout_ms);
+    if (rc == 0) {
+        return -2; // timeout
+    }
+    if (rc < 0) {
+        return errno == EINTR ? -2 : -1;
+    }
+    char buf[4096];
+    ssize_t n = ::read(fd_, buf, sizeof(buf));
+    if (n <= 0) {
+        return -1;
+    }
+    inbuf_.assign(buf, static_cast<size_t>(n));
+    inpos_ = 1;
+    return static_cast<uint8_t>(buf[0]);
+}
+
+void GdbStub::unread_byte(char c) {
+    // Every byte handed out came from inbuf_, so there is room before inpos_.
+    inbuf_[--inpos_] = c;
+}
+
+bool GdbStub::write_all(const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = ::write(fd_, data.data() + off, data.size() - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool GdbStub::read_packet(std::string& packet) {
+    while (true) {
+        int c = read_byte(-1);
+        if (c < 0) {
+            return false;
+        }
+        if (c == 0x03) {
+            interrupted_ = true;
+            continue;
+        }
+        if (c != '$') {
+            continue; // acks and noise
+        }
+        packet.clear();
+        uint8_t sum = 0;
+        while (true) {
+            c = read_byte(-1);
+            if (c < 0) {
+                return false;
+            }
+            if (c == '#') {
+                break;
+            }
+            sum = static_cast<uint8_t>(sum + c);
+            packet.push_back(static_cast<char>(c));
+        }
+        int h = read_byte(-1);
+        int l = read_byte(-1);
+        if (h < 0 || l < 0) {
+            return false;
+        }
+        bool ok = hex_val(static_cast<char>(h)) * 16 + hex_val(static_cast<char>(l)) == sum;
+        if (!no_ack_) {
+            if (!write_all(ok ? "+" : "-")) {
+                return false;
+            }
+        }
+        if (ok) {
+            return true;
+        }
+    }
+}
+
+bool GdbStub::send_packet(const std::string& payload) {
+    uint8_t sum = 0;
+    for (char c : payload) {
+        sum = static_cast<uint8_t>(sum + static_cast<uint8_t>(c));
+    }
+    std::string frame = "$" + payload + "#";
+    append_hex_byte(frame, sum);
+    while (true) {
+        if (!write_all(frame)) {
+            return false;
+        }
+        if (no_ack_) {
+            return true;
+        }
+        int c = read_byte(-1);
+        while (c == 0x03) {
+            interrupted_ = true;
+            c = read_byte(-1);
+        }
+        if (c < 0) {
+            return false;
+        }
+        if (c == '+') {
+            return true;
+        }
+        if (c != '-') {
+            // Not an ack: keep it for the next packet read.
+            unread_byte(static_cast<char>(c));
+            return true;
+        }
+    }
+}
+
+bool GdbStub::interrupt_pending() {
+    if (interrupted_) {
+        return true;
+    }
+    while (true) {
+        int c = read_byte(0);
+        if (c == -2) {
+            return false;
+        }
+        if (c < 0) {
+            done_ = true;
+            outcome_ = Outcome::Disconnected;
+            return true;
+        }
+        if (c == 0x03) {
+            interrupted_ = true;
+            return true;
+        }
+        if (c == '$') {
+            // A new packet while running: leave it for read_packet.
+            unread_byte('$');
+            return false;
+        }
+    }
+}
+
+uint16_t GdbStub::read_reg(int n) const {
+    if (n < 8) {
+        return cpu_.r[n];
+    }
+    return cpu_.psw_word();
+}
+
+void GdbStub::write_reg(int n, uint16_t v) {
+    if (n < 8) {
+        cpu_.r[n] = v;
+        return;
+    }
+    cpu_.set_psw_word(v);
+}
+
+std::string GdbStub::read_registers() const {
+    std::string out;
+    for (int i = 0; i < 9; ++i) {
+        uint16_t v = read_reg(i);
+        append_hex_byte(out, static_cast<uint8_t>(v & 0xFF));
+        append_hex_byte(out, static_cast<uint8_t>(v >> 8));
+    }
+    return out;
+}
+
+void GdbStub::write_registers(const std::string& hex) {
+    for (int i = 0; i < 9 && static_cast<size_t>(i * 4 + 4) <= hex.size(); ++i) {
+        const char* p = hex.data() + i * 4;
+        uint16_t lo = static_cast<uint16_t>(hex_val(p[0]) * 16 + hex_val(p[1]));
+        uint16_t hi = static_cast<uint16_t>(hex_val(p[2]) * 16 + hex_val(p[3]));
+        write_reg(i, static_cast<uint16_t>(lo | (hi << 8)));
+    }
+}
+
+std::string GdbStub::read_memory(uint32_t addr, uint32_t len) const {
+    std::string out;
+    out.reserve(len * 2);
+    for (uint32_t i = 0; i < len; ++i) {
+        append_hex_byte(out, cpu_.mem[(addr + i) & (CPU::kMemSize - 1)]);
+    }
+    return out;
+}
+
+void GdbStub::write_memory(uint32_t addr, const std::string& bytes) {
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        uint32_t p = (addr + i) & (CPU::kMemSize - 1);
+        if (!cpu_.mem.read_only(p >> 16)) {
+            cpu_.mem[p] = static_cast<uint8_t>(bytes[i]);
+            cpu_.mark_dirty(p, 1);
+        }
+    }
+}
+
+std::string GdbStub::set_breakpoint(const std::string& args, bool insert) {
+    // args: "type,addr,kind"
+    size_t pos = 0;
+    uint32_t type = parse_hex(args, pos);
+    if (pos >= args.size() || args[pos] != ',') {
+        return "E01";
+    }
+    ++pos;
+    uint32_t addr = parse_hex(args, pos);
+    uint32_t kind = 2;
+    if (pos < args.size() && args[pos] == ',') {
+        ++pos;
+        kind = parse_hex(args, pos);
+    }
+    switch (type) {
+        case 0:
+        case 1:
+            if (insert) {
+                cpu_.breakpoints.insert(static_cast<uint16_t>(addr));
+            } else {
+                cpu_.breakpoints.erase(static_cast<uint16_t>(addr));
+            }
+            return "OK";
+        case 2:
+        case 3:
+        case 4:
+            if (insert) {
+                cpu_.add_watchpoint(addr, kind, type != 2, type != 3);
+            } else {
+                cpu_.clear_watchpoint(addr & (CPU::kMemSize - 1));
+            }
+            return "OK";
+        default:
+            return "";
+    }
+}
+
+std::string GdbStub::stop_reply() const {
+    if (cpu_.halted) {
+        return "W00"; // HALT ends the guest like a process exit
+    }
+    if (cpu_.watch_hit) {
+        std::string out = "T05";
+        out += cpu_.watch_write ? "watch:" : "rwatch:";
+        char buf[16];
+        std::snprintf(buf, sizeof(buf), "%x;", cpu_.watch_addr);
+        out += buf;
+        return out;
+    }
+    if (cpu_.break_hit) {
+        return "T05swbreak:;";
+    }
+    char buf[4];
+    std::snprintf(buf, sizeof(buf), "S%02x", stop_signal_);
+    return buf;
+}
+
+std::string GdbStub::resume(bool single) {
+    cpu_.break_hit = false;
+    cpu_.watch_hit = false;
+    interrupted_ = false;
+    stop_signal_ = kSigTrap;
+    if (cpu_.halted) {
+        return stop_reply();
+    }
+    try {
+        // Move off a breakpoint at the current PC before running at full speed.
+        cpu_.step();
+        if (single || cpu_.halted || cpu_.watch_hit) {
+            return stop_reply();
+        }
+        while (!cpu_.halted) {
+            cpu_.run(kRunSlice);
+            if (cpu_.break_hit || cpu_.watch_hit) {
+                break;
+            }
+            if (interrupt_pending()) {
+                stop_signal_ = kSigInt;
+                break;
+            }
+        }
+    } catch (const std::exception&) {
+        // A runtime error in the guest (bad TRAP, odd address, ...).
+        stop_signal_ = kSigIll;
+    }
+    interrupted_ = false;
+    return done_ ? std::string() : stop_reply();
+}
+
+std::string GdbStub::handle(const std::string& pkt) {
+    if (pkt.empty()) {
+        return "";
+    }
+    switch (pkt[0]) {
+        case '?':
+            return stop_reply();
+        case 'g':
+            return read_registers();
+        case 'G':
+            write_registers(pkt.substr(1));
+            return "OK";
+        case 'p': {
+            size_t pos = 1;
+            uint32_t n = parse_hex(pkt, pos);
+            if (n > 8) {
+                return "E01";
+            }
+            uint16_t v = read_reg(static_cast<int>(n));
+            std::string out;
+            append_hex_byte(out, static_cast<uint8_t>(v & 0xFF));
+            append_hex_byte(out, static_cast<uint8_t>(v >> 8));
+            return out;
+        }
+        case 'P': {
+            size_t pos = 1;
+            uint32_t n = parse_hex(pkt, pos);
+            if (n > 8 || pos + 5 > pkt.size() || pkt[pos] != '=') {
+                return "E01";
+            }
+            const char* p = pkt.data() + pos + 1;
+            uint16_t lo = static_cast<uint16_t>(hex_val(p[0]) * 16 + hex_val(p[1]));
+            uint16_t hi = static_cast<uint16_t>(hex_val(p[2]) * 16 + hex_val(p[3]));
+            write_reg(static_cast<int>(n), static_cast<uint16_t>(lo | (hi << 8)));
+            return "OK";
+        }
+        case 'm': {
+            size_t pos = 1;
+            uint32_t addr = parse_hex(pkt, pos);
+            if (pos >= pkt.size() || pkt[pos] != ',') {
+                return "E01";
+            }
+            ++pos;
+            uint32_t len = parse_hex(pkt, pos);
+            return read_memory(addr, std::min<uint32_t>(len, 0x2000));
+        }
+        case 'M':
+        case 'X': {
+            size_t pos = 1;
+            uint32_t addr = parse_hex(pkt, pos);
+            if (pos >= pkt.size() || pkt[pos] != ',') {
+                return "E01";
+            }
+            ++pos;
+            uint32_t len = parse_hex(pkt, pos);
+            if (pos >= pkt.size() || pkt[pos] != ':') {
+                return len == 0 ? "OK" : "E01";
+            }
+            ++pos;
+            std::string bytes;
+            bytes.reserve(len);
+            if (pkt[0] == 'M') {
+                for (; pos + 1 < pkt.size() && bytes.size() < len; pos += 2) {
+                    bytes.push_back(static_cast<char>(hex_val(pkt[pos]) * 16 + hex_val(pkt[pos + 1])));
+                }
+            } else {
+                for (; pos < pkt.size() && bytes.size() < len; ++pos) {
+                    char c = pkt[pos];
+                    if (c == '}' && pos + 1 < pkt.size()) {
+                        c = static_cast<char>(pkt[++pos] ^ 0x20);
+                    }
+                    bytes.push_back(c);
+                }
+            }
+            write_memory(addr, bytes);
+            return "OK";
+        }
+        case 'Z':
+        case 'z':
+            return set_breakpoint(pkt.substr(1), pkt[0] == 'Z');
+        case 'c':
+        case 's': {
+            if (pkt.size() > 1) {
+                size_t pos = 1;
+                cpu_.r[7] = static_cast<uint16_t>(parse_hex(pkt, pos));
+            }
+            return resume(pkt[0] == 's');
+        }
+        case 'v':
+            if (pkt == "vCont?") {
+                return "vCont;c;C;s;S";
+            }
+            if (pkt.rfind("vCont;", 0) == 0) {
+                char action = pkt.size() > 6 ? pkt[6] : 'c';
+                return resume(action == 's' || action == 'S');
+            }
+            if (pkt.rfind("vKill", 0) == 0) {
+                done_ = true;
+                outcome_ = Outcome::Killed;
+                return "OK";
+            }
+            return "";
+        case 'H':
+            return "OK";
+        case 'T':
+            return "OK";
+        case 'k':
+            done_ = true;
+            outcome_ = Outcome::Killed;
+            return "";
+        case 'D':
+            done_ = true;
+            outcome_ = Outcome::Detached;
+            return "OK";
+        case 'q':
+            if (pkt.rfind("qSupported", 0) == 0) {
+                return "PacketSize=4000;swbreak+;hwbreak+;QStartNoAckMode+";
+            }
+            if (pkt == "qAttached") {
+                return "1";
+            }
+            if (pkt == "qC") {
+                return "QC1";
+            }
+            if (pkt == "qfThreadInfo") {
+                return "m1";
+            }
+            if (pkt == "qsThreadInfo") {
+                return "l";
+            }
+            return "";
+        case 'Q':
+            if (pkt == "QStartNoAckMode") {
+                send_packet("OK");
+                no_ack_ = true;
+                return std::string(1, '\0');
+            }
+            return "";
+        default:
+            return "";
+    }
+}
+
+GdbStub::Outcome GdbStub::serve() {
+    std::string packet;
+    while (!done_) {
+        if (!read_packet(packet)) {
+            return Outcome::Disconnected;
+        }
+        std::string reply = handle(packet);
+        if (done_ && outcome_ == Outcome::Disconnected) {
+            break;
+        }
+        if (reply.size() == 1 && reply[0] == '\0') {
+            continue; // already answered
+        }
+        if (packet == "k") {
+            break; // no reply to kill
+        }
+        if (!send_packet(reply)) {
+            return Outcome::Disconnected;
+        }
+    }
+    return outcome_;
+}
+
+} // namespace pdp11
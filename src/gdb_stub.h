@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// GDB remote serial protocol server for one CPU over a connected socket.
+//
+// Registers are R0-R7 followed by the PSW, 16 bits each. Memory addresses are
+// physical (bank << 16 | addr), so bank 0 matches the code address space.
+// Continue runs the guest through CPU::run() in large slices and only polls
+// the socket for an interrupt (Ctrl-C) between slices. Stops are reported as
+// SIGTRAP, SIGINT after Ctrl-C and SIGILL after a runtime error; a guest
+// HALT is reported as an exit (W00).
+class GdbStub {
+public:
+    enum class Outcome {
+        Detached,
+        Killed,
+        Disconnected
+    };
+
+    GdbStub(CPU& cpu, int fd);
+
+    Outcome serve();
+
+    // Listens on "port" (loopback TCP) or "unix:path" and returns the first
+    // accepted connection. Throws on failure.
+    static int listen_and_accept(const std::string& spec);
+
+    static constexpr uint64_t kRunSlice = 1 << 20;
+
+private:
+    CPU& cpu_;
+    int fd_;
+    bool no_ack_ = false;
+    std::string inbuf_; // bytes read from fd_; those before inpos_ are consumed
+    size_t inpos_ = 0;
+
+    // Puts back the byte read_byte() just returned.
+    void unread_byte(char c);
+    bool read_packet(std::string& packet);
+    bool send_packet(const std::string& payload);
+    bool write_all(const std::string& data);
+    int read_byte(int timeout_ms);
+    bool interrupt_pending();
+
+    std::string handle(const std::string& packet);
+    std::string stop_reply() const;
+    std::string read_registers() const;
+    void write_registers(const std::string& hex);
+    std::string read_memory(uint32_t addr, uint32_t len) const;
+    void write_memory(uint32_t addr, const std::string& bytes);
+    std::string set_breakpoint(const std::string& args, bool insert);
+    std::string resume(bool step);
+
+    uint16_t read_reg(int n) const;
+    void write_reg(int n, uint16_t v);
+
+    bool done_ = false;
+    Outcome outcome_ = Outcome::Disconnected;
+    bool interrupted_ = false;
+
+    // Signal numbers as GDB knows them, for S stop replies.
+    static constexpr int kSigInt = 2;
+    static constexpr int kSigIll = 4;
+    static constexpr int kSigTrap = 5;
+    int stop_signal_ = kSigTrap;
+};
+
+} // namespace pdp11
@@ -0,0 +1,158 @@
+#include "lockstep.h"
+#include "disasm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <sstream>
+
+namespace pdp11 {
+
+namespace {
+
+constexpr size_t kHistory = 8;
+
+std::string hex(uint32_t value) {
+    std::ostringstream out;
+    out << "0x" << std::hex << value;
+    return out.str();
+}
+
+void feed_input(CPU& cpu, const std::string& input, size_t& pos, std::string& output) {
+    cpu.console_in.clear();
+    cpu.console_in.poll_fd = -1;
+    cpu.console_in.source = [&input, &pos](char* data, size_t len) -> long {
+        size_t n = std::min(len, input.size() - pos);
+        std::memcpy(data, input.data() + pos, n);
+        pos += n;
+        return static_cast<long>(n);
+    };
+    cpu.console_out.sink = [&output](const char* data, size_t len) { output.append(data, len); };
+}
+
+// Differences between the two states, one per line; empty if none.
+std::string compare(CPU& ref, CPU& cand, const std::string& ref_out, const std::string& cand_out,
+                    std::vector<uint32_t>& pages) {
+    std::ostringstream diff;
+    auto field = [&](const std::string& name, uint32_t a, uint32_t b) {
+        if (a != b) {
+            diff << "  " << name << ": reference=" << hex(a) << " candidate=" << hex(b) << "\n";
+        }
+    };
+    field("icount", static_cast<uint32_t>(ref.icount), static_cast<uint32_t>(cand.icount));
+    for (int i = 0; i < 8; ++i) {
+        field("R" + std::to_string(i), ref.r[i], cand.r[i]);
+    }
+    field("PSW", ref.psw_word(), cand.psw_word());
+    field("bank", ref.mem_bank, cand.mem_bank);
+    field("halted", ref.halted, cand.halted);
+
+    pages.clear();
+    ref.take_dirty_pages(pages);
+    cand.take_dirty_pages(pages);
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+    constexpr size_t kPage = size_t{1} << CPU::kDirtyPageShift;
+    for (uint32_t page : pages) {
+        size_t base = static_cast<size_t>(page) * kPage;
+        if (std::memcmp(ref.mem.data() + base, cand.mem.data() + base, kPage) == 0) {
+            continue;
+        }
+        for (size_t a = base; a < base + kPage; ++a) {
+            if (ref.mem[a] != cand.mem[a]) {
+                field("mem[" + hex(static_cast<uint32_t>(a)) + "]", ref.mem[a], cand.mem[a]);
+                break;
+            }
+        }
+        break; // the first differing byte is enough
+    }
+
+    ref.console_out.flush();
+    cand.console_out.flush();
+    if (ref_out != cand_out) {
+        size_t at = static_cast<size_t>(
+            std::mismatch(ref_out.begin(), ref_out.end(), cand_out.begin(), cand_out.end()).first - ref_out.begin());
+        diff << "  output differs at byte " << at << " (reference " << ref_out.size() << " bytes, candidate "
+             << cand_out.size() << " bytes)\n";
+    }
+    return diff.str();
+}
+
+} // namespace
+
+LockstepReport run_lockstep(Engine& reference, Engine& candidate, const std::string& input, uint64_t max_steps) {
+    CPU& ref = reference.cpu();
+    CPU& cand = candidate.cpu();
+    std::string ref_out;
+    std::string cand_out;
+    size_t ref_pos = 0;
+    size_t cand_pos = 0;
+    feed_input(ref, input, ref_pos, ref_out);
+    feed_input(cand, input, cand_pos, cand_out);
+    ref.track_dirty_pages(true);
+    cand.track_dirty_pages(true);
+
+    LockstepReport report;
+    std::deque<uint16_t> history; // reference PCs of the latest instructions
+    std::vector<uint32_t> pages;
+    uint64_t start = ref.icount;
+    while (!ref.halted && ref.icount - start < max_steps) {
+        uint64_t before = cand.icount;
+        uint16_t block_pc = cand.r[7];
+        std::string cand_error;
+        try {
+            candidate.advance();
+        } catch (const std::exception& ex) {
+            cand_error = ex.what();
+        }
+        std::string ref_error;
+        while (ref.icount < cand.icount && !ref.halted) {
+            history.push_back(ref.r[7]);
+            if (history.size() > kHistory) {
+                history.pop_front();
+            }
+            try {
+                reference.advance();
+            } catch (const std::exception& ex) {
+                ref_error = ex.what();
+                break;
+            }
+        }
+        report.instructions = ref.icount - start;
+
+        std::string diff = compare(ref, cand, ref_out, cand_out, pages);
+        if (ref_error != cand_error) {
+            diff += "  error: reference=\"" + ref_error + "\" candidate=\"" + cand_error + "\"\n";
+        }
+        if (diff.empty() && cand.icount == before && !cand.halted && cand_error.empty()) {
+            diff = "  candidate made no progress\n";
+        }
+        if (!diff.empty()) {
+            std::ostringstream msg;
+            msg << "Divergence after " << report.instructions << " instructions (" << candidate.name()
+                << " vs " << reference.name() << ", block at PC=" << hex(block_pc) << ")\n"
+                << diff << "Last instructions (reference):\n";
+            for (uint16_t pc : history) {
+                msg << "  " << hex(pc) << "  " << disassemble(ref, pc) << "\n";
+            }
+            report.diverged = true;
+            report.message = msg.str();
+            break;
+        }
+        if (!ref_error.empty()) {
+            report.error = ref_error;
+            break;
+        }
+    }
+    report.halted = ref.halted;
+    report.output = ref_out;
+    ref.console_in.source = nullptr;
+    cand.console_in.source = nullptr;
+    ref.console_out.sink = nullptr;
+    cand.console_out.sink = nullptr;
+    ref.track_dirty_pages(false);
+    cand.track_dirty_pages(false);
+    return report;
+}
+
+} // namespace pdp11
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// One way of executing guest code on a CPU. advance() runs one unit (an
+// instruction, a block, a slice) and must count each instruction in
+// cpu().icount, as CPU::step() does.
+class Engine {
+public:
+    virtual ~Engine() = default;
+    virtual const char* name() const = 0;
+    virtual CPU& cpu() = 0;
+    virtual void advance() = 0;
+};
+
+// The reference: one CPU::step() per advance().
+class StepEngine : public Engine {
+public:
+    explicit StepEngine(CPU& cpu) : cpu_(cpu) {}
+    const char* name() const override { return "step"; }
+    CPU& cpu() override { return cpu_; }
+    void advance() override { cpu_.step(); }
+
+private:
+    CPU& cpu_;
+};
+
+// CPU::run() in slices of block instructions.
+class RunEngine : public Engine {
+public:
+    RunEngine(CPU& cpu, uint64_t block) : cpu_(cpu), block_(block) {}
+    const char* name() const override { return "run"; }
+    CPU& cpu() override { return cpu_; }
+    void advance() override { cpu_.run(block_); }
+
+private:
+    CPU& cpu_;
+    uint64_t block_;
+};
+
+struct LockstepReport {
+    bool diverged = false;
+    bool halted = false;
+    std::string error;         // runtime error both engines raised
+    uint64_t instructions = 0; // executed and compared
+    std::string output;        // reference console output
+    std::string message;       // the first divergence, with recent disassembly
+};
+
+// Runs both engines from the same state on the same console input. After
+// each candidate advance() the reference is stepped to the same icount and
+// the registers, PSW, bank, halt state, console output and every memory page
+// either side wrote are compared. Both CPUs must be loaded identically; the
+// harness takes over their console channels and dirty-page tracking.
+LockstepReport run_lockstep(Engine& reference, Engine& candidate, const std::string& input, uint64_t max_steps);
+
+} // namespace pdp11
@@ -1,39 +1,80 @@
 #include "assembler.h"
+#include "cli.h"
 #include "pdp11.h"
 #include "disasm.h"
+#include "gdb_stub.h"
+#include "coverage.h"
+#include "replay.h"
+#include "fork_server.h"
+#include "lockstep.h"
+#include "multi.h"
+#include "smp.h"
 
+#include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
+#include <unistd.h>
+
 using namespace pdp11;
 
-static uint16_t parse_u16(const std::string& s) {
-    int base = 10;
-    std::string t = s;
-    if (t.rfind("0x", 0) == 0 || t.rfind("0X", 0) == 0) {
-        base = 16;
-        t = t.substr(2);
-    } else if (t.rfind("0o", 0) == 0 || t.rfind("0O", 0) == 0) {
-        base = 8;
-        t = t.substr(2);
-    }
-    return static_cast<uint16_t>(std::stoul(t, nullptr, base));
+static bool read_exact(std::FILE* in, void* data, size_t len) {
+    return len == 0 || std::fread(data, 1, len, in) == len;
 }
 
-static std::string upper(const std::string& s) {
-    std::string out = s;
-    for (char& c : out) {
-        if (c >= 'a' && c <= 'z') {
-            c = static_cast<char>(c - 'a' + 'A');
+static void write_u32(std::FILE* out, uint32_t value) {
+    uint8_t bytes[4] = {static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+                        static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24)};
+    std::fwrite(bytes, 1, 4, out);
+}
+
+// Fork-server mode: run each input file, or each length-prefixed record on
+// stdin, from the snapshot at the entry point.
+static int serve_inputs(ForkServer& server, const std::vector<std::string>& input_paths,
+                        uint64_t max_steps) {
+    if (!input_paths.empty()) {
+        for (const auto& input_path : input_paths) {
+            std::ifstream in(input_path, std::ios::binary);
+            if (!in) {
+                throw std::runtime_error("Failed to open input: " + input_path);
+            }
+            std::string input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            ForkServer::Result r = server.run(input, max_steps);
+            std::cout << "== " << input_path << ": "
+                      << (!r.error.empty() ? "ERROR " + r.error : (r.halted ? "HALT" : "LIMIT"))
+                      << " steps=" << r.instructions << " ==\n"
+                      << r.output;
+            if (!r.output.empty() && r.output.back() != '\n') {
+                std::cout << "\n";
+            }
         }
+        return 0;
+    }
+    // Request: u32 length + bytes. Reply: u32 status (0=halt, 1=step limit,
+    // 2=error), u32 length + output (or the error message). All little-endian.
+    while (true) {
+        uint8_t header[4];
+        if (!read_exact(stdin, header, 4)) {
+            return 0;
+        }
+        uint32_t len = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<uint32_t>(header[3]) << 24);
+        std::string input(len, '\0');
+        if (!read_exact(stdin, &input[0], len)) {
+            throw std::runtime_error("Truncated fork-server request");
+        }
+        ForkServer::Result r = server.run(input, max_steps);
+        const std::string& body = r.error.empty() ? r.output : r.error;
+        write_u32(stdout, !r.error.empty() ? 2 : (r.halted ? 0 : 1));
+        write_u32(stdout, static_cast<uint32_t>(body.size()));
+        std::fwrite(body.data(), 1, body.size(), stdout);
+        std::fflush(stdout);
     }
-    return out;
 }
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cerr << "Usage: pdp11sim <file.asm> [max_steps] [--trace] [--trace-mem] [--watch=addr[:len]] [--map file] [--dump-symbols] [--break=label|0xADDR]\n";
+        std::cerr << "Usage: pdp11sim <file.asm> [max_steps] [--trace] [--trace-mem] [--watch=addr[:len]] [--map file] [--dump-symbols] [--break=label|0xADDR[,if=cond][,ignore=N]] [--watchpoint=r|w|rw:0xPHYS[:len][,if=cond]] [--coverage=file.info] [--record=file|--replay=file] [--checkpoint-interval=N] [--gdb=port|unix:path] [--devices[=clock_hz]] [--fork-server[=entry] [--fork-input=file]...] [--lockstep[=block]] [--sweep=inputs.txt] [--smp=cores]\n";
         return 1;
     }
 
@@ -47,6 +88,20 @@ int main(int argc, char** argv) {
     uint16_t watch_start = 0;
     uint16_t watch_end = 0;
     std::vector<std::string> break_specs;
+    std::vector<std::string> watchpoint_specs;
+    std::string coverage_path;
+    std::string record_path;
+    std::string replay_path;
+    uint64_t checkpoint_interval = 0;
+    std::string gdb_spec;
+    bool fork_server = false;
+    std::string fork_entry;
+    std::vector<std::string> fork_inputs;
+    uint64_t lockstep_block = 0;
+    std::string sweep_path;
+    size_t smp_cores = 0;
+    bool devices = false;
+    uint32_t clock_hz = 60;
     for (int i = 2; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--trace") {
@@ -70,6 +125,69 @@ int main(int argc, char** argv) {
             }
             continue;
         }
+        if (arg.rfind("--coverage", 0) == 0) {
+            auto pos = arg.find('=');
+            if (pos != std::string::npos) {
+                coverage_path = arg.substr(pos + 1);
+            } else if (i + 1 < argc) {
+                coverage_path = argv[++i];
+            }
+            continue;
+        }
+        if (arg.rfind("--record=", 0) == 0) {
+            record_path = arg.substr(9);
+            continue;
+        }
+        if (arg.rfind("--replay=", 0) == 0) {
+            replay_path = arg.substr(9);
+            continue;
+        }
+        if (arg.rfind("--gdb=", 0) == 0) {
+            gdb_spec = arg.substr(6);
+            continue;
+        }
+        if (arg == "--fork-server" || arg.rfind("--fork-server=", 0) == 0) {
+            fork_server = true;
+            if (arg.size() > 14) {
+                fork_entry = arg.substr(14);
+            }
+            continue;
+        }
+        if (arg.rfind("--sweep=", 0) == 0) {
+            sweep_path = arg.substr(8);
+            continue;
+        }
+        if (arg.rfind("--smp=", 0) == 0) {
+            smp_cores = std::stoul(arg.substr(6));
+            continue;
+        }
+        if (arg == "--lockstep" || arg.rfind("--lockstep=", 0) == 0) {
+            lockstep_block = arg.size() > 11 ? std::stoull(arg.substr(11)) : 64;
+            if (lockstep_block == 0) {
+                std::cerr << "--lockstep block must be at least 1\n";
+                return 1;
+            }
+            continue;
+        }
+        if (arg.rfind("--fork-input=", 0) == 0) {
+            fork_inputs.push_back(arg.substr(13));
+            continue;
+        }
+        if (arg == "--devices" || arg.rfind("--devices=", 0) == 0) {
+            devices = true;
+            if (arg.size() > 10) {
+                clock_hz = parse_u32(arg.substr(10));
+            }
+            continue;
+        }
+        if (arg.rfind("--checkpoint-interval=", 0) == 0) {
+            checkpoint_interval = static_cast<uint64_t>(std::stoull(arg.substr(22)));
+            continue;
+        }
+        if (arg.rfind("--watchpoint=", 0) == 0) {
+            watchpoint_specs.push_back(arg.substr(13));
+            continue;
+        }
         if (arg.rfind("--watch", 0) == 0) {
             auto pos = arg.find('=');
             std::string spec;
@@ -117,28 +235,76 @@ int main(int argc, char** argv) {
         cpu.r[7] = res.start;
         cpu.r[6] = 0xFFFE; // stack grows down
         cpu.load_words(res.start, res.words);
+        if (devices) {
+            cpu.enable_devices(clock_hz);
+            cpu.r[6] = CPU::kIoPageStart; // keep the stack clear of device registers
+        }
         cpu.mem_watch.enabled = watch_enabled;
         cpu.mem_watch.trace_all = trace_mem;
         cpu.mem_watch.start = watch_start;
         cpu.mem_watch.end = watch_end;
+        if (trace || trace_mem || watch_enabled) {
+            cpu.console_out.buffered = false; // keep guest output in order with the logs
+        }
+        if (!coverage_path.empty()) {
+            cpu.enable_coverage();
+        }
+        if (!replay_path.empty()) {
+            cpu.events = load_event_log(replay_path);
+        } else if (!record_path.empty()) {
+            cpu.events.mode = CPU::EventLog::Mode::Record;
+        }
+        cpu.checkpoint_interval = checkpoint_interval;
 
         if (!break_specs.empty()) {
-            for (const auto& spec : break_specs) {
-                bool is_num = !spec.empty() && (std::isdigit(static_cast<unsigned char>(spec[0])) ||
-                                                spec.rfind("0x", 0) == 0 || spec.rfind("0X", 0) == 0 ||
-                                                spec.rfind("0o", 0) == 0 || spec.rfind("0O", 0) == 0);
-                if (is_num) {
-                    cpu.breakpoints.insert(parse_u16(spec));
-                } else {
-                    auto it = res.symbols.find(upper(spec));
-                    if (it == res.symbols.end()) {
-                        throw std::runtime_error("Unknown breakpoint label: " + spec);
+            for (const auto& full_spec : break_specs) {
+                auto parts = split(full_spec, ',');
+                const std::string& spec = parts[0];
+                std::string cond;
+                uint64_t ignore = 0;
+                for (size_t p = 1; p < parts.size(); ++p) {
+                    if (parts[p].rfind("if=", 0) == 0) {
+                        cond = parts[p].substr(3);
+                    } else if (parts[p].rfind("ignore=", 0) == 0) {
+                        ignore = std::stoull(parts[p].substr(7));
+                    } else {
+                        throw std::runtime_error("Bad breakpoint option: " + parts[p]);
                     }
-                    cpu.breakpoints.insert(it->second);
+                }
+                uint16_t addr = resolve_address(spec, res, "breakpoint");
+                if (cond.empty() && ignore == 0) {
+                    cpu.breakpoints.insert(addr);
+                } else {
+                    cpu.add_breakpoint(addr, cond, ignore);
                 }
             }
         }
 
+        for (const auto& full_spec : watchpoint_specs) {
+            auto parts = split(full_spec, ',');
+            auto fields = split(parts[0], ':');
+            if (fields.size() < 2 || fields.size() > 3) {
+                throw std::runtime_error("Bad watchpoint: " + full_spec);
+            }
+            std::string mode = upper(fields[0]);
+            bool on_read = mode.find('R') != std::string::npos;
+            bool on_write = mode.find('W') != std::string::npos;
+            uint32_t start = parse_u32(fields[1]);
+            uint32_t len = fields.size() == 3 ? parse_u32(fields[2]) : 2;
+            std::string cond;
+            uint64_t ignore = 0;
+            for (size_t p = 1; p < parts.size(); ++p) {
+                if (parts[p].rfind("if=", 0) == 0) {
+                    cond = parts[p].substr(3);
+                } else if (parts[p].rfind("ignore=", 0) == 0) {
+                    ignore = std::stoull(parts[p].substr(7));
+                } else {
+                    throw std::runtime_error("Bad watchpoint option: " + parts[p]);
+                }
+            }
+            cpu.add_watchpoint(start, len, on_read, on_write, cond, ignore);
+        }
+
         if (dump_symbols || !map_path.empty()) {
             if (dump_symbols) {
                 for (const auto& kv : res.symbols) {
@@ -155,10 +321,101 @@ int main(int argc, char** argv) {
                 }
             }
         }
-        if (trace) {
+        if (!sweep_path.empty()) {
+            // One lane per input line, all run by the multi-instance engine.
+            std::ifstream in(sweep_path);
+            if (!in) {
+                throw std::runtime_error("Failed to open sweep inputs: " + sweep_path);
+            }
+            std::vector<std::string> inputs;
+            for (std::string line; std::getline(in, line);) {
+                inputs.push_back(line + "\n");
+            }
+            MultiCPU multi(inputs.size());
+            multi.load(res.start, res.words);
+            for (size_t lane = 0; lane < inputs.size(); ++lane) {
+                multi.set_input(lane, inputs[lane]);
+            }
+            multi.run(max_steps);
+            for (size_t lane = 0; lane < inputs.size(); ++lane) {
+                std::cout << "== lane " << lane << ": "
+                          << (!multi.error(lane).empty() ? "ERROR " + multi.error(lane)
+                                                         : (multi.halted(lane) ? "HALT" : "LIMIT"))
+                          << " steps=" << multi.instructions(lane) << " ==\n"
+                          << multi.output(lane);
+                if (!multi.output(lane).empty() && multi.output(lane).back() != '\n') {
+                    std::cout << "\n";
+                }
+            }
+            std::cerr << "vector steps=" << multi.stats().vector_steps
+                      << " scalar lane steps=" << multi.stats().scalar_steps << "\n";
+            return 0;
+        }
+        if (smp_cores != 0) {
+            if (devices) {
+                throw std::runtime_error("--smp does not support --devices");
+            }
+            // Every core starts at the entry point; guests split work by TRAP 52.
+            SmpMachine smp(smp_cores);
+            smp.load(res.start, res.words);
+            smp.run(max_steps);
+            for (size_t id = 0; id < smp.size(); ++id) {
+                const CPU& core = smp.core(id);
+                std::cout << "== core " << id << ": "
+                          << (!smp.error(id).empty() ? "ERROR " + smp.error(id) : (core.halted ? "HALT" : "LIMIT"))
+                          << " steps=" << core.icount << " R0=" << std::hex << core.r[0] << std::dec << " ==\n";
+            }
+            return 0;
+        }
+        if (lockstep_block != 0) {
+            if (devices) {
+                throw std::runtime_error("--lockstep does not support --devices");
+            }
+            // Only the candidate would stop at these or read the log, which
+            // shows up as a divergence that is not one.
+            if (!break_specs.empty() || !watchpoint_specs.empty() || !replay_path.empty()) {
+                throw std::runtime_error("--lockstep does not support --break, --watchpoint or --replay");
+            }
+            // Both engines see the same input, so read it all up front.
+            std::string input((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+            CPU reference;
+            reference.reset();
+            reference.r[7] = res.start;
+            reference.r[6] = 0xFFFE;
+            reference.load_words(res.start, res.words);
+            StepEngine ref_engine(reference);
+            RunEngine run_engine(cpu, lockstep_block);
+            LockstepReport report = run_lockstep(ref_engine, run_engine, input, max_steps);
+            std::cout << report.output;
+            if (report.diverged) {
+                std::cerr << report.message;
+                return 3;
+            }
+            std::cout << "LOCKSTEP " << (report.error.empty() ? "OK" : "ERROR " + report.error)
+                      << " instructions=" << report.instructions << "\n";
+            return 0;
+        }
+        if (fork_server) {
+            uint16_t entry = resolve_entry(fork_entry, res);
+            // Keep startup output off stdout, which may carry replies.
+            cpu.console_out.sink = [](const char* data, size_t len) { std::fwrite(data, 1, len, stderr); };
+            ForkServer server(cpu, entry, max_steps);
+            return serve_inputs(server, fork_inputs, max_steps);
+        }
+        if (!gdb_spec.empty()) {
+            int fd = GdbStub::listen_and_accept(gdb_spec);
+            GdbStub stub(cpu, fd);
+            GdbStub::Outcome outcome = stub.serve();
+            ::close(fd);
+            if (outcome == GdbStub::Outcome::Killed) {
+                return 0;
+            }
+            cpu.break_hit = false;
+            cpu.run(max_steps);
+        } else if (trace) {
             for (uint64_t i = 0; i < max_steps && !cpu.halted; ++i) {
                 uint16_t pc = cpu.r[7];
-                if (!cpu.breakpoints.empty() && cpu.breakpoints.find(pc) != cpu.breakpoints.end()) {
+                if (cpu.breakpoint_at(pc)) {
                     cpu.break_hit = true;
                     cpu.break_addr = pc;
                     break;
@@ -166,14 +423,34 @@ int main(int argc, char** argv) {
                 std::cout << "PC=" << std::hex << pc << std::dec
                           << "  " << disassemble(cpu, pc) << "\n";
                 cpu.step();
+                if (cpu.watch_hit) {
+                    break;
+                }
             }
         } else {
             cpu.run(max_steps);
         }
 
+        cpu.console_out.flush();
+
+        if (!record_path.empty()) {
+            save_event_log(cpu.events, record_path);
+        }
+        if (!coverage_path.empty()) {
+            std::ofstream out(coverage_path);
+            if (!out) {
+                throw std::runtime_error("Failed to open coverage file: " + coverage_path);
+            }
+            write_lcov(out, path, res, cpu);
+        }
+
         if (cpu.break_hit) {
             std::cout << "BREAK at 0x" << std::hex << cpu.break_addr << std::dec << "\n";
         }
+        if (cpu.watch_hit) {
+            std::cout << "WATCH " << (cpu.watch_write ? "write" : "read") << " at 0x" << std::hex
+                      << cpu.watch_addr << " PC=0x" << cpu.r[7] << std::dec << "\n";
+        }
         std::cout << "HALT=" << (cpu.halted ? "yes" : "no") << "\n";
         for (int i = 0; i < 8; ++i) {
             std::cout << "R" << i << "=" << std::hex << cpu.r[i] << std::dec << "\n";
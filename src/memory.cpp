@@ -0,0 +1,154 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pdp11 {
+
+PhysicalMemory::PhysicalMemory(size_t size) : size_(size) {
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Cannot allocate guest memory");
+    }
+    base_ = static_cast<uint8_t*>(p);
+}
+
+PhysicalMemory PhysicalMemory::alias(PhysicalMemory& owner) {
+    PhysicalMemory view;
+    view.base_ = owner.base_;
+    view.size_ = owner.size_;
+    view.alias_ = true;
+    view.mapped_banks_ = owner.mapped_banks_;
+    view.ro_banks_ = owner.ro_banks_;
+    return view;
+}
+
+PhysicalMemory::PhysicalMemory(PhysicalMemory&& other) noexcept
+    : base_(other.base_), size_(other.size_), alias_(other.alias_), mapped_banks_(other.mapped_banks_),
+      ro_banks_(other.ro_banks_) {
+    for (uint32_t bank = 0; bank < kMaxBanks; ++bank) {
+        files_[bank] = std::move(other.files_[bank]);
+    }
+    other.base_ = nullptr;
+    other.size_ = 0;
+    other.alias_ = false;
+    other.mapped_banks_ = 0;
+    other.ro_banks_ = 0;
+}
+
+PhysicalMemory& PhysicalMemory::operator=(PhysicalMemory&& other) noexcept {
+    if (this != &other) {
+        if (base_ && !alias_) {
+            ::munmap(base_, size_);
+        }
+        base_ = other.base_;
+        size_ = other.size_;
+        alias_ = other.alias_;
+        mapped_banks_ = other.mapped_banks_;
+        ro_banks_ = other.ro_banks_;
+        for (uint32_t bank = 0; bank < kMaxBanks; ++bank) {
+            files_[bank] = std::move(other.files_[bank]);
+        }
+        other.base_ = nullptr;
+        other.size_ = 0;
+        other.alias_ = false;
+        other.mapped_banks_ = 0;
+        other.ro_banks_ = 0;
+    }
+    return *this;
+}
+
+PhysicalMemory::~PhysicalMemory() {
+    if (base_ && !alias_) {
+        ::munmap(base_, size_);
+    }
+}
+
+PhysicalMemory::FileMapping::~FileMapping() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+long PhysicalMemory::map_file(uint32_t bank, int fd, uint64_t offset, bool writable) {
+    if (alias_ || bank >= kMaxBanks || (bank + 1) * static_cast<size_t>(kBankSize) > size_ ||
+        offset % kBankSize != 0) {
+        return -1;
+    }
+    auto file = std::make_shared<FileMapping>();
+    file->fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    file->offset = offset;
+    file->writable = writable;
+    if (file->fd < 0) {
+        return -1;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) <= offset) {
+        return -1;
+    }
+    // Pages wholly past end of file would fault on access, so only map
+    // what the file covers and leave the rest of the bank anonymous.
+    size_t len = static_cast<size_t>(
+        std::min<uint64_t>(kBankSize, static_cast<uint64_t>(st.st_size) - offset));
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t map_len = (len + page - 1) / page * page;
+    // Start from a zeroed bank, so the tail past end of file does not keep
+    // what the guest stored there before.
+    unmap(bank);
+    int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+    int flags = MAP_FIXED | (writable ? MAP_SHARED : MAP_PRIVATE);
+    void* p = ::mmap(base_ + bank * kBankSize, map_len, prot, flags, fd, static_cast<off_t>(offset));
+    if (p == MAP_FAILED) {
+        unmap(bank); // the old contents of the range are gone either way
+        return -1;
+    }
+    mapped_banks_ |= static_cast<uint8_t>(1u << bank);
+    if (writable) {
+        ro_banks_ &= static_cast<uint8_t>(~(1u << bank));
+    } else {
+        ro_banks_ |= static_cast<uint8_t>(1u << bank);
+    }
+    files_[bank] = std::move(file);
+    return static_cast<long>(len);
+}
+
+bool PhysicalMemory::remap(uint32_t bank, const std::shared_ptr<const FileMapping>& m) {
+    if (!m) {
+        return unmap(bank);
+    }
+    if (map_file(bank, m->fd, m->offset, m->writable) < 0) {
+        return false;
+    }
+    files_[bank] = m; // keep the caller's identity for later comparisons
+    return true;
+}
+
+bool PhysicalMemory::unmap(uint32_t bank) {
+    if (alias_ || bank >= kMaxBanks || (bank + 1) * static_cast<size_t>(kBankSize) > size_) {
+        return false;
+    }
+    void* p = ::mmap(base_ + bank * kBankSize, kBankSize, PROT_READ | PROT_WRITE,
+                     MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Cannot restore guest memory bank");
+    }
+    mapped_banks_ &= static_cast<uint8_t>(~(1u << bank));
+    ro_banks_ &= static_cast<uint8_t>(~(1u << bank));
+    files_[bank].reset();
+    return true;
+}
+
+void PhysicalMemory::unmap_all() {
+    for (uint32_t bank = 0; bank * static_cast<size_t>(kBankSize) < size_; ++bank) {
+        if (mapped(bank)) {
+            unmap(bank);
+        }
+    }
+}
+
+} // namespace pdp11
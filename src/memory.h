@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace pdp11 {
+
+// Guest physical memory: one anonymous mapping, so that a host file can be
+// mapped over any 64K bank in place (TRAP 35). Banks mapped read-only must
+// not be written through operator[]; check read_only() first.
+class PhysicalMemory {
+public:
+    static constexpr uint32_t kBankSize = 0x10000;
+    static constexpr uint32_t kMaxBanks = 8;
+
+    // A file mapped over a bank. The descriptor stays open so the mapping
+    // can be made again (see remap()); it is closed with the last reference.
+    struct FileMapping {
+        int fd = -1;
+        uint64_t offset = 0;
+        bool writable = false;
+        FileMapping() = default;
+        FileMapping(const FileMapping&) = delete;
+        FileMapping& operator=(const FileMapping&) = delete;
+        ~FileMapping();
+    };
+
+    explicit PhysicalMemory(size_t size);
+    // A second view of owner's memory for CPUs that share it. It must not
+    // outlive owner, and file mapping through it is refused.
+    static PhysicalMemory alias(PhysicalMemory& owner);
+    ~PhysicalMemory();
+    PhysicalMemory(const PhysicalMemory&) = delete;
+    PhysicalMemory& operator=(const PhysicalMemory&) = delete;
+    PhysicalMemory(PhysicalMemory&& other) noexcept;
+    PhysicalMemory& operator=(PhysicalMemory&& other) noexcept;
+
+    uint8_t& operator[](size_t index) { return base_[index]; }
+    const uint8_t& operator[](size_t index) const { return base_[index]; }
+    uint8_t* data() { return base_; }
+    const uint8_t* data() const { return base_; }
+    size_t size() const { return size_; }
+    bool is_alias() const { return alias_; }
+
+    // Word access at an even physical address as one host access, so CPUs
+    // sharing the memory never see half of another's store. Stores release
+    // and loads acquire: a guest publishing data and then a flag word with
+    // plain MOVs is seen in that order by another CPU.
+    static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "guest words are kept in host order");
+    uint16_t load_word(uint32_t p) const {
+        return __atomic_load_n(reinterpret_cast<const uint16_t*>(base_ + p), __ATOMIC_ACQUIRE);
+    }
+    void store_word(uint32_t p, uint16_t value) {
+        __atomic_store_n(reinterpret_cast<uint16_t*>(base_ + p), value, __ATOMIC_RELEASE);
+    }
+    uint16_t fetch_or_word(uint32_t p, uint16_t bits) {
+        return __atomic_fetch_or(reinterpret_cast<uint16_t*>(base_ + p), bits, __ATOMIC_SEQ_CST);
+    }
+    // On failure expected is updated to the current contents.
+    bool compare_exchange_word(uint32_t p, uint16_t& expected, uint16_t desired) {
+        return __atomic_compare_exchange_n(reinterpret_cast<uint16_t*>(base_ + p), &expected, desired, false,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+
+    bool mapped(uint32_t bank) const { return (mapped_banks_ >> bank) & 1; }
+    bool read_only(uint32_t bank) const { return (ro_banks_ >> bank) & 1; }
+
+    // Maps up to one bank of `fd` from `offset` (a multiple of kBankSize)
+    // over `bank`. Writable mappings are shared, so stores reach the file.
+    // The part of the bank past end of file stays zero-filled anonymous
+    // memory. Returns the number of file bytes mapped, or -1.
+    long map_file(uint32_t bank, int fd, uint64_t offset, bool writable);
+    // Replaces a file mapping with zeroed anonymous memory.
+    bool unmap(uint32_t bank);
+    // The file mapped over bank, or null for anonymous memory.
+    std::shared_ptr<const FileMapping> mapping(uint32_t bank) const { return files_[bank]; }
+    // Maps m over bank again, or unmaps bank when m is null. The bank is
+    // left unmapped if the file can no longer be mapped.
+    bool remap(uint32_t bank, const std::shared_ptr<const FileMapping>& m);
+    void unmap_all();
+
+private:
+    PhysicalMemory() = default;
+
+    uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    bool alias_ = false; // base_ is owned by another PhysicalMemory
+    uint8_t mapped_banks_ = 0;
+    uint8_t ro_banks_ = 0;
+    std::shared_ptr<const FileMapping> files_[kMaxBanks];
+};
+
+} // namespace pdp11
@@ -0,0 +1,387 @@
+#include "multi.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace pdp11 {
+
+namespace {
+
+// 16-bit lane operations, overloaded for one lane (uint16_t) and for a
+// vector of lanes, so each kernel is written once.
+inline uint16_t get(const uint16_t* p, uint16_t) { return *p; }
+inline uint16_t splat(uint16_t v, uint16_t) { return v; }
+inline void store(uint16_t* p, uint16_t v) { *p = v; }
+inline uint16_t add(uint16_t a, uint16_t b) { return static_cast<uint16_t>(a + b); }
+inline uint16_t sub(uint16_t a, uint16_t b) { return static_cast<uint16_t>(a - b); }
+inline uint16_t band(uint16_t a, uint16_t b) { return a & b; }
+inline uint16_t bor(uint16_t a, uint16_t b) { return a | b; }
+inline uint16_t bxor(uint16_t a, uint16_t b) { return a ^ b; }
+inline uint16_t andnot(uint16_t a, uint16_t b) { return static_cast<uint16_t>(~a & b); }
+inline uint16_t eq(uint16_t a, uint16_t b) { return a == b ? 0xFFFF : 0; }
+inline uint16_t sign(uint16_t a) { return a >> 15; }
+inline uint16_t shl1(uint16_t a) { return static_cast<uint16_t>(a << 1); }
+inline uint16_t sar1(uint16_t a) { return static_cast<uint16_t>((a & 0x8000) | (a >> 1)); }
+
+#if defined(__AVX2__)
+constexpr size_t kWidth = 16;
+using Vec = __m256i;
+inline Vec get(const uint16_t* p, Vec) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline Vec splat(uint16_t v, Vec) { return _mm256_set1_epi16(static_cast<short>(v)); }
+inline void store(uint16_t* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+inline Vec add(Vec a, Vec b) { return _mm256_add_epi16(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm256_sub_epi16(a, b); }
+inline Vec band(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+inline Vec bor(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline Vec bxor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+inline Vec andnot(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }
+inline Vec eq(Vec a, Vec b) { return _mm256_cmpeq_epi16(a, b); }
+inline Vec sign(Vec a) { return _mm256_srli_epi16(a, 15); }
+inline Vec shl1(Vec a) { return _mm256_slli_epi16(a, 1); }
+inline Vec sar1(Vec a) { return _mm256_srai_epi16(a, 1); }
+#elif defined(__SSE2__)
+constexpr size_t kWidth = 8;
+using Vec = __m128i;
+inline Vec get(const uint16_t* p, Vec) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Vec splat(uint16_t v, Vec) { return _mm_set1_epi16(static_cast<short>(v)); }
+inline void store(uint16_t* p, Vec v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+inline Vec add(Vec a, Vec b) { return _mm_add_epi16(a, b); }
+inline Vec sub(Vec a, Vec b) { return _mm_sub_epi16(a, b); }
+inline Vec band(Vec a, Vec b) { return _mm_and_si128(a, b); }
+inline Vec bor(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline Vec bxor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+inline Vec andnot(Vec a, Vec b) { return _mm_andnot_si128(a, b); }
+inline Vec eq(Vec a, Vec b) { return _mm_cmpeq_epi16(a, b); }
+inline Vec sign(Vec a) { return _mm_srli_epi16(a, 15); }
+inline Vec shl1(Vec a) { return _mm_slli_epi16(a, 1); }
+inline Vec sar1(Vec a) { return _mm_srai_epi16(a, 1); }
+#endif
+
+// Lanes are padded to this, so vector loops never need a tail.
+constexpr size_t kLaneAlign = 16;
+
+template <typename Fn>
+void for_each_block(size_t lanes, Fn&& fn) {
+    size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+    for (; i + kWidth <= lanes; i += kWidth) {
+        fn(i, Vec{});
+    }
+#endif
+    for (; i < lanes; ++i) {
+        fn(i, uint16_t{});
+    }
+}
+
+// Stores value into the masked lanes of p[i...].
+template <typename T>
+void put(uint16_t* p, size_t i, T mask, T value) {
+    store(p + i, bor(band(mask, value), andnot(mask, get(p + i, value))));
+}
+
+} // namespace
+
+MultiCPU::MultiCPU(size_t lanes)
+    : count_(lanes), padded_((lanes + kLaneAlign - 1) / kLaneAlign * kLaneAlign), icount_(lanes),
+      inputs_(lanes), input_pos_(lanes), outputs_(lanes), errors_(lanes) {
+    for (auto& reg : r_) {
+        reg.assign(padded_, 0);
+    }
+    n_.assign(padded_, 0);
+    z_.assign(padded_, 0);
+    v_.assign(padded_, 0);
+    c_.assign(padded_, 0);
+    mask_.assign(padded_, 0);
+    cpus_.reserve(lanes);
+    for (size_t i = 0; i < lanes; ++i) {
+        cpus_.emplace_back();
+    }
+}
+
+void MultiCPU::load(uint16_t start, const std::vector<uint16_t>& words) {
+    for (size_t lane = 0; lane < count_; ++lane) {
+        CPU& cpu = cpus_[lane];
+        cpu.reset();
+        std::memset(cpu.mem.data(), 0, cpu.mem.size());
+        cpu.load_words(start, words);
+        for (int i = 0; i < 8; ++i) {
+            r_[i][lane] = 0;
+        }
+        r_[7][lane] = start;
+        r_[6][lane] = 0xFFFE;
+        n_[lane] = z_[lane] = v_[lane] = c_[lane] = 0;
+        icount_[lane] = 0;
+        input_pos_[lane] = 0;
+        outputs_[lane].clear();
+        errors_[lane].clear();
+    }
+}
+
+void MultiCPU::set_input(size_t lane, std::string input) {
+    inputs_[lane] = std::move(input);
+    input_pos_[lane] = 0;
+}
+
+Flags MultiCPU::flags(size_t lane) const {
+    Flags f = cpus_[lane].psw;
+    f.n = n_[lane] != 0;
+    f.z = z_[lane] != 0;
+    f.v = v_[lane] != 0;
+    f.c = c_[lane] != 0;
+    return f;
+}
+
+void MultiCPU::run(uint64_t max_steps) {
+    for (size_t lane = 0; lane < count_; ++lane) {
+        CPU& cpu = cpus_[lane];
+        cpu.console_in.clear();
+        cpu.console_in.poll_fd = -1;
+        cpu.console_in.source = [this, lane](char* data, size_t len) -> long {
+            const std::string& input = inputs_[lane];
+            size_t n = std::min(len, input.size() - input_pos_[lane]);
+            std::memcpy(data, input.data() + input_pos_[lane], n);
+            input_pos_[lane] += n;
+            return static_cast<long>(n);
+        };
+        cpu.console_out.sink = [this, lane](const char* data, size_t len) { outputs_[lane].append(data, len); };
+    }
+    std::vector<uint64_t> limit(count_);
+    std::vector<uint8_t> live(count_);
+    for (size_t lane = 0; lane < count_; ++lane) {
+        limit[lane] = icount_[lane] + max_steps;
+        live[lane] = !cpus_[lane].halted && errors_[lane].empty() && max_steps > 0;
+    }
+
+    const uint16_t* pcs = r_[7].data();
+    while (true) {
+        // Lowest PC first, so lanes that branched ahead wait for the rest.
+        bool any = false;
+        uint16_t pc = 0;
+        size_t lead = 0;
+        for (size_t lane = 0; lane < count_; ++lane) {
+            if (live[lane] && (!any || pcs[lane] < pc)) {
+                any = true;
+                pc = pcs[lane];
+                lead = lane;
+            }
+        }
+        if (!any) {
+            break;
+        }
+        for (size_t lane = 0; lane < count_; ++lane) {
+            mask_[lane] = live[lane] && pcs[lane] == pc ? 0xFFFF : 0;
+        }
+
+        const CPU& code = cpus_[lead];
+        if (vector_step(code.read_word_code(pc), pc, code)) {
+            ++stats_.vector_steps;
+        } else {
+            for (size_t lane = lead; lane < count_; ++lane) {
+                if (mask_[lane]) {
+                    scalar_step(lane);
+                }
+            }
+        }
+        for (size_t lane = lead; lane < count_; ++lane) {
+            if (mask_[lane]) {
+                ++icount_[lane];
+                if (cpus_[lane].halted || !errors_[lane].empty() || icount_[lane] >= limit[lane]) {
+                    live[lane] = 0;
+                }
+            }
+        }
+    }
+
+    for (size_t lane = 0; lane < count_; ++lane) {
+        CPU& cpu = cpus_[lane];
+        cpu.console_out.flush();
+        cpu.console_in.source = nullptr;
+        cpu.console_out.sink = nullptr;
+    }
+}
+
+void MultiCPU::scalar_step(size_t lane) {
+    CPU& cpu = cpus_[lane];
+    for (int i = 0; i < 8; ++i) {
+        cpu.r[i] = r_[i][lane];
+    }
+    cpu.psw.n = n_[lane] != 0;
+    cpu.psw.z = z_[lane] != 0;
+    cpu.psw.v = v_[lane] != 0;
+    cpu.psw.c = c_[lane] != 0;
+    try {
+        cpu.step();
+    } catch (const std::exception& ex) {
+        errors_[lane] = ex.what();
+    }
+    for (int i = 0; i < 8; ++i) {
+        r_[i][lane] = cpu.r[i];
+    }
+    n_[lane] = cpu.psw.n;
+    z_[lane] = cpu.psw.z;
+    v_[lane] = cpu.psw.v;
+    c_[lane] = cpu.psw.c;
+    ++stats_.scalar_steps;
+}
+
+bool MultiCPU::vector_step(uint16_t instr, uint16_t pc, const CPU& code) {
+    uint16_t next = static_cast<uint16_t>(pc + 2);
+    uint16_t* m = mask_.data();
+    uint16_t* pcs = r_[7].data();
+
+    // Branches: every masked lane picks its own target.
+    uint16_t br = instr & 0xFF00;
+    if (br == 0000400 || br == 0001000 || br == 0001400) {
+        uint16_t target = static_cast<uint16_t>(next + static_cast<int8_t>(instr & 0xFF) * 2);
+        const uint16_t* z = z_.data();
+        for_each_block(padded_, [&](size_t i, auto tag) {
+            auto mk = get(m + i, tag);
+            auto taken = splat(0xFFFF, tag);
+            if (br == 0001400) { // BEQ
+                taken = eq(get(z + i, tag), splat(1, tag));
+            } else if (br == 0001000) { // BNE
+                taken = eq(get(z + i, tag), splat(0, tag));
+            }
+            put(pcs, i, mk, bor(band(taken, splat(target, tag)), andnot(taken, splat(next, tag))));
+        });
+        return true;
+    }
+
+    // Operands must be registers other than the PC, or an immediate source.
+    struct Operand {
+        uint16_t* reg = nullptr;
+        uint16_t imm = 0;
+    };
+    auto operand = [&](uint16_t spec, bool written, Operand& op) {
+        uint16_t mode = spec >> 3;
+        uint16_t reg = spec & 7;
+        if (mode == 0 && reg != 7) {
+            op.reg = r_[reg].data();
+            return true;
+        }
+        if (mode == 2 && reg == 7 && !written) {
+            op.imm = code.read_word_code(next);
+            next = static_cast<uint16_t>(next + 2);
+            return true;
+        }
+        return false;
+    };
+
+    uint16_t* n = n_.data();
+    uint16_t* z = z_.data();
+    uint16_t* v = v_.data();
+    uint16_t* c = c_.data();
+    uint16_t op = instr & 0170000;
+    uint16_t single = instr & 0177700;
+
+    if (op == 0010000 || op == 0020000 || op == 0030000 || op == 0040000 || op == 0050000 ||
+        op == 0060000 || op == 0160000) {
+        Operand src;
+        Operand dst;
+        bool writes = op != 0020000 && op != 0030000; // CMP and BIT only set flags
+        if (!operand((instr >> 6) & 077, false, src) || !operand(instr & 077, writes, dst)) {
+            return false;
+        }
+        for_each_block(padded_, [&](size_t i, auto tag) {
+            using T = decltype(tag);
+            T mk = get(m + i, tag);
+            T s = src.reg ? get(src.reg + i, tag) : splat(src.imm, tag);
+            T d = dst.reg ? get(dst.reg + i, tag) : splat(dst.imm, tag);
+            T zero = splat(0, tag);
+            T res = zero;
+            switch (op) {
+            case 0010000: // MOV: V cleared, C kept
+                res = s;
+                put(v, i, mk, zero);
+                break;
+            case 0020000: // CMP (dst - src)
+            case 0160000: // SUB
+                res = sub(d, s);
+                put(v, i, mk, sign(band(bxor(d, s), bxor(d, res))));
+                put(c, i, mk, sign(bor(andnot(d, s), andnot(bxor(d, s), res))));
+                break;
+            case 0060000: // ADD
+                res = add(s, d);
+                put(v, i, mk, sign(andnot(bxor(s, d), bxor(s, res))));
+                put(c, i, mk, sign(bor(band(s, d), andnot(res, bxor(s, d)))));
+                break;
+            case 0030000: // BIT
+                res = band(s, d);
+                break;
+            case 0040000: // BIC
+                res = andnot(s, d);
+                break;
+            default: // BIS
+                res = bor(s, d);
+                break;
+            }
+            if (op == 0030000 || op == 0040000 || op == 0050000) {
+                put(v, i, mk, zero);
+                put(c, i, mk, zero);
+            }
+            if (writes) {
+                put(dst.reg, i, mk, res);
+            }
+            put(n, i, mk, sign(res));
+            put(z, i, mk, band(eq(res, zero), splat(1, tag)));
+        });
+    } else if (single == 0005000 || single == 0005200 || single == 0005300 || single == 0005700 ||
+               single == 0006200 || single == 0006300) {
+        Operand dst;
+        if (!operand(instr & 077, true, dst)) {
+            return false;
+        }
+        for_each_block(padded_, [&](size_t i, auto tag) {
+            using T = decltype(tag);
+            T mk = get(m + i, tag);
+            T d = get(dst.reg + i, tag);
+            T zero = splat(0, tag);
+            T res = d;
+            switch (single) {
+            case 0005000: // CLR
+                res = zero;
+                put(v, i, mk, zero);
+                put(c, i, mk, zero);
+                break;
+            case 0005200: // INC: C kept
+                res = add(d, splat(1, tag));
+                put(v, i, mk, band(eq(d, splat(0x7FFF, tag)), splat(1, tag)));
+                break;
+            case 0005300: // DEC: C kept
+                res = sub(d, splat(1, tag));
+                put(v, i, mk, band(eq(d, splat(0x8000, tag)), splat(1, tag)));
+                break;
+            case 0005700: // TST
+                put(v, i, mk, zero);
+                put(c, i, mk, zero);
+                break;
+            default: { // ASR, ASL: V = N ^ C
+                T carry = single == 0006200 ? band(d, splat(1, tag)) : sign(d);
+                res = single == 0006200 ? sar1(d) : shl1(d);
+                put(c, i, mk, carry);
+                put(v, i, mk, bxor(sign(res), carry));
+                break;
+            }
+            }
+            if (single != 0005700) {
+                put(dst.reg, i, mk, res);
+            }
+            put(n, i, mk, sign(res));
+            put(z, i, mk, band(eq(res, zero), splat(1, tag)));
+        });
+    } else {
+        return false;
+    }
+
+    for_each_block(padded_, [&](size_t i, auto tag) { put(pcs, i, get(m + i, tag), splat(next, tag)); });
+    return true;
+}
+
+} // namespace pdp11
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// Runs many instances (lanes) of one program, each with its own console
+// input and memory. Registers and condition codes are stored as one array
+// per register across lanes. Each step picks the lowest PC among running
+// lanes and executes that instruction for every lane at that PC. Lanes at
+// other PCs are masked off until they reconverge. Register-only forms of
+// MOV, CMP, BIT, BIC, BIS, ADD, SUB, CLR, INC, DEC, TST, ASR and ASL, plus
+// BR/BEQ/BNE, run as 16-bit vector operations across lanes (16 per step
+// with AVX2, 8 with SSE2). Everything else, including memory operands and
+// TRAPs, goes through CPU::step() on each lane's own CPU.
+class MultiCPU {
+public:
+    struct Stats {
+        uint64_t vector_steps = 0; // instructions run across lanes at once
+        uint64_t scalar_steps = 0; // lane instructions run by CPU::step()
+    };
+
+    explicit MultiCPU(size_t lanes);
+
+    size_t lanes() const { return count_; }
+    // Loads the program into every lane and sets PC = start, SP = 0xFFFE.
+    void load(uint16_t start, const std::vector<uint16_t>& words);
+    void set_input(size_t lane, std::string input);
+    // Runs until every lane has halted, failed or executed max_steps more
+    // instructions.
+    void run(uint64_t max_steps);
+
+    uint16_t reg(size_t lane, int index) const { return r_[index][lane]; }
+    Flags flags(size_t lane) const;
+    bool halted(size_t lane) const { return cpus_[lane].halted; }
+    const std::string& error(size_t lane) const { return errors_[lane]; }
+    const std::string& output(size_t lane) const { return outputs_[lane]; }
+    uint64_t instructions(size_t lane) const { return icount_[lane]; }
+    // The lane's CPU holds its memory, I/O state and non-NZVC PSW bits. Its
+    // registers are only current during a scalar step.
+    CPU& lane_cpu(size_t lane) { return cpus_[lane]; }
+    const Stats& stats() const { return stats_; }
+
+private:
+    size_t count_;
+    size_t padded_; // count_ rounded up to whole vectors; extra lanes never run
+    std::vector<uint16_t> r_[8];
+    std::vector<uint16_t> n_, z_, v_, c_; // 0 or 1
+    std::vector<uint16_t> mask_;          // 0xFFFF for lanes in the current step
+    std::vector<uint64_t> icount_;
+    std::vector<CPU> cpus_;
+    std::vector<std::string> inputs_;
+    std::vector<size_t> input_pos_;
+    std::vector<std::string> outputs_;
+    std::vector<std::string> errors_;
+    Stats stats_;
+
+    // Executes instr at pc on the masked lanes; false if it has no vector form.
+    bool vector_step(uint16_t instr, uint16_t pc, const CPU& code);
+    void scalar_step(size_t lane);
+};
+
+} // namespace pdp11
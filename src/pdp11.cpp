@@ -1,17 +1,28 @@
 #include "pdp11.h"
+#include "scan.h"
 
+#include <algorithm>
 #include <cctype>
+#include <cstring>
 #include <cstdio>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace pdp11 {
 
-CPU::CPU() : mem(kMemSize, 0) {
-    in_char = []() -> int { return std::getc(stdin); };
-    out_char = [](uint8_t v) { std::putchar(static_cast<int>(v)); };
+static inline uint32_t phys_addr(uint16_t addr, uint8_t bank) {
+    return (static_cast<uint32_t>(bank & 0x3) << 16) | addr;
+}
+
+CPU::CPU() : mem(kMemSize) {
     reset();
 }
 
@@ -22,11 +33,628 @@ void CPU::reset() {
     psw = {};
     halted = false;
     mem_bank = 0;
+    devices = {};
+    cancel_async();
     files.clear();
+    mem.unmap_all();
     mem_watch = {};
     breakpoints.clear();
     break_hit = false;
     break_addr = 0;
+    cond_breaks.clear();
+    watchpoints.clear();
+    watch_hit = false;
+    watch_addr = 0;
+    watch_write = false;
+    rebuild_debug_bitmaps();
+    coverage.clear();
+    dirty_pages_.clear();
+    events = {};
+    icount = 0;
+    checkpoint_interval = 0;
+    checkpoints.clear();
+}
+
+void CPU::cancel_async() {
+    aio_.reset();
+    aio_next_id_ = 1;
+}
+
+void CPU::enable_devices(uint32_t clock_hz) {
+    devices = {};
+    devices.enabled = true;
+    devices.clock_hz = clock_hz;
+    next_tick_ = std::chrono::steady_clock::now();
+}
+
+uint16_t CPU::psw_word() const {
+    return static_cast<uint16_t>((psw.priority << 5) | (psw.n ? 8 : 0) | (psw.z ? 4 : 0) |
+                                 (psw.v ? 2 : 0) | (psw.c ? 1 : 0));
+}
+
+void CPU::set_psw_word(uint16_t value) {
+    psw.priority = static_cast<uint8_t>((value >> 5) & 7);
+    psw.n = (value & 8) != 0;
+    psw.z = (value & 4) != 0;
+    psw.v = (value & 2) != 0;
+    psw.c = (value & 1) != 0;
+}
+
+bool CPU::io_read(uint16_t address, uint16_t& value) const {
+    switch (address) {
+        case 0177546: // LKS
+            value = static_cast<uint16_t>((devices.clock_monitor ? 0200 : 0) | (devices.clock_ie ? 0100 : 0));
+            return true;
+        case 0177560: // RCSR
+            value = static_cast<uint16_t>((devices.rx_done ? 0200 : 0) | (devices.rx_ie ? 0100 : 0));
+            return true;
+        case 0177562: // RBUF
+            value = 0;
+            if (devices.rx_done && console_in.available() > 0) {
+                value = static_cast<uint8_t>(console_in.data()[0]);
+                devices.rx_done = false;
+                devices.rx_taken = true;
+            }
+            return true;
+        case 0177564: // XCSR: output is buffered, so always ready
+            value = static_cast<uint16_t>(0200 | (devices.tx_ie ? 0100 : 0));
+            return true;
+        case 0177566: // XBUF
+            value = 0;
+            return true;
+        case 0177776:
+            value = psw_word();
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool CPU::io_write(uint16_t address, uint16_t value, bool byte) {
+    uint16_t reg = static_cast<uint16_t>(address & ~1);
+    if (byte && (address & 1)) {
+        // High bytes hold nothing writable except in the PSW, which ignores them.
+        uint16_t unused = 0;
+        return io_read(reg, unused) && reg != 0177562;
+    }
+    switch (reg) {
+        case 0177546: // LKS: IE is writable, MONITOR can only be cleared
+            devices.clock_ie = (value & 0100) != 0;
+            devices.clock_monitor = devices.clock_monitor && (value & 0200) != 0;
+            return true;
+        case 0177560: // RCSR
+            if (!devices.rx_ie && (value & 0100) && devices.rx_done) {
+                devices.rx_irq = true;
+            }
+            devices.rx_ie = (value & 0100) != 0;
+            return true;
+        case 0177562: // RBUF is read-only
+            return true;
+        case 0177564: // XCSR
+            if (!devices.tx_ie && (value & 0100)) {
+                devices.tx_irq = true; // already READY
+            }
+            devices.tx_ie = (value & 0100) != 0;
+            return true;
+        case 0177566: // XBUF
+            put_char(static_cast<uint8_t>(value));
+            devices.tx_irq = devices.tx_ie;
+            return true;
+        case 0177776:
+            set_psw_word(byte ? static_cast<uint16_t>(value & 0xFF) : value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+void CPU::poll_devices(bool block) {
+    using Clock = std::chrono::steady_clock;
+    devices.next_poll = icount + kDevicePollInterval;
+    bool want_rx = !devices.rx_done && console_in.available() == 0 && !console_in.eof();
+    uint32_t ticks = 0;
+    bool rx = false;
+    int32_t logged = 0;
+    if (replay_value(logged)) {
+        ticks = static_cast<uint32_t>(logged & 0xFFFF);
+        rx = (logged & 0x10000) != 0;
+    } else {
+        auto period = devices.clock_hz ? std::chrono::nanoseconds(1000000000 / devices.clock_hz)
+                                       : std::chrono::nanoseconds(0);
+        if (block) {
+            console_out.flush();
+            if (want_rx && console_in.poll_fd >= 0) {
+                int timeout = -1;
+                if (devices.clock_hz) {
+                    auto wait = std::chrono::ceil<std::chrono::milliseconds>(next_tick_ - Clock::now());
+                    timeout = static_cast<int>(std::max<int64_t>(0, wait.count()));
+                }
+                struct pollfd pfd {console_in.poll_fd, POLLIN, 0};
+                ::poll(&pfd, 1, timeout);
+            } else if (!want_rx && devices.clock_hz) {
+                std::this_thread::sleep_until(next_tick_);
+            }
+        }
+        if (devices.clock_hz) {
+            auto now = Clock::now();
+            while (now >= next_tick_ && ticks < 0xFFFF) {
+                ++ticks;
+                next_tick_ += period;
+            }
+            if (now >= next_tick_) {
+                next_tick_ = now + period; // far behind: drop the backlog
+            }
+        }
+        if (want_rx) {
+            if (console_in.poll_fd < 0) {
+                rx = true;
+            } else {
+                struct pollfd pfd {console_in.poll_fd, POLLIN, 0};
+                rx = ::poll(&pfd, 1, 0) > 0;
+            }
+        }
+        record_value(static_cast<int32_t>(ticks) | (rx ? 0x10000 : 0));
+    }
+    if (ticks > 0) {
+        devices.clock_monitor = true;
+        devices.clock_irq = devices.clock_irq || devices.clock_ie;
+    }
+    if (rx) {
+        input_ready(); // reads (or replays) the bytes
+    }
+}
+
+bool CPU::service_devices() {
+    if (devices.rx_taken) {
+        console_in.consume(1);
+        devices.rx_taken = false;
+    }
+    if (devices.waiting || icount >= devices.next_poll) {
+        poll_devices(devices.waiting);
+    }
+    if (devices.waiting && !wake_possible()) {
+        halted = true; // input ended while waiting for it
+        console_out.flush();
+        return true;
+    }
+    if (!devices.rx_done && console_in.available() > 0) {
+        devices.rx_done = true;
+        devices.rx_irq = devices.rx_irq || devices.rx_ie;
+    }
+    // KW11-L interrupts at BR6, the DL11 at BR4 (receiver before transmitter).
+    if (devices.clock_irq && psw.priority < 6) {
+        devices.clock_irq = false;
+        interrupt(0100);
+        return true;
+    }
+    if (psw.priority < 4 && (devices.rx_irq || devices.tx_irq)) {
+        if (devices.rx_irq) {
+            devices.rx_irq = false;
+            interrupt(060);
+        } else {
+            devices.tx_irq = false;
+            interrupt(064);
+        }
+        return true;
+    }
+    return devices.waiting;
+}
+
+bool CPU::wake_possible() const {
+    return devices.rx_irq || devices.tx_irq || devices.clock_irq ||
+           (devices.clock_ie && devices.clock_hz != 0) ||
+           (devices.rx_ie && (devices.rx_done || console_in.available() > 0 || !console_in.eof()));
+}
+
+void CPU::interrupt(uint16_t vector) {
+    uint16_t old_psw = psw_word();
+    r[6] = static_cast<uint16_t>(r[6] - 2);
+    write_word(r[6], old_psw);
+    r[6] = static_cast<uint16_t>(r[6] - 2);
+    write_word(r[6], r[7]);
+    r[7] = read_word_code(vector);
+    set_psw_word(read_word_code(static_cast<uint16_t>(vector + 2)));
+    devices.waiting = false;
+}
+
+void CPU::enable_coverage() {
+    coverage.assign(kCoverageWords, 0);
+}
+
+bool CPU::covered(uint16_t address) const {
+    if (coverage.empty()) {
+        return false;
+    }
+    uint16_t word = static_cast<uint16_t>(address >> 1);
+    return (coverage[word >> 6] >> (word & 63)) & 1;
+}
+
+void CPU::add_breakpoint(uint16_t address, const std::string& cond, uint64_t ignore_count) {
+    Breakpoint bp;
+    bp.addr = address;
+    bp.cond = Predicate::compile(cond);
+    bp.ignore_count = ignore_count;
+    cond_breaks.push_back(std::move(bp));
+    rebuild_debug_bitmaps();
+}
+
+void CPU::add_watchpoint(uint32_t phys_start, uint32_t length, bool on_read, bool on_write,
+                         const std::string& cond, uint64_t ignore_count) {
+    if (length == 0) {
+        return;
+    }
+    Watchpoint wp;
+    wp.start = phys_start & (kMemSize - 1);
+    wp.end = std::min<uint32_t>(wp.start + length - 1, kMemSize - 1);
+    wp.on_read = on_read;
+    wp.on_write = on_write;
+    wp.cond = Predicate::compile(cond);
+    wp.ignore_count = ignore_count;
+    watchpoints.push_back(std::move(wp));
+    rebuild_debug_bitmaps();
+}
+
+void CPU::clear_breakpoint(uint16_t address) {
+    cond_breaks.erase(std::remove_if(cond_breaks.begin(), cond_breaks.end(),
+                                     [&](const Breakpoint& bp) { return bp.addr == address; }),
+                      cond_breaks.end());
+    rebuild_debug_bitmaps();
+}
+
+void CPU::clear_watchpoint(uint32_t phys_start) {
+    watchpoints.erase(std::remove_if(watchpoints.begin(), watchpoints.end(),
+                                     [&](const Watchpoint& wp) { return wp.start == phys_start; }),
+                      watchpoints.end());
+    rebuild_debug_bitmaps();
+}
+
+void CPU::rebuild_debug_bitmaps() {
+    break_pc_bits_.clear();
+    if (!cond_breaks.empty()) {
+        break_pc_bits_.assign(65536 / 64, 0);
+        for (const auto& bp : cond_breaks) {
+            break_pc_bits_[bp.addr >> 6] |= uint64_t{1} << (bp.addr & 63);
+        }
+    }
+    watch_page_bits_.clear();
+    if (!watchpoints.empty()) {
+        watch_page_bits_.assign((kMemSize >> kWatchPageShift) / 64, 0);
+        for (const auto& wp : watchpoints) {
+            for (uint32_t page = wp.start >> kWatchPageShift; page <= (wp.end >> kWatchPageShift); ++page) {
+                watch_page_bits_[page >> 6] |= uint64_t{1} << (page & 63);
+            }
+        }
+    }
+}
+
+bool CPU::breakpoint_at(uint16_t pc) {
+    if (!breakpoints.empty() && breakpoints.find(pc) != breakpoints.end()) {
+        return true;
+    }
+    if (break_pc_bits_.empty() || !((break_pc_bits_[pc >> 6] >> (pc & 63)) & 1)) {
+        return false;
+    }
+    for (auto& bp : cond_breaks) {
+        if (bp.addr != pc || !bp.cond.eval(*this)) {
+            continue;
+        }
+        if (++bp.hits > bp.ignore_count) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CPU::check_watch(uint32_t phys, int size, bool write) const {
+    for (const auto& wp : watchpoints) {
+        if (write ? !wp.on_write : !wp.on_read) {
+            continue;
+        }
+        uint32_t last = phys + static_cast<uint32_t>(size) - 1;
+        if (last < wp.start || phys > wp.end || !wp.cond.eval(*this)) {
+            continue;
+        }
+        if (++wp.hits > wp.ignore_count && !watch_hit) {
+            watch_hit = true;
+            watch_addr = phys;
+            watch_write = write;
+        }
+    }
+}
+
+CPU::Checkpoint CPU::save_checkpoint() const {
+    Checkpoint cp;
+    cp.icount = icount;
+    for (int i = 0; i < 8; ++i) {
+        cp.r[i] = r[i];
+    }
+    cp.psw = psw;
+    cp.halted = halted;
+    cp.mem_bank = mem_bank;
+    cp.mem.assign(mem.data(), mem.data() + mem.size());
+    for (uint32_t bank = 0; bank < kMemSize / PhysicalMemory::kBankSize; ++bank) {
+        cp.mappings[bank] = mem.mapping(bank);
+    }
+    cp.value_pos = events.values.size();
+    cp.byte_pos = events.bytes.size();
+    if (events.mode == EventLog::Mode::Replay) {
+        cp.value_pos = events.value_pos;
+        cp.byte_pos = events.byte_pos;
+    }
+    cp.input_pending.assign(console_in.data(), console_in.available());
+    cp.devices = devices;
+    return cp;
+}
+
+void CPU::add_checkpoint() {
+    if (checkpoints.size() >= kMaxCheckpoints) {
+        size_t kept = 1;
+        for (size_t i = 2; i < checkpoints.size(); i += 2) {
+            checkpoints[kept++] = std::move(checkpoints[i]);
+        }
+        checkpoints.resize(kept);
+    }
+    checkpoints.push_back(save_checkpoint());
+}
+
+void CPU::restore_registers(const Checkpoint& cp) {
+    icount = cp.icount;
+    for (int i = 0; i < 8; ++i) {
+        r[i] = cp.r[i];
+    }
+    psw = cp.psw;
+    halted = cp.halted;
+    mem_bank = cp.mem_bank;
+    events.value_pos = cp.value_pos;
+    events.byte_pos = cp.byte_pos;
+    console_in.clear();
+    console_in.feed(cp.input_pending.data(), cp.input_pending.size());
+    devices = cp.devices;
+}
+
+// Maps back the files cp was taken with and unmaps any mapped since.
+// Returns the banks whose mapping changed: an anonymous one among them
+// must be copied from cp in full, whatever the dirty marks say.
+uint8_t CPU::restore_mappings(const Checkpoint& cp) {
+    uint8_t changed = 0;
+    for (uint32_t bank = 0; bank < kMemSize / PhysicalMemory::kBankSize; ++bank) {
+        if (mem.mapping(bank) != cp.mappings[bank]) {
+            mem.remap(bank, cp.mappings[bank]); // on failure the bank gets cp's bytes instead
+            changed |= static_cast<uint8_t>(1u << bank);
+        }
+    }
+    return changed;
+}
+
+void CPU::restore_checkpoint(const Checkpoint& cp) {
+    restore_registers(cp);
+    restore_mappings(cp);
+    for (uint32_t bank = 0; bank < kMemSize / PhysicalMemory::kBankSize; ++bank) {
+        if (!mem.mapped(bank)) { // never write snapshot bytes into a file
+            size_t base = bank * PhysicalMemory::kBankSize;
+            std::memcpy(mem.data() + base, cp.mem.data() + base, PhysicalMemory::kBankSize);
+        }
+    }
+    if (!dirty_pages_.empty()) {
+        // Unknown relative to the tracked snapshot now.
+        std::fill(dirty_pages_.begin(), dirty_pages_.end(), ~uint64_t{0});
+    }
+}
+
+void CPU::track_dirty_pages(bool on) {
+    dirty_pages_.assign(on ? (kMemSize >> kDirtyPageShift) / 64 : 0, 0);
+}
+
+void CPU::restore_dirty(const Checkpoint& cp) {
+    restore_registers(cp);
+    uint8_t remapped = restore_mappings(cp);
+    for (uint32_t bank = 0; bank < kMemSize / PhysicalMemory::kBankSize; ++bank) {
+        if ((remapped >> bank & 1) && !mem.mapped(bank)) {
+            size_t base = bank * PhysicalMemory::kBankSize;
+            std::memcpy(mem.data() + base, cp.mem.data() + base, PhysicalMemory::kBankSize);
+        }
+    }
+    constexpr size_t kPage = size_t{1} << kDirtyPageShift;
+    for (size_t w = 0; w < dirty_pages_.size(); ++w) {
+        uint64_t bits = dirty_pages_[w];
+        dirty_pages_[w] = 0;
+        while (bits != 0) {
+            size_t page = w * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+            bits &= bits - 1;
+            size_t base = page * kPage;
+            uint32_t bank = static_cast<uint32_t>(base >> 16);
+            if (!mem.mapped(bank) && !(remapped >> bank & 1)) {
+                std::memcpy(mem.data() + base, cp.mem.data() + base, kPage);
+            }
+        }
+    }
+}
+
+void CPU::take_dirty_pages(std::vector<uint32_t>& pages) {
+    for (size_t w = 0; w < dirty_pages_.size(); ++w) {
+        uint64_t bits = dirty_pages_[w];
+        dirty_pages_[w] = 0;
+        while (bits != 0) {
+            pages.push_back(static_cast<uint32_t>(w * 64 + static_cast<size_t>(__builtin_ctzll(bits))));
+            bits &= bits - 1;
+        }
+    }
+}
+
+bool CPU::rewind_to(uint64_t target_icount) {
+    if (events.mode == EventLog::Mode::Off) {
+        return false;
+    }
+    const Checkpoint* best = nullptr;
+    for (const auto& cp : checkpoints) {
+        if (cp.icount <= target_icount && (!best || cp.icount > best->icount)) {
+            best = &cp;
+        }
+    }
+    if (!best) {
+        return false;
+    }
+    restore_checkpoint(*best);
+    events.mode = EventLog::Mode::Replay;
+    bool was_quiet = events.quiet;
+    events.quiet = true;
+    while (icount < target_icount && !halted) {
+        step();
+    }
+    events.quiet = was_quiet;
+    return icount == target_icount;
+}
+
+bool CPU::step_back() {
+    if (icount == 0) {
+        return false;
+    }
+    return rewind_to(icount - 1);
+}
+
+bool CPU::replay_value(int32_t& value) {
+    if (events.mode != EventLog::Mode::Replay) {
+        return false;
+    }
+    if (events.value_pos >= events.values.size()) {
+        // Log exhausted: the host is back where recording stopped.
+        events.mode = EventLog::Mode::Record;
+        events.values.resize(events.value_pos);
+        events.bytes.resize(events.byte_pos);
+        return false;
+    }
+    value = events.values[events.value_pos++];
+    return true;
+}
+
+void CPU::record_value(int32_t value) {
+    if (events.mode == EventLog::Mode::Record) {
+        events.values.push_back(value);
+    }
+}
+
+bool CPU::input_ready() {
+    if (console_in.available() > 0) {
+        return true;
+    }
+    int32_t logged = 0;
+    if (replay_value(logged)) {
+        size_t n = logged > 0 ? static_cast<size_t>(logged) : 0;
+        n = std::min(n, events.bytes.size() - events.byte_pos);
+        console_in.feed(reinterpret_cast<const char*>(events.bytes.data() + events.byte_pos), n);
+        events.byte_pos += n;
+        return n > 0;
+    }
+    console_out.flush(); // prompts must be visible before blocking on input
+    size_t n = console_in.refill();
+    if (events.mode == EventLog::Mode::Record && !console_in.would_block()) {
+        record_value(static_cast<int32_t>(n));
+        events.bytes.insert(events.bytes.end(), console_in.data(), console_in.data() + n);
+    }
+    return n > 0;
+}
+
+int CPU::get_char() {
+    if (!input_ready()) {
+        return EOF;
+    }
+    int ch = static_cast<uint8_t>(console_in.data()[0]);
+    console_in.consume(1);
+    return ch;
+}
+
+void CPU::write_block(uint16_t address, const uint8_t* data, size_t len) {
+    if (!bulk_write_ok(mem_bank)) {
+        for (size_t i = 0; i < len; ++i) {
+            write_byte(static_cast<uint16_t>(address + i), data[i]);
+        }
+        return;
+    }
+    Span spans[2];
+    int n = data_spans(address, len, spans);
+    for (int i = 0; i < n; ++i) {
+        std::memcpy(spans[i].data, data, spans[i].len);
+        mark_dirty(static_cast<uint32_t>(spans[i].data - mem.data()), spans[i].len);
+        data += spans[i].len;
+    }
+}
+
+void CPU::read_block(uint16_t address, uint8_t* out, size_t len) {
+    if (!bulk_access_ok()) {
+        for (size_t i = 0; i < len; ++i) {
+            out[i] = read_byte(static_cast<uint16_t>(address + i));
+        }
+        return;
+    }
+    Span spans[2];
+    int n = data_spans(address, len, spans);
+    for (int i = 0; i < n; ++i) {
+        std::memcpy(out, spans[i].data, spans[i].len);
+        out += spans[i].len;
+    }
+}
+
+int CPU::data_spans(uint16_t address, size_t len, Span out[2]) {
+    // Addresses wrap within the current bank, like write_byte().
+    uint8_t* bank = &mem[phys_addr(0, mem_bank)];
+    len = std::min<size_t>(len, 0x10000);
+    size_t first = std::min<size_t>(len, 0x10000 - address);
+    out[0] = {bank + address, first};
+    if (first == len) {
+        return 1;
+    }
+    out[1] = {bank, len - first};
+    return 2;
+}
+
+void CPU::put_char(uint8_t ch) {
+    if (!events.quiet) {
+        console_out.put(static_cast<char>(ch));
+    }
+}
+
+void CPU::put_string(uint16_t address) {
+    if (!bulk_access_ok()) {
+        while (true) {
+            uint8_t ch = read_byte(address);
+            if (ch == 0) break;
+            put_char(ch);
+            address = static_cast<uint16_t>(address + 1);
+        }
+        return;
+    }
+    size_t len = guest_strlen(address);
+    if (events.quiet) {
+        return;
+    }
+    // Copy straight from guest memory, wrapping once at the end of the bank.
+    Span spans[2];
+    int n = data_spans(address, len, spans);
+    for (int i = 0; i < n; ++i) {
+        console_out.write(reinterpret_cast<const char*>(spans[i].data), spans[i].len);
+    }
+}
+
+size_t CPU::guest_strlen(uint16_t address) {
+    if (!bulk_access_ok()) {
+        for (size_t i = 0; i < 0x10000; ++i) {
+            if (read_byte(static_cast<uint16_t>(address + i)) == 0) {
+                return i;
+            }
+        }
+        return 0x10000;
+    }
+    Span spans[2];
+    int n = data_spans(address, 0x10000, spans);
+    size_t len = 0;
+    for (int i = 0; i < n; ++i) {
+        size_t at = scan::find_byte(spans[i].data, spans[i].len, 0);
+        len += at;
+        if (at < spans[i].len) {
+            return len;
+        }
+    }
+    return 0x10000;
 }
 
 void CPU::load_words(uint16_t address, const std::vector<uint16_t>& words) {
@@ -35,27 +663,37 @@ void CPU::load_words(uint16_t address, const std::vector<uint16_t>& words) {
     }
 }
 
-static inline uint32_t phys_addr(uint16_t addr, uint8_t bank) {
-    return (static_cast<uint32_t>(bank & 0x3) << 16) | addr;
-}
-
 uint16_t CPU::read_word(uint16_t address) const {
+    uint16_t io_value = 0;
+    if (devices.enabled && address >= kIoPageStart && io_read(static_cast<uint16_t>(address & ~1), io_value)) {
+        return io_value;
+    }
     uint32_t p = phys_addr(address, mem_bank);
-    uint16_t lo = mem[p];
-    uint16_t hi = mem[(p + 1) & (CPU::kMemSize - 1)];
+    if (watching(p) || watching((p + 1) & (CPU::kMemSize - 1))) {
+        check_watch(p, 2, false);
+    }
+    uint16_t value = word_at(p);
     if (mem_watch.trace_all || (mem_watch.enabled && address >= mem_watch.start && address <= mem_watch.end)) {
         std::cout << "MEM R PC=0x" << std::hex << std::setw(4) << std::setfill('0') << r[7]
                   << " addr=0x" << std::setw(4) << address
-                  << " size=2 val=0x" << std::setw(4) << static_cast<uint16_t>(lo | (hi << 8))
+                  << " size=2 val=0x" << std::setw(4) << value
                   << std::dec << "\n";
     }
-    return static_cast<uint16_t>(lo | (hi << 8));
+    return value;
 }
 
 void CPU::write_word(uint16_t address, uint16_t value) {
+    if (devices.enabled && address >= kIoPageStart && io_write(static_cast<uint16_t>(address & ~1), value, false)) {
+        return;
+    }
     uint32_t p = phys_addr(address, mem_bank);
-    mem[p] = static_cast<uint8_t>(value & 0xFF);
-    mem[(p + 1) & (CPU::kMemSize - 1)] = static_cast<uint8_t>((value >> 8) & 0xFF);
+    if (watching(p) || watching((p + 1) & (CPU::kMemSize - 1))) {
+        check_watch(p, 2, true);
+    }
+    if (!mem.read_only(mem_bank)) {
+        set_word_at(p, value);
+        mark_dirty(p, 2);
+    }
     if (mem_watch.trace_all || (mem_watch.enabled && address >= mem_watch.start && address <= mem_watch.end)) {
         std::cout << "MEM W PC=0x" << std::hex << std::setw(4) << std::setfill('0') << r[7]
                   << " addr=0x" << std::setw(4) << address
@@ -65,20 +703,24 @@ void CPU::write_word(uint16_t address, uint16_t value) {
 }
 
 uint16_t CPU::read_word_code(uint16_t address) const {
-    uint32_t p = phys_addr(address, 0);
-    uint16_t lo = mem[p];
-    uint16_t hi = mem[(p + 1) & (CPU::kMemSize - 1)];
-    return static_cast<uint16_t>(lo | (hi << 8));
+    return word_at(phys_addr(address, 0));
 }
 
 void CPU::write_word_code(uint16_t address, uint16_t value) {
     uint32_t p = phys_addr(address, 0);
-    mem[p] = static_cast<uint8_t>(value & 0xFF);
-    mem[(p + 1) & (CPU::kMemSize - 1)] = static_cast<uint8_t>((value >> 8) & 0xFF);
+    set_word_at(p, value);
+    mark_dirty(p, 2);
 }
 
 uint8_t CPU::read_byte(uint16_t address) const {
+    uint16_t io_value = 0;
+    if (devices.enabled && address >= kIoPageStart && io_read(static_cast<uint16_t>(address & ~1), io_value)) {
+        return static_cast<uint8_t>((address & 1) ? io_value >> 8 : io_value);
+    }
     uint32_t p = phys_addr(address, mem_bank);
+    if (watching(p)) {
+        check_watch(p, 1, false);
+    }
     if (mem_watch.trace_all || (mem_watch.enabled && address >= mem_watch.start && address <= mem_watch.end)) {
         std::cout << "MEM R PC=0x" << std::hex << std::setw(4) << std::setfill('0') << r[7]
                   << " addr=0x" << std::setw(4) << address
@@ -89,8 +731,17 @@ uint8_t CPU::read_byte(uint16_t address) const {
 }
 
 void CPU::write_byte(uint16_t address, uint8_t value) {
+    if (devices.enabled && address >= kIoPageStart && io_write(address, value, true)) {
+        return;
+    }
     uint32_t p = phys_addr(address, mem_bank);
-    mem[p] = value;
+    if (watching(p)) {
+        check_watch(p, 1, true);
+    }
+    if (!mem.read_only(mem_bank)) {
+        mem[p] = value;
+        mark_dirty(p, 1);
+    }
     if (mem_watch.trace_all || (mem_watch.enabled && address >= mem_watch.start && address <= mem_watch.end)) {
         std::cout << "MEM W PC=0x" << std::hex << std::setw(4) << std::setfill('0') << r[7]
                   << " addr=0x" << std::setw(4) << address
@@ -99,522 +750,1366 @@ void CPU::write_byte(uint16_t address, uint8_t value) {
     }
 }
 
-uint16_t CPU::fetch_word() {
-    uint16_t value = read_word_code(r[7]);
-    r[7] = static_cast<uint16_t>(r[7] + 2);
-    return value;
+uint16_t CPU::fetch_word() {
+    uint16_t value = read_word_code(r[7]);
+    r[7] = static_cast<uint16_t>(r[7] + 2);
+    return value;
+}
+
+void CPU::set_nz(uint16_t value) {
+    psw.n = (value & 0x8000) != 0;
+    psw.z = value == 0;
+}
+
+void CPU::set_nz_byte(uint8_t value) {
+    psw.n = (value & 0x80) != 0;
+    psw.z = value == 0;
+}
+
+CPU::EA CPU::resolve_ea(uint16_t spec, Access access, int size) {
+    uint16_t mode = (spec >> 3) & 0x7;
+    uint16_t reg = spec & 0x7;
+    uint16_t delta = static_cast<uint16_t>(size);
+    if (size == 1 && (reg == 6 || reg == 7)) {
+        delta = 2;
+    }
+
+    EA ea;
+
+    switch (mode) {
+        case 0: // Register
+            ea.is_reg = true;
+            ea.reg = &r[reg];
+            return ea;
+        case 1: // Register deferred
+            ea.addr = r[reg];
+            return ea;
+        case 2: { // Autoincrement
+            ea.addr = r[reg];
+            r[reg] = static_cast<uint16_t>(r[reg] + delta);
+            if (reg == 7) {
+                ea.is_code = true; // immediate operand lives in code space
+            }
+            return ea;
+        }
+        case 3: { // Autoincrement deferred
+            uint16_t ptr = r[reg];
+            r[reg] = static_cast<uint16_t>(r[reg] + delta);
+            ea.addr = (reg == 7) ? read_word_code(ptr) : read_word(ptr);
+            return ea;
+        }
+        case 4: { // Autodecrement
+            r[reg] = static_cast<uint16_t>(r[reg] - delta);
+            ea.addr = r[reg];
+            return ea;
+        }
+        case 5: { // Autodecrement deferred
+            r[reg] = static_cast<uint16_t>(r[reg] - delta);
+            ea.addr = read_word(r[reg]);
+            return ea;
+        }
+        case 6: { // Index
+            int16_t disp = static_cast<int16_t>(fetch_word());
+            ea.addr = static_cast<uint16_t>(r[reg] + disp);
+            if (reg == 7) {
+                ea.is_code = true; // PC-relative literal lives in code space
+            }
+            return ea;
+        }
+        case 7: { // Index deferred
+            int16_t disp = static_cast<int16_t>(fetch_word());
+            uint16_t ptr = static_cast<uint16_t>(r[reg] + disp);
+            ea.addr = (reg == 7) ? read_word_code(ptr) : read_word(ptr);
+            return ea;
+        }
+        default:
+            throw std::runtime_error("Invalid addressing mode");
+    }
+}
+
+uint16_t CPU::read_operand(uint16_t spec) {
+    EA ea = resolve_ea(spec, Access::Read, 2);
+    if (ea.is_reg) {
+        return *ea.reg;
+    }
+    if (ea.is_code) {
+        return read_word_code(ea.addr);
+    }
+    return read_word(ea.addr);
+}
+
+void CPU::write_operand(uint16_t spec, uint16_t value) {
+    EA ea = resolve_ea(spec, Access::Write, 2);
+    if (ea.is_reg) {
+        *ea.reg = value;
+        return;
+    }
+    write_word(ea.addr, value);
+}
+
+uint8_t CPU::read_operand_byte(uint16_t spec) {
+    EA ea = resolve_ea(spec, Access::Read, 1);
+    if (ea.is_reg) {
+        return static_cast<uint8_t>(*ea.reg & 0xFF);
+    }
+    if (ea.is_code) {
+        return static_cast<uint8_t>(read_word_code(ea.addr) & 0xFF);
+    }
+    return read_byte(ea.addr);
+}
+
+void CPU::write_operand_byte(uint16_t spec, uint8_t value, bool sign_extend_to_reg) {
+    EA ea = resolve_ea(spec, Access::Write, 1);
+    if (ea.is_reg) {
+        if (sign_extend_to_reg) {
+            int8_t s = static_cast<int8_t>(value);
+            *ea.reg = static_cast<uint16_t>(static_cast<int16_t>(s));
+        } else {
+            *ea.reg = static_cast<uint16_t>((*ea.reg & 0xFF00) | value);
+        }
+        return;
+    }
+    write_byte(ea.addr, value);
+}
+
+uint16_t CPU::operand_address(uint16_t spec) {
+    EA ea = resolve_ea(spec, Access::AddressOnly, 2);
+    if (ea.is_reg) {
+        return *ea.reg;
+    }
+    return ea.addr;
+}
+
+CPU::FileHandle::FileHandle(FileHandle&& other) noexcept
+    : fd(other.fd), offset(other.offset), append(other.append), seekable(other.seekable) {
+    other.fd = -1;
+}
+
+CPU::FileHandle& CPU::FileHandle::operator=(FileHandle&& other) noexcept {
+    if (this != &other) {
+        close();
+        fd = other.fd;
+        offset = other.offset;
+        append = other.append;
+        seekable = other.seekable;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+CPU::FileHandle::~FileHandle() {
+    close();
+}
+
+bool CPU::FileHandle::close() {
+    if (fd < 0) {
+        return false;
+    }
+    int rc = ::close(fd);
+    fd = -1;
+    return rc == 0;
+}
+
+long CPU::FileHandle::read_at(uint8_t* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = seekable ? ::pread(fd, data + done, len - done, static_cast<off_t>(offset))
+                             : ::read(fd, data + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return done > 0 ? static_cast<long>(done) : -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+        if (!seekable) {
+            break; // pipes and terminals return what is available
+        }
+    }
+    return static_cast<long>(done);
+}
+
+long CPU::FileHandle::write_at(const uint8_t* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = (seekable && !append)
+                        ? ::pwrite(fd, data + done, len - done, static_cast<off_t>(offset))
+                        : ::write(fd, data + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+    if (append && seekable) {
+        off_t pos = ::lseek(fd, 0, SEEK_CUR);
+        if (pos >= 0) {
+            offset = static_cast<uint64_t>(pos);
+        }
+    }
+    return static_cast<long>(done);
+}
+
+namespace {
+
+// Drops `n` transferred bytes from the front of an iovec array.
+int advance_iov(iovec*& iov, int count, size_t n) {
+    while (count > 0 && n >= iov->iov_len) {
+        n -= iov->iov_len;
+        ++iov;
+        --count;
+    }
+    if (count > 0) {
+        iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + n;
+        iov->iov_len -= n;
+    }
+    return count;
+}
+
+} // namespace
+
+long CPU::FileHandle::readv_at(iovec* iov, int count) {
+    size_t done = 0;
+    while (count > 0) {
+        ssize_t n = seekable ? ::preadv(fd, iov, count, static_cast<off_t>(offset))
+                             : ::readv(fd, iov, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return done > 0 ? static_cast<long>(done) : -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+        if (!seekable) {
+            break;
+        }
+        count = advance_iov(iov, count, static_cast<size_t>(n));
+    }
+    return static_cast<long>(done);
+}
+
+long CPU::FileHandle::writev_at(iovec* iov, int count) {
+    size_t done = 0;
+    while (count > 0) {
+        ssize_t n = (seekable && !append)
+                        ? ::pwritev(fd, iov, count, static_cast<off_t>(offset))
+                        : ::writev(fd, iov, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        done += static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+        count = advance_iov(iov, count, static_cast<size_t>(n));
+    }
+    if (append && seekable) {
+        off_t pos = ::lseek(fd, 0, SEEK_CUR);
+        if (pos >= 0) {
+            offset = static_cast<uint64_t>(pos);
+        }
+    }
+    return static_cast<long>(done);
+}
+
+bool CPU::FileHandle::seek(int64_t off, int whence) {
+    if (!seekable) {
+        return false;
+    }
+    int64_t base = 0;
+    if (whence == 1) {
+        base = static_cast<int64_t>(offset);
+    } else if (whence == 2) {
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            return false;
+        }
+        base = static_cast<int64_t>(st.st_size);
+    }
+    if (base + off < 0) {
+        return false;
+    }
+    offset = static_cast<uint64_t>(base + off);
+    return true;
+}
+
+std::vector<CPU::IoSegment> CPU::io_segments(uint16_t table, uint16_t count) {
+    // Each descriptor is 3 words: bank, address, length. The total is capped
+    // so the byte count still fits in R0.
+    std::vector<IoSegment> segs;
+    size_t total = 0;
+    for (uint16_t i = 0; i < std::min(count, kMaxIoSegments) && total < 0xFFFF; ++i) {
+        uint16_t at = static_cast<uint16_t>(table + i * 6);
+        IoSegment seg;
+        seg.bank = static_cast<uint8_t>(read_word(at) & 0x3);
+        seg.addr = read_word(static_cast<uint16_t>(at + 2));
+        seg.len = static_cast<uint16_t>(
+            std::min<size_t>(read_word(static_cast<uint16_t>(at + 4)), 0xFFFF - total));
+        total += seg.len;
+        segs.push_back(seg);
+    }
+    return segs;
+}
+
+void CPU::scatter(const std::vector<IoSegment>& segs, const uint8_t* data, size_t len) {
+    uint8_t saved_bank = mem_bank;
+    for (const auto& seg : segs) {
+        if (len == 0) {
+            break;
+        }
+        size_t n = std::min<size_t>(seg.len, len);
+        mem_bank = seg.bank;
+        write_block(seg.addr, data, n);
+        data += n;
+        len -= n;
+    }
+    mem_bank = saved_bank;
+}
+
+void CPU::gather(const std::vector<IoSegment>& segs, uint8_t* out, size_t len) {
+    uint8_t saved_bank = mem_bank;
+    for (const auto& seg : segs) {
+        if (len == 0) {
+            break;
+        }
+        size_t n = std::min<size_t>(seg.len, len);
+        mem_bank = seg.bank;
+        read_block(seg.addr, out, n);
+        out += n;
+        len -= n;
+    }
+    mem_bank = saved_bank;
+}
+
+std::string CPU::read_path(uint16_t address) const {
+    std::string path;
+    for (int i = 0; i < 1024; ++i) {
+        uint8_t ch = read_byte(static_cast<uint16_t>(address + i));
+        if (ch == 0) break;
+        path.push_back(static_cast<char>(ch));
+    }
+    return path;
+}
+
+CPU::FileHandle* CPU::file_at(uint16_t handle) {
+    if (handle >= files.size() || !files[handle].is_open()) {
+        return nullptr;
+    }
+    return &files[handle];
+}
+
+void CPU::file_trap(uint8_t vec) {
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+
+    if (vec == 20) { // open file: R0=addr, R1=mode
+        std::string path = read_path(r[0]);
+        int flags = O_RDONLY;
+        switch (r[1]) {
+            case 0: flags = O_RDONLY; break;
+            case 1: flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+            case 2: flags = O_WRONLY | O_CREAT | O_APPEND; break;
+            case 3: flags = O_RDWR; break;
+            default: flags = O_RDONLY; break;
+        }
+        int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+            return;
+        }
+        FileHandle fh(fd);
+        fh.append = (flags & O_APPEND) != 0;
+        struct stat st {};
+        fh.seekable = ::fstat(fd, &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode));
+        if (fh.append && fh.seekable) {
+            fh.seek(0, 2);
+        }
+        size_t handle = 0;
+        for (; handle < files.size(); ++handle) {
+            if (!files[handle].is_open()) {
+                break;
+            }
+        }
+        if (handle == files.size()) {
+            files.emplace_back();
+        }
+        files[handle] = std::move(fh);
+        r[0] = static_cast<uint16_t>(handle);
+        psw.z = false;
+        return;
+    }
+
+    FileHandle* fh = file_at(r[0]);
+
+    if (vec == 21) { // read file: R0=handle, R1=buf, R2=max
+        uint16_t addr = r[1];
+        uint16_t max = r[2];
+        if (!fh || max == 0) {
+            r[0] = 0;
+            psw.z = true;
+            return;
+        }
+        long count = 0;
+        if (bulk_write_ok(mem_bank)) {
+            // Read straight into guest memory.
+            Span spans[2];
+            int n = data_spans(addr, max, spans);
+            for (int i = 0; i < n; ++i) {
+                long got = fh->read_at(spans[i].data, spans[i].len);
+                mark_dirty(static_cast<uint32_t>(spans[i].data - mem.data()), spans[i].len);
+                if (got > 0) {
+                    count += got;
+                }
+                if (got < static_cast<long>(spans[i].len)) {
+                    break;
+                }
+            }
+        } else {
+            std::vector<uint8_t> buf(max);
+            count = std::max(0L, fh->read_at(buf.data(), max));
+            write_block(addr, buf.data(), static_cast<size_t>(count));
+        }
+        r[0] = static_cast<uint16_t>(count);
+        psw.z = (count == 0);
+        return;
+    }
+    if (vec == 22) { // write file: R0=handle, R1=buf, R2=len
+        if (!fh) {
+            r[0] = 0;
+            psw.z = true;
+            return;
+        }
+        uint16_t addr = r[1];
+        uint16_t len = r[2];
+        bool ok = true;
+        if (bulk_access_ok()) {
+            // Write straight from guest memory.
+            Span spans[2];
+            int n = data_spans(addr, len, spans);
+            for (int i = 0; i < n && ok; ++i) {
+                ok = fh->write_at(spans[i].data, spans[i].len) >= 0;
+            }
+        } else {
+            std::vector<uint8_t> buf(len);
+            for (uint16_t i = 0; i < len; ++i) {
+                buf[i] = read_byte(static_cast<uint16_t>(addr + i));
+            }
+            ok = fh->write_at(buf.data(), len) >= 0;
+        }
+        if (!ok) {
+            r[0] = 0;
+            psw.z = true;
+        } else {
+            r[0] = len;
+            psw.z = (len == 0);
+        }
+        return;
+    }
+    if (vec == 33 || vec == 34) { // readv/writev: R0=handle, R1=descriptors, R2=count
+        if (!fh) {
+            r[0] = 0;
+            psw.z = true;
+            return;
+        }
+        std::vector<IoSegment> segs = io_segments(r[1], r[2]);
+        size_t total = 0;
+        for (const auto& seg : segs) {
+            total += seg.len;
+        }
+        bool direct = bulk_access_ok();
+        for (const auto& seg : segs) {
+            direct = direct && (vec == 34 || !mem.read_only(seg.bank));
+        }
+        long count = 0;
+        if (direct) {
+            // One host call straight to or from guest memory.
+            std::vector<iovec> iov;
+            uint8_t saved_bank = mem_bank;
+            for (const auto& seg : segs) {
+                mem_bank = seg.bank;
+                Span spans[2];
+                int n = data_spans(seg.addr, seg.len, spans);
+                for (int i = 0; i < n; ++i) {
+                    if (spans[i].len > 0) {
+                        iov.push_back({spans[i].data, spans[i].len});
+                        if (vec == 33) {
+                            mark_dirty(static_cast<uint32_t>(spans[i].data - mem.data()), spans[i].len);
+                        }
+                    }
+                }
+            }
+            mem_bank = saved_bank;
+            int n = static_cast<int>(iov.size());
+            count = vec == 33 ? fh->readv_at(iov.data(), n) : fh->writev_at(iov.data(), n);
+        } else {
+            std::vector<uint8_t> buf(total);
+            if (vec == 33) {
+                count = fh->read_at(buf.data(), total);
+                if (count > 0) {
+                    scatter(segs, buf.data(), static_cast<size_t>(count));
+                }
+            } else {
+                gather(segs, buf.data(), total);
+                count = fh->write_at(buf.data(), total);
+            }
+        }
+        r[0] = static_cast<uint16_t>(std::max(0L, count));
+        psw.z = (count <= 0);
+        return;
+    }
+    if (vec == 23) { // close file: R0=handle
+        if (!fh) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+        } else {
+            fh->close();
+            r[0] = 0;
+            psw.z = false;
+        }
+        return;
+    }
+    if (vec == 24) { // seek file: R0=handle, R1=offset (signed), R2=whence
+        if (!fh || !fh->seek(static_cast<int16_t>(r[1]), r[2] <= 2 ? r[2] : 0)) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+        } else {
+            r[0] = 0;
+            psw.z = false;
+        }
+        return;
+    }
+    if (vec == 25) { // tell file: R0=handle
+        if (!fh) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+        } else {
+            r[0] = static_cast<uint16_t>(fh->offset & 0xFFFF);
+            psw.z = false;
+        }
+        return;
+    }
+    if (vec == 27) { // seek32: R0=handle, R1:R2=offset (signed), R3=whence
+        int32_t off = static_cast<int32_t>((static_cast<uint32_t>(r[1]) << 16) | r[2]);
+        if (!fh || !fh->seek(off, r[3] <= 2 ? r[3] : 0) || fh->offset > 0xFFFFFFFFu) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+        } else {
+            r[0] = 0;
+            r[1] = static_cast<uint16_t>(fh->offset >> 16);
+            r[2] = static_cast<uint16_t>(fh->offset & 0xFFFF);
+            psw.z = false;
+        }
+        return;
+    }
+    if (vec == 28) { // tell32: R0=handle; returns R0:R1=position
+        if (!fh || fh->offset > 0xFFFFFFFFu) {
+            r[0] = 0xFFFF;
+            r[1] = 0xFFFF;
+            psw.z = true;
+        } else {
+            uint64_t pos = fh->offset;
+            r[0] = static_cast<uint16_t>(pos >> 16);
+            r[1] = static_cast<uint16_t>(pos & 0xFFFF);
+            psw.z = false;
+        }
+        return;
+    }
+}
+
+bool CPU::replay_file_trap(uint8_t vec) {
+    int32_t logged = 0;
+    if (!replay_value(logged)) {
+        return false;
+    }
+    r[0] = static_cast<uint16_t>(logged & 0xFFFF);
+    psw.z = (logged & 0x10000) != 0;
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+    if (vec == 27 || vec == 28) {
+        // 32-bit results also return registers R1 (and R2 for seek32)
+        for (int i = 1; i <= (vec == 27 ? 2 : 1); ++i) {
+            if (replay_value(logged)) {
+                r[i] = static_cast<uint16_t>(logged);
+            }
+        }
+    }
+    if (vec == 21 || vec == 33) {
+        size_t n = std::min<size_t>(r[0], events.bytes.size() - events.byte_pos);
+        if (vec == 21) {
+            write_block(r[1], events.bytes.data() + events.byte_pos, n);
+        } else {
+            scatter(io_segments(r[1], r[2]), events.bytes.data() + events.byte_pos, n);
+        }
+        events.byte_pos += n;
+    }
+    return true;
+}
+
+void CPU::record_file_trap(uint8_t vec) {
+    if (events.mode != EventLog::Mode::Record) {
+        return;
+    }
+    record_value(static_cast<int32_t>(r[0]) | (psw.z ? 0x10000 : 0));
+    if (vec == 27 || vec == 28) {
+        for (int i = 1; i <= (vec == 27 ? 2 : 1); ++i) {
+            record_value(r[i]);
+        }
+    }
+    if (vec == 21) {
+        Span spans[2];
+        int n = data_spans(r[1], r[0], spans);
+        for (int i = 0; i < n; ++i) {
+            events.bytes.insert(events.bytes.end(), spans[i].data, spans[i].data + spans[i].len);
+        }
+    }
+    if (vec == 33) {
+        size_t start = events.bytes.size();
+        events.bytes.resize(start + r[0]);
+        gather(io_segments(r[1], r[2]), events.bytes.data() + start, r[0]);
+    }
+}
+
+// Control block at R0 (current data bank), 7 words:
+//   +0 op (0=read, 1=write)   +2 handle   +4 buffer   +6 length
+//   +8 offset high            +10 offset low
+//   +12 status: 0xFFFF while pending, then bytes transferred or 0xFFFE on error
+void CPU::async_submit() {
+    uint16_t cb = r[0];
+    uint16_t op = read_word(cb);
+    FileHandle* fh = file_at(read_word(static_cast<uint16_t>(cb + 2)));
+    int fd = -1;
+    if (fh && op <= 1 && (!aio_ || aio_->in_flight() < AsyncIO::kMaxInFlight)) {
+        fd = ::fcntl(fh->fd, F_DUPFD_CLOEXEC, 0);
+    }
+    if (fd < 0) {
+        r[0] = 0xFFFF;
+        psw.z = true;
+        return;
+    }
+    AsyncIO::Request req;
+    req.id = aio_next_id_;
+    aio_next_id_ = aio_next_id_ == 0x7FFF ? 1 : static_cast<uint16_t>(aio_next_id_ + 1);
+    req.fd = fd;
+    req.write = (op == 1);
+    req.seekable = fh->seekable;
+    req.offset = (static_cast<uint32_t>(read_word(static_cast<uint16_t>(cb + 8))) << 16) |
+                 read_word(static_cast<uint16_t>(cb + 10));
+    // Capped so a full transfer never reads as the error or pending status.
+    req.len = std::min<uint16_t>(read_word(static_cast<uint16_t>(cb + 6)), kAsyncMaxLength);
+    req.bank = mem_bank;
+    req.block = cb;
+    req.buf_addr = read_word(static_cast<uint16_t>(cb + 4));
+    if (req.write) {
+        // Snapshot the payload now; the guest may reuse the buffer.
+        req.data.resize(req.len);
+        read_block(req.buf_addr, req.data.data(), req.len);
+    }
+    write_word(static_cast<uint16_t>(cb + 12), 0xFFFF);
+    if (!aio_) {
+        aio_ = std::make_unique<AsyncIO>();
+    }
+    r[0] = req.id;
+    psw.z = false;
+    aio_->submit(std::move(req));
+}
+
+void CPU::async_complete(const AsyncIO::Request& req) {
+    // Completions land in the bank that was current at submit time.
+    uint8_t saved_bank = mem_bank;
+    mem_bank = req.bank;
+    if (!req.write && req.result > 0) {
+        write_block(req.buf_addr, req.data.data(), static_cast<size_t>(req.result));
+    }
+    write_word(static_cast<uint16_t>(req.block + 12),
+               req.result < 0 ? 0xFFFE : static_cast<uint16_t>(req.result));
+    mem_bank = saved_bank;
+}
+
+void CPU::async_trap(uint8_t vec) {
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+    int32_t logged = 0;
+
+    if (vec == 30) { // submit: R0=control block; returns request id
+        uint16_t cb = r[0];
+        if (replay_value(logged)) {
+            r[0] = static_cast<uint16_t>(logged & 0xFFFF);
+            psw.z = (logged & 0x10000) != 0;
+            if (!psw.z) {
+                write_word(static_cast<uint16_t>(cb + 12), 0xFFFF);
+            }
+            return;
+        }
+        async_submit();
+        record_value(static_cast<int32_t>(r[0]) | (psw.z ? 0x10000 : 0));
+        return;
+    }
+
+    // 31 = poll, 32 = wait for request R0 (0xFFFF = all). Both deliver every
+    // finished request and return the number still outstanding.
+    std::vector<AsyncIO::Request> done;
+    if (replay_value(logged)) {
+        for (int32_t i = 0; i < logged; ++i) {
+            int32_t where = 0;
+            int32_t result = 0;
+            int32_t buf = 0;
+            replay_value(where);
+            replay_value(result);
+            replay_value(buf);
+            AsyncIO::Request req;
+            req.bank = static_cast<uint8_t>((where >> 16) & 0xFF);
+            req.block = static_cast<uint16_t>(where);
+            req.write = (where & 0x1000000) != 0;
+            req.result = result;
+            req.buf_addr = static_cast<uint16_t>(buf);
+            if (!req.write && req.result > 0) {
+                size_t n = std::min<size_t>(static_cast<size_t>(req.result),
+                                            events.bytes.size() - events.byte_pos);
+                req.data.assign(events.bytes.begin() + events.byte_pos,
+                                events.bytes.begin() + events.byte_pos + n);
+                events.byte_pos += n;
+                req.result = static_cast<long>(n);
+            }
+            async_complete(req);
+        }
+        replay_value(logged);
+        r[0] = static_cast<uint16_t>(logged);
+        psw.z = (r[0] == 0);
+        return;
+    }
+    if (aio_) {
+        console_out.flush();
+        aio_->collect(done, vec == 32 ? r[0] : AsyncIO::kNoWait);
+    }
+    for (const auto& req : done) {
+        async_complete(req);
+    }
+    r[0] = static_cast<uint16_t>(aio_ ? aio_->in_flight() : 0);
+    psw.z = (r[0] == 0);
+    if (events.mode == EventLog::Mode::Record) {
+        record_value(static_cast<int32_t>(done.size()));
+        for (const auto& req : done) {
+            record_value((req.write ? 0x1000000 : 0) | (req.bank << 16) | req.block);
+            record_value(static_cast<int32_t>(req.result));
+            record_value(req.buf_addr);
+            if (!req.write && req.result > 0) {
+                events.bytes.insert(events.bytes.end(), req.data.begin(), req.data.end());
+            }
+        }
+        record_value(r[0]);
+    }
+}
+
+void CPU::map_trap(uint8_t vec) {
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+
+    if (vec == 35) { // map file: R0=path, R1=bank 1..3, R2=mode (0=ro,1=rw), R3=offset/64K
+        long mapped = -1;
+        struct stat st {};
+        // Refused under --record/--replay: the log cannot reproduce what a
+        // file holds, so a replay would diverge.
+        if (r[1] >= 1 && r[1] <= 3 && r[2] <= 1 && events.mode == EventLog::Mode::Off) {
+            int fd = ::open(read_path(r[0]).c_str(), (r[2] == 1 ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+            if (fd >= 0) {
+                uint64_t offset = static_cast<uint64_t>(r[3]) * PhysicalMemory::kBankSize;
+                mapped = mem.map_file(r[1], fd, offset, r[2] == 1);
+                if (mapped >= 0 && ::fstat(fd, &st) != 0) {
+                    st.st_size = 0;
+                }
+                ::close(fd); // the mapping keeps the file open
+            }
+        }
+        if (mapped < 0) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+            return;
+        }
+        uint32_t size = static_cast<uint32_t>(std::min<uint64_t>(st.st_size, 0xFFFFFFFFu));
+        r[0] = 0;
+        r[1] = static_cast<uint16_t>(size >> 16);
+        r[2] = static_cast<uint16_t>(size & 0xFFFF);
+        psw.z = false;
+        return;
+    }
+    if (vec == 36) { // unmap: R0=bank
+        if (r[0] < 1 || r[0] > 3 || !mem.mapped(r[0])) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+            return;
+        }
+        mem.unmap(r[0]);
+        r[0] = 0;
+        psw.z = false;
+        return;
+    }
+}
+
+uint8_t CPU::load_phys(uint32_t phys) {
+    uint8_t saved_bank = mem_bank;
+    mem_bank = static_cast<uint8_t>((phys >> 16) & 0x3);
+    uint8_t value = read_byte(static_cast<uint16_t>(phys));
+    mem_bank = saved_bank;
+    return value;
+}
+
+void CPU::store_phys(uint32_t phys, uint8_t value) {
+    uint8_t saved_bank = mem_bank;
+    mem_bank = static_cast<uint8_t>((phys >> 16) & 0x3);
+    write_byte(static_cast<uint16_t>(phys), value);
+    mem_bank = saved_bank;
+}
+
+bool CPU::bulk_phys_ok(uint32_t phys, size_t len, bool write) const {
+    if (!bulk_access_ok() || phys + len > kMemSize) {
+        return false; // hooks to run, or the range wraps past 256K
+    }
+    if (write && len > 0) {
+        for (uint32_t bank = phys >> 16; bank <= (phys + len - 1) >> 16; ++bank) {
+            if (mem.read_only(bank)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void CPU::mem_trap(uint8_t vec) {
+    // R0/R1 are addresses in the banks given by the low/high byte of R3 (for
+    // memset/memchr R1 is a byte value and only the low byte is used).
+    // Ranges run on through physical memory past the end of a bank.
+    uint32_t a = phys_addr(r[0], static_cast<uint8_t>(r[3] & 0xFF));
+    uint32_t b = phys_addr(r[1], static_cast<uint8_t>(r[3] >> 8));
+    size_t len = r[2];
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+
+    if (vec == 40) { // memcpy (overlap safe): R0=dst, R1=src, R2=len
+        if (bulk_phys_ok(a, len, true) && bulk_phys_ok(b, len, false)) {
+            std::memmove(&mem[a], &mem[b], len);
+            mark_dirty(a, len);
+        } else {
+            std::vector<uint8_t> buf(len);
+            for (size_t i = 0; i < len; ++i) {
+                buf[i] = load_phys(static_cast<uint32_t>((b + i) & (kMemSize - 1)));
+            }
+            for (size_t i = 0; i < len; ++i) {
+                store_phys(static_cast<uint32_t>((a + i) & (kMemSize - 1)), buf[i]);
+            }
+        }
+        psw.z = (len == 0);
+        return;
+    }
+    if (vec == 41) { // memset: R0=dst, R1=byte, R2=len
+        uint8_t value = static_cast<uint8_t>(r[1]);
+        if (bulk_phys_ok(a, len, true)) {
+            std::memset(&mem[a], value, len);
+            mark_dirty(a, len);
+        } else {
+            for (size_t i = 0; i < len; ++i) {
+                store_phys(static_cast<uint32_t>((a + i) & (kMemSize - 1)), value);
+            }
+        }
+        psw.z = (len == 0);
+        return;
+    }
+    if (vec == 42) { // memcmp: R0=a, R1=b, R2=len; returns -1/0/1
+        int cmp = 0;
+        if (bulk_phys_ok(a, len, false) && bulk_phys_ok(b, len, false)) {
+            cmp = std::memcmp(&mem[a], &mem[b], len);
+        } else {
+            for (size_t i = 0; i < len && cmp == 0; ++i) {
+                cmp = load_phys(static_cast<uint32_t>((a + i) & (kMemSize - 1))) -
+                      load_phys(static_cast<uint32_t>((b + i) & (kMemSize - 1)));
+            }
+        }
+        r[0] = static_cast<uint16_t>(cmp < 0 ? -1 : (cmp > 0 ? 1 : 0));
+        set_nz(r[0]);
+        return;
+    }
+    if (vec == 43) { // memchr: R0=addr, R1=byte, R2=len; returns R0=addr, R1=bank
+        uint8_t value = static_cast<uint8_t>(r[1]);
+        long found = -1;
+        if (bulk_phys_ok(a, len, false)) {
+            const void* hit = std::memchr(&mem[a], value, len);
+            if (hit) {
+                found = static_cast<const uint8_t*>(hit) - &mem[0];
+            }
+        } else {
+            for (size_t i = 0; i < len; ++i) {
+                uint32_t p = static_cast<uint32_t>((a + i) & (kMemSize - 1));
+                if (load_phys(p) == value) {
+                    found = p;
+                    break;
+                }
+            }
+        }
+        if (found < 0) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+        } else {
+            r[0] = static_cast<uint16_t>(found & 0xFFFF);
+            r[1] = static_cast<uint16_t>(found >> 16);
+            psw.z = false;
+        }
+        return;
+    }
+}
+
+void CPU::string_trap(uint8_t vec) {
+    // Strings live in the current data bank and wrap at 64K like other
+    // bank-relative accesses.
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+    const uint8_t* bank = &mem[phys_addr(0, mem_bank)];
+
+    if (vec == 44) { // strlen: R0=addr; returns length, 0xFFFF if unterminated
+        size_t len = guest_strlen(r[0]);
+        r[0] = static_cast<uint16_t>(std::min<size_t>(len, 0xFFFF));
+        psw.z = (len == 0);
+        return;
+    }
+    if (vec == 45) { // strcmp: R0=a, R1=b; returns -1/0/1
+        uint16_t a = r[0];
+        uint16_t b = r[1];
+        int cmp = 0;
+        size_t done = 0;
+        while (done < 0x10000) {
+            size_t chunk = std::min({0x10000 - done, size_t{0x10000} - a, size_t{0x10000} - b});
+            size_t at = chunk;
+            if (bulk_access_ok()) {
+                at = scan::find_mismatch_or_nul(bank + a, bank + b, chunk);
+            } else {
+                for (size_t i = 0; i < chunk; ++i) {
+                    uint8_t ca = read_byte(static_cast<uint16_t>(a + i));
+                    if (ca != read_byte(static_cast<uint16_t>(b + i)) || ca == 0) {
+                        at = i;
+                        break;
+                    }
+                }
+            }
+            if (at < chunk) {
+                uint8_t ca = read_byte(static_cast<uint16_t>(a + at));
+                uint8_t cb = read_byte(static_cast<uint16_t>(b + at));
+                cmp = (ca > cb) - (ca < cb);
+                break;
+            }
+            a = static_cast<uint16_t>(a + chunk);
+            b = static_cast<uint16_t>(b + chunk);
+            done += chunk;
+        }
+        r[0] = static_cast<uint16_t>(cmp);
+        set_nz(r[0]);
+        return;
+    }
+    if (vec == 46) { // strchr: R0=addr, R1=char; returns address or 0xFFFF
+        uint8_t value = static_cast<uint8_t>(r[1]);
+        size_t at = 0x10000;
+        if (bulk_access_ok()) {
+            Span spans[2];
+            int n = data_spans(r[0], 0x10000, spans);
+            size_t base = 0;
+            for (int i = 0; i < n && at == 0x10000; ++i) {
+                size_t hit = scan::find_either(spans[i].data, spans[i].len, value, 0);
+                if (hit < spans[i].len) {
+                    at = base + hit;
+                }
+                base += spans[i].len;
+            }
+        } else {
+            for (size_t i = 0; i < 0x10000; ++i) {
+                uint8_t ch = read_byte(static_cast<uint16_t>(r[0] + i));
+                if (ch == value || ch == 0) {
+                    at = i;
+                    break;
+                }
+            }
+        }
+        uint16_t addr = static_cast<uint16_t>(r[0] + at);
+        if (at == 0x10000 || read_byte(addr) != value) {
+            r[0] = 0xFFFF;
+            psw.z = true;
+        } else {
+            r[0] = addr;
+            psw.z = false;
+        }
+        return;
+    }
+    if (vec == 47) { // strcpy: R0=dst, R1=src; returns length copied
+        size_t len = guest_strlen(r[1]);
+        size_t n = std::min<size_t>(len + 1, 0x10000);
+        if (bulk_write_ok(mem_bank) && r[0] + n <= 0x10000 && r[1] + n <= 0x10000) {
+            std::memmove(&mem[phys_addr(r[0], mem_bank)], bank + r[1], n);
+            mark_dirty(phys_addr(r[0], mem_bank), n);
+        } else {
+            std::vector<uint8_t> buf(n);
+            read_block(r[1], buf.data(), n);
+            write_block(r[0], buf.data(), n);
+        }
+        r[0] = static_cast<uint16_t>(std::min<size_t>(len, 0xFFFF));
+        psw.z = (len == 0);
+        return;
+    }
+}
+
+// TRAP 1: putc from R0 low byte
+void CPU::trap_putc(uint8_t) {
+    put_char(static_cast<uint8_t>(r[0] & 0xFF));
+}
+
+// TRAP 2: getc into R0 low byte
+void CPU::trap_getc(uint8_t) {
+    int ch = get_char();
+    if (ch == EOF) {
+        r[0] = 0;
+        psw.z = true;
+    } else {
+        r[0] = static_cast<uint16_t>(ch & 0xFF);
+        psw.z = false;
+    }
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+}
+
+// TRAP 3: puts from address in R0 (null-terminated)
+void CPU::trap_puts(uint8_t) {
+    put_string(r[0]);
+}
+
+// TRAP 4: print signed decimal from R0
+void CPU::trap_print_signed(uint8_t) {
+    if (!events.quiet) {
+        console_out.write_signed(static_cast<int16_t>(r[0]));
+    }
+}
+
+// TRAP 5: read line into buffer at R0, max bytes in R1 (includes null)
+void CPU::trap_read_line(uint8_t) {
+    uint16_t addr = r[0];
+    uint16_t max = r[1];
+    uint16_t count = 0;
+    bool saw_char = false;
+    while (count + 1 < max && input_ready()) {
+        saw_char = true;
+        size_t span = std::min<size_t>(console_in.available(), max - 1 - count);
+        const char* data = console_in.data();
+        const void* nl = std::memchr(data, '\n', span);
+        size_t len = nl ? static_cast<size_t>(static_cast<const char*>(nl) - data) : span;
+        write_block(static_cast<uint16_t>(addr + count),
+                    reinterpret_cast<const uint8_t*>(data), len);
+        count = static_cast<uint16_t>(count + len);
+        if (nl) {
+            console_in.consume(len + 1);
+            break;
+        }
+        console_in.consume(len);
+    }
+    if (max > 0) {
+        write_byte(static_cast<uint16_t>(addr + count), 0);
+    }
+    r[0] = count;
+    psw.z = (!saw_char && count == 0);
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+}
+
+// TRAP 6: print unsigned hex from R0
+void CPU::trap_print_hex(uint8_t) {
+    if (!events.quiet) {
+        console_out.write_hex(r[0]);
+    }
+}
+
+// TRAP 7: print unsigned decimal from R0
+void CPU::trap_print_unsigned(uint8_t) {
+    if (!events.quiet) {
+        console_out.write_unsigned(r[0]);
+    }
 }
 
-void CPU::set_nz(uint16_t value) {
-    psw.n = (value & 0x8000) != 0;
-    psw.z = value == 0;
+// TRAP 8: println string from address in R0
+void CPU::trap_println(uint8_t) {
+    put_string(r[0]);
+    put_char('\n');
 }
 
-void CPU::set_nz_byte(uint8_t value) {
-    psw.n = (value & 0x80) != 0;
-    psw.z = value == 0;
+// TRAP 9: read signed integer into R0
+void CPU::trap_read_signed(uint8_t) {
+    int ch = get_char();
+    while (ch != EOF && std::isspace(static_cast<unsigned char>(ch))) {
+        ch = get_char();
+    }
+    if (ch == EOF) {
+        r[0] = 0;
+        psw.z = true;
+        psw.n = false;
+        psw.v = false;
+        psw.c = false;
+        return;
+    }
+
+    int sign = 1;
+    if (ch == '-') {
+        sign = -1;
+        ch = get_char();
+    } else if (ch == '+') {
+        ch = get_char();
+    }
+
+    bool any = false;
+    int32_t value = 0;
+    while (ch != EOF && ch >= '0' && ch <= '9') {
+        any = true;
+        value = value * 10 + (ch - '0');
+        ch = get_char();
+    }
+    if (!any) {
+        r[0] = 0;
+        psw.z = true;
+    } else {
+        value *= sign;
+        r[0] = static_cast<uint16_t>(value);
+        psw.z = false;
+    }
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
 }
 
-CPU::EA CPU::resolve_ea(uint16_t spec, Access access, int size) {
-    uint16_t mode = (spec >> 3) & 0x7;
-    uint16_t reg = spec & 0x7;
-    uint16_t delta = static_cast<uint16_t>(size);
-    if (size == 1 && (reg == 6 || reg == 7)) {
-        delta = 2;
+// TRAP 10: read hex into R0
+void CPU::trap_read_hex(uint8_t) {
+    int ch = get_char();
+    while (ch != EOF && std::isspace(static_cast<unsigned char>(ch))) {
+        ch = get_char();
+    }
+    if (ch == EOF) {
+        r[0] = 0;
+        psw.z = true;
+        psw.n = false;
+        psw.v = false;
+        psw.c = false;
+        return;
+    }
+    if (ch == '0') {
+        int next = get_char();
+        if (next == 'x' || next == 'X') {
+            ch = get_char();
+        } else {
+            ch = next;
+        }
     }
+    bool any = false;
+    uint16_t value = 0;
+    while (ch != EOF) {
+        int digit = -1;
+        if (ch >= '0' && ch <= '9') digit = ch - '0';
+        else if (ch >= 'a' && ch <= 'f') digit = 10 + (ch - 'a');
+        else if (ch >= 'A' && ch <= 'F') digit = 10 + (ch - 'A');
+        else break;
+        any = true;
+        value = static_cast<uint16_t>((value << 4) | (digit & 0xF));
+        ch = get_char();
+    }
+    if (!any) {
+        r[0] = 0;
+        psw.z = true;
+    } else {
+        r[0] = value;
+        psw.z = false;
+    }
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+}
 
-    EA ea;
+// TRAP 26: set memory bank: R0=0..3
+void CPU::trap_set_bank(uint8_t) {
+    mem_bank = static_cast<uint8_t>(r[0] & 0x3);
+    r[0] = 0;
+    psw.z = false;
+    psw.n = false;
+    psw.v = false;
+    psw.c = false;
+}
 
-    switch (mode) {
-        case 0: // Register
-            ea.is_reg = true;
-            ea.reg = &r[reg];
-            return ea;
-        case 1: // Register deferred
-            ea.addr = r[reg];
-            return ea;
-        case 2: { // Autoincrement
-            ea.addr = r[reg];
-            r[reg] = static_cast<uint16_t>(r[reg] + delta);
-            if (reg == 7) {
-                ea.is_code = true; // immediate operand lives in code space
-            }
-            return ea;
+// TRAPs 20-25, 27, 28, 33, 34: host files, with record/replay
+void CPU::trap_file(uint8_t vec) {
+    if (!replay_file_trap(vec)) {
+        file_trap(vec);
+        record_file_trap(vec);
+    }
+}
+
+const CPU::TrapTable& CPU::trap_table() {
+    static const TrapTable table = [] {
+        TrapTable t{};
+        t[1] = &CPU::trap_putc;
+        t[2] = &CPU::trap_getc;
+        t[3] = &CPU::trap_puts;
+        t[4] = &CPU::trap_print_signed;
+        t[5] = &CPU::trap_read_line;
+        t[6] = &CPU::trap_print_hex;
+        t[7] = &CPU::trap_print_unsigned;
+        t[8] = &CPU::trap_println;
+        t[9] = &CPU::trap_read_signed;
+        t[10] = &CPU::trap_read_hex;
+        for (int vec : {20, 21, 22, 23, 24, 25, 27, 28, 33, 34}) {
+            t[vec] = &CPU::trap_file;
         }
-        case 3: { // Autoincrement deferred
-            uint16_t ptr = r[reg];
-            r[reg] = static_cast<uint16_t>(r[reg] + delta);
-            ea.addr = (reg == 7) ? read_word_code(ptr) : read_word(ptr);
-            return ea;
+        t[26] = &CPU::trap_set_bank;
+        for (int vec = 30; vec <= 32; ++vec) {
+            t[vec] = &CPU::async_trap;
         }
-        case 4: { // Autodecrement
-            r[reg] = static_cast<uint16_t>(r[reg] - delta);
-            ea.addr = r[reg];
-            return ea;
+        t[35] = &CPU::map_trap;
+        t[36] = &CPU::map_trap;
+        for (int vec = 40; vec <= 43; ++vec) {
+            t[vec] = &CPU::mem_trap;
         }
-        case 5: { // Autodecrement deferred
-            r[reg] = static_cast<uint16_t>(r[reg] - delta);
-            ea.addr = read_word(r[reg]);
-            return ea;
+        for (int vec = 44; vec <= 47; ++vec) {
+            t[vec] = &CPU::string_trap;
         }
-        case 6: { // Index
-            int16_t disp = static_cast<int16_t>(fetch_word());
-            ea.addr = static_cast<uint16_t>(r[reg] + disp);
-            if (reg == 7) {
-                ea.is_code = true; // PC-relative literal lives in code space
+        return t;
+    }();
+    return table;
+}
+
+// Console TRAPs run against a marked input buffer. If the source runs dry
+// part way through, the bytes, R0 and the PSW are put back so the TRAP can be
+// retried from the start. A pipe read (TRAP 21) is only attempted once the
+// descriptor is readable.
+void CPU::yielding_trap(TrapFn fn, uint8_t vec) {
+    if (vec == 21) {
+        FileHandle* fh = file_at(r[0]);
+        if (fh && !fh->seekable && events.mode != EventLog::Mode::Replay) {
+            pollfd p{fh->fd, POLLIN, 0};
+            if (::poll(&p, 1, 0) == 0) {
+                block_on(fh->fd);
+                return;
             }
-            return ea;
-        }
-        case 7: { // Index deferred
-            int16_t disp = static_cast<int16_t>(fetch_word());
-            uint16_t ptr = static_cast<uint16_t>(r[reg] + disp);
-            ea.addr = (reg == 7) ? read_word_code(ptr) : read_word(ptr);
-            return ea;
         }
-        default:
-            throw std::runtime_error("Invalid addressing mode");
+        (this->*fn)(vec);
+        return;
+    }
+    uint16_t saved_r0 = r[0];
+    Flags saved_psw = psw;
+    console_in.mark();
+    (this->*fn)(vec);
+    if (console_in.would_block()) {
+        console_in.rewind();
+        r[0] = saved_r0;
+        psw = saved_psw;
+        block_on(console_in.poll_fd);
+        return;
     }
+    console_in.release();
 }
 
-uint16_t CPU::read_operand(uint16_t spec) {
-    EA ea = resolve_ea(spec, Access::Read, 2);
-    if (ea.is_reg) {
-        return *ea.reg;
-    }
-    if (ea.is_code) {
-        return read_word_code(ea.addr);
-    }
-    return read_word(ea.addr);
+void CPU::block_on(int fd) {
+    r[7] = static_cast<uint16_t>(r[7] - 2);
+    --icount; // counted again when it is retried
+    blocked = true;
+    blocked_fd = fd;
 }
 
-void CPU::write_operand(uint16_t spec, uint16_t value) {
-    EA ea = resolve_ea(spec, Access::Write, 2);
-    if (ea.is_reg) {
-        *ea.reg = value;
-        return;
-    }
-    write_word(ea.addr, value);
+bool CPU::builtin_trap(uint8_t vector) {
+    return trap_table()[vector] != nullptr;
 }
 
-uint8_t CPU::read_operand_byte(uint16_t spec) {
-    EA ea = resolve_ea(spec, Access::Read, 1);
-    if (ea.is_reg) {
-        return static_cast<uint8_t>(*ea.reg & 0xFF);
+void CPU::register_trap(uint8_t vector, TrapHandler handler) {
+    if (builtin_trap(vector)) {
+        throw std::runtime_error("TRAP " + std::to_string(vector) + " is built in");
     }
-    if (ea.is_code) {
-        return static_cast<uint8_t>(read_word_code(ea.addr) & 0xFF);
+    if (native_traps_.empty()) {
+        native_traps_.resize(256);
     }
-    return read_byte(ea.addr);
+    native_traps_[vector] = std::move(handler);
 }
 
-void CPU::write_operand_byte(uint16_t spec, uint8_t value, bool sign_extend_to_reg) {
-    EA ea = resolve_ea(spec, Access::Write, 1);
-    if (ea.is_reg) {
-        if (sign_extend_to_reg) {
-            int8_t s = static_cast<int8_t>(value);
-            *ea.reg = static_cast<uint16_t>(static_cast<int16_t>(s));
-        } else {
-            *ea.reg = static_cast<uint16_t>((*ea.reg & 0xFF00) | value);
-        }
+void CPU::step() {
+    if (halted) {
         return;
     }
-    write_byte(ea.addr, value);
-}
+    blocked = false;
 
-uint16_t CPU::operand_address(uint16_t spec) {
-    EA ea = resolve_ea(spec, Access::AddressOnly, 2);
-    if (ea.is_reg) {
-        return *ea.reg;
+    if (checkpoint_interval != 0 && icount % checkpoint_interval == 0 &&
+        (checkpoints.empty() || checkpoints.back().icount < icount)) {
+        add_checkpoint();
     }
-    return ea.addr;
-}
+    ++icount;
 
-void CPU::step() {
-    if (halted) {
+    if (devices.enabled && service_devices()) {
         return;
     }
 
     uint16_t pc_before = r[7];
+    if (!coverage.empty()) {
+        uint16_t word = static_cast<uint16_t>(pc_before >> 1);
+        coverage[word >> 6] |= uint64_t{1} << (word & 63);
+    }
     uint16_t instr = fetch_word();
 
     if (instr == 0x0000) { // HALT
         halted = true;
+        console_out.flush();
         return;
     }
 
-    if ((instr & 0xFF00) == 0104000) { // TRAP 104000 + vector
-        uint8_t vec = static_cast<uint8_t>(instr & 0xFF);
-        if (vec == 1) { // putc from R0 low byte
-            if (out_char) {
-                out_char(static_cast<uint8_t>(r[0] & 0xFF));
-            }
-            return;
-        }
-        if (vec == 2) { // getc into R0 low byte
-            int ch = in_char ? in_char() : EOF;
-            if (ch == EOF) {
-                r[0] = 0;
-                psw.z = true;
-            } else {
-                r[0] = static_cast<uint16_t>(ch & 0xFF);
-                psw.z = false;
-            }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 3) { // puts from address in R0 (null-terminated)
-            uint16_t addr = r[0];
-            while (true) {
-                uint8_t ch = read_byte(addr);
-                if (ch == 0) break;
-                if (out_char) {
-                    out_char(ch);
-                }
-                addr = static_cast<uint16_t>(addr + 1);
-            }
-            return;
-        }
-        if (vec == 4) { // print signed decimal from R0
-            int16_t value = static_cast<int16_t>(r[0]);
-            std::ostringstream oss;
-            oss << value;
-            auto s = oss.str();
-            for (char c : s) {
-                if (out_char) {
-                    out_char(static_cast<uint8_t>(c));
-                }
-            }
-            return;
+    if (instr == 0000001) { // WAIT
+        if (!devices.enabled) {
+            // Nothing can interrupt, so this would wait forever.
+            throw std::runtime_error("WAIT without --devices at PC=" + std::to_string(pc_before));
         }
-        if (vec == 5) { // read line into buffer at R0, max bytes in R1 (includes null)
-            uint16_t addr = r[0];
-            uint16_t max = r[1];
-            uint16_t count = 0;
-            bool saw_char = false;
-            while (count + 1 < max) {
-                int ch = in_char ? in_char() : EOF;
-                if (ch == EOF) break;
-                saw_char = true;
-                if (ch == '\n') break;
-                write_byte(static_cast<uint16_t>(addr + count),
-                           static_cast<uint8_t>(ch & 0xFF));
-                ++count;
-            }
-            if (max > 0) {
-                write_byte(static_cast<uint16_t>(addr + count), 0);
-            }
-            r[0] = count;
-            psw.z = (!saw_char && count == 0);
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 6) { // print unsigned hex from R0
-            std::ostringstream oss;
-            oss << "0x" << std::hex << static_cast<uint16_t>(r[0]);
-            auto s = oss.str();
-            for (char c : s) {
-                if (out_char) {
-                    out_char(static_cast<uint8_t>(c));
-                }
-            }
-            return;
-        }
-        if (vec == 7) { // print unsigned decimal from R0
-            std::ostringstream oss;
-            oss << static_cast<uint16_t>(r[0]);
-            auto s = oss.str();
-            for (char c : s) {
-                if (out_char) {
-                    out_char(static_cast<uint8_t>(c));
-                }
-            }
-            return;
-        }
-        if (vec == 8) { // println string from address in R0
-            uint16_t addr = r[0];
-            while (true) {
-                uint8_t ch = read_byte(addr);
-                if (ch == 0) break;
-                if (out_char) {
-                    out_char(ch);
-                }
-                addr = static_cast<uint16_t>(addr + 1);
-            }
-            if (out_char) {
-                out_char('\n');
-            }
-            return;
+        devices.waiting = true;
+        if (!wake_possible()) {
+            halted = true; // nothing could ever interrupt
+            console_out.flush();
         }
-        if (vec == 9) { // read signed integer into R0
-            int ch = in_char ? in_char() : EOF;
-            while (ch != EOF && std::isspace(static_cast<unsigned char>(ch))) {
-                ch = in_char ? in_char() : EOF;
-            }
-            if (ch == EOF) {
-                r[0] = 0;
-                psw.z = true;
-                psw.n = false;
-                psw.v = false;
-                psw.c = false;
-                return;
-            }
+        return;
+    }
 
-            int sign = 1;
-            if (ch == '-') {
-                sign = -1;
-                ch = in_char ? in_char() : EOF;
-            } else if (ch == '+') {
-                ch = in_char ? in_char() : EOF;
-            }
+    if (instr == 0000002 || instr == 0000006) { // RTI, RTT
+        r[7] = read_word(r[6]);
+        r[6] = static_cast<uint16_t>(r[6] + 2);
+        set_psw_word(read_word(r[6]));
+        r[6] = static_cast<uint16_t>(r[6] + 2);
+        note_edge(pc_before, r[7]);
+        return;
+    }
 
-            bool any = false;
-            int32_t value = 0;
-            while (ch != EOF && ch >= '0' && ch <= '9') {
-                any = true;
-                value = value * 10 + (ch - '0');
-                ch = in_char ? in_char() : EOF;
-            }
-            if (!any) {
-                r[0] = 0;
-                psw.z = true;
-            } else {
-                value *= sign;
-                r[0] = static_cast<uint16_t>(value);
-                psw.z = false;
-            }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 10) { // read hex into R0
-            int ch = in_char ? in_char() : EOF;
-            while (ch != EOF && std::isspace(static_cast<unsigned char>(ch))) {
-                ch = in_char ? in_char() : EOF;
-            }
-            if (ch == EOF) {
-                r[0] = 0;
-                psw.z = true;
-                psw.n = false;
-                psw.v = false;
-                psw.c = false;
-                return;
-            }
-            if (ch == '0') {
-                int next = in_char ? in_char() : EOF;
-                if (next == 'x' || next == 'X') {
-                    ch = in_char ? in_char() : EOF;
-                } else {
-                    ch = next;
-                }
-            }
-            bool any = false;
-            uint16_t value = 0;
-            while (ch != EOF) {
-                int digit = -1;
-                if (ch >= '0' && ch <= '9') digit = ch - '0';
-                else if (ch >= 'a' && ch <= 'f') digit = 10 + (ch - 'a');
-                else if (ch >= 'A' && ch <= 'F') digit = 10 + (ch - 'A');
-                else break;
-                any = true;
-                value = static_cast<uint16_t>((value << 4) | (digit & 0xF));
-                ch = in_char ? in_char() : EOF;
-            }
-            if (!any) {
-                r[0] = 0;
-                psw.z = true;
-            } else {
-                r[0] = value;
-                psw.z = false;
-            }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 20) { // open file: R0=addr, R1=mode
-            uint16_t addr = r[0];
-            std::string path;
-            for (int i = 0; i < 1024; ++i) {
-                uint8_t ch = read_byte(static_cast<uint16_t>(addr + i));
-                if (ch == 0) break;
-                path.push_back(static_cast<char>(ch));
-            }
-            std::ios::openmode mode = std::ios::binary;
-            switch (r[1]) {
-                case 0: mode |= std::ios::in; break;
-                case 1: mode |= std::ios::out | std::ios::trunc; break;
-                case 2: mode |= std::ios::out | std::ios::app; break;
-                case 3: mode |= std::ios::in | std::ios::out; break;
-                default: mode |= std::ios::in; break;
-            }
-            auto fs = std::make_unique<std::fstream>(path, mode);
-            if (!fs->is_open()) {
-                r[0] = 0xFFFF;
-                psw.z = true;
-            } else {
-                size_t handle = 0;
-                for (; handle < files.size(); ++handle) {
-                    if (!files[handle]) {
-                        break;
-                    }
-                }
-                if (handle == files.size()) {
-                    files.push_back(nullptr);
-                }
-                files[handle] = std::move(fs);
-                r[0] = static_cast<uint16_t>(handle);
-                psw.z = false;
-            }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 21) { // read file: R0=handle, R1=buf, R2=max
-            uint16_t handle = r[0];
-            uint16_t addr = r[1];
-            uint16_t max = r[2];
-            if (handle >= files.size() || !files[handle] || max == 0) {
-                r[0] = 0;
-                psw.z = true;
-                psw.n = false;
-                psw.v = false;
-                psw.c = false;
-                return;
-            }
-            std::string buf;
-            buf.resize(max);
-            files[handle]->read(&buf[0], max);
-            std::streamsize count = files[handle]->gcount();
-            for (std::streamsize i = 0; i < count; ++i) {
-                write_byte(static_cast<uint16_t>(addr + i),
-                           static_cast<uint8_t>(buf[static_cast<size_t>(i)]));
-            }
-            r[0] = static_cast<uint16_t>(count);
-            psw.z = (count == 0);
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 22) { // write file: R0=handle, R1=buf, R2=len
-            uint16_t handle = r[0];
-            if (handle >= files.size() || !files[handle]) {
-                r[0] = 0;
-                psw.z = true;
-                psw.n = false;
-                psw.v = false;
-                psw.c = false;
-                return;
-            }
-            uint16_t addr = r[1];
-            uint16_t len = r[2];
-            std::string buf;
-            buf.resize(len);
-            for (uint16_t i = 0; i < len; ++i) {
-                buf[i] = static_cast<char>(read_byte(static_cast<uint16_t>(addr + i)));
-            }
-            files[handle]->write(buf.data(), len);
-            if (files[handle]->bad()) {
-                r[0] = 0;
-                psw.z = true;
-            } else {
-                r[0] = len;
-                psw.z = (len == 0);
-            }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 23) { // close file: R0=handle
-            uint16_t handle = r[0];
-            if (handle >= files.size() || !files[handle]) {
-                r[0] = 0xFFFF;
-                psw.z = true;
-            } else {
-                files[handle]->close();
-                files[handle].reset();
-                r[0] = 0;
-                psw.z = false;
-            }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 24) { // seek file: R0=handle, R1=offset (signed), R2=whence
-            uint16_t handle = r[0];
-            if (handle >= files.size() || !files[handle]) {
-                r[0] = 0xFFFF;
-                psw.z = true;
-                psw.n = false;
-                psw.v = false;
-                psw.c = false;
-                return;
-            }
-            std::ios::seekdir dir = std::ios::beg;
-            switch (r[2]) {
-                case 0: dir = std::ios::beg; break;
-                case 1: dir = std::ios::cur; break;
-                case 2: dir = std::ios::end; break;
-                default: dir = std::ios::beg; break;
-            }
-            int16_t off = static_cast<int16_t>(r[1]);
-            files[handle]->clear();
-            files[handle]->seekg(off, dir);
-            files[handle]->seekp(off, dir);
-            if (files[handle]->fail()) {
-                r[0] = 0xFFFF;
-                psw.z = true;
-            } else {
-                r[0] = 0;
-                psw.z = false;
-            }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
-            return;
-        }
-        if (vec == 25) { // tell file: R0=handle
-            uint16_t handle = r[0];
-            if (handle >= files.size() || !files[handle]) {
-                r[0] = 0xFFFF;
-                psw.z = true;
-                psw.n = false;
-                psw.v = false;
-                psw.c = false;
-                return;
-            }
-            files[handle]->clear();
-            std::streampos pos = files[handle]->tellg();
-            if (pos < 0) {
-                pos = files[handle]->tellp();
-            }
-            if (pos < 0) {
-                r[0] = 0xFFFF;
-                psw.z = true;
+    if ((instr & 0xFF00) == 0104000) { // TRAP 104000 + vector
+        uint8_t vec = static_cast<uint8_t>(instr & 0xFF);
+        TrapFn fn = trap_table()[vec];
+        if (fn) {
+            if (yield_on_block && (vec == 2 || vec == 5 || vec == 9 || vec == 10 || vec == 21)) {
+                yielding_trap(fn, vec);
             } else {
-                r[0] = static_cast<uint16_t>(pos & 0xFFFF);
-                psw.z = false;
+                (this->*fn)(vec);
             }
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
             return;
         }
-        if (vec == 26) { // set memory bank: R0=0..3
-            mem_bank = static_cast<uint8_t>(r[0] & 0x3);
-            r[0] = 0;
-            psw.z = false;
-            psw.n = false;
-            psw.v = false;
-            psw.c = false;
+        if (!native_traps_.empty() && native_traps_[vec]) {
+            native_traps_[vec](*this);
             return;
         }
     }
@@ -625,6 +2120,7 @@ void CPU::step() {
     if ((instr & 0xFFC0) == 0000100) { // JMP 0001dd
         uint16_t dst = instr & 0x3F;
         r[7] = operand_address(dst);
+        note_edge(pc_before, r[7]);
         return;
     }
 
@@ -636,6 +2132,7 @@ void CPU::step() {
         write_word(r[6], r[reg]);
         r[reg] = r[7];
         r[7] = addr;
+        note_edge(pc_before, r[7]);
         return;
     }
 
@@ -645,6 +2142,7 @@ void CPU::step() {
         r[reg] = read_word(r[6]);
         r[6] = static_cast<uint16_t>(r[6] + 2);
         r[7] = old;
+        note_edge(pc_before, r[7]);
         return;
     }
 
@@ -780,18 +2278,21 @@ void CPU::step() {
         int8_t off = static_cast<int8_t>(instr & 0xFF);
         if (op == 0000400) { // BR
             r[7] = static_cast<uint16_t>(r[7] + static_cast<int16_t>(off) * 2);
+            note_edge(pc_before, r[7]);
             return;
         }
         if (op == 0001400) { // BEQ
             if (psw.z) {
                 r[7] = static_cast<uint16_t>(r[7] + static_cast<int16_t>(off) * 2);
             }
+            note_edge(pc_before, r[7]);
             return;
         }
         if (op == 0001000) { // BNE
             if (!psw.z) {
                 r[7] = static_cast<uint16_t>(r[7] + static_cast<int16_t>(off) * 2);
             }
+            note_edge(pc_before, r[7]);
             return;
         }
     }
@@ -939,13 +2440,23 @@ void CPU::step() {
 }
 
 void CPU::run(uint64_t max_steps) {
-    for (uint64_t i = 0; i < max_steps && !halted; ++i) {
-        if (!breakpoints.empty() && breakpoints.find(r[7]) != breakpoints.end()) {
+    struct FlushOnExit {
+        OutputChannel& out;
+        ~FlushOnExit() { out.flush(); }
+    } flush_on_exit{console_out};
+
+    watch_hit = false;
+    blocked = false;
+    for (uint64_t i = 0; i < max_steps && !halted && !blocked; ++i) {
+        if (breakpoint_at(r[7])) {
             break_hit = true;
             break_addr = r[7];
-            return;
+            break;
         }
         step();
+        if (watch_hit) {
+            break;
+        }
     }
 }
 
@@ -1,13 +1,21 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <functional>
-#include <fstream>
 #include <memory>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
+#include <sys/uio.h>
+
+#include "async_io.h"
+#include "console.h"
+#include "memory.h"
+#include "predicate.h"
+
 namespace pdp11 {
 
 struct Flags {
@@ -15,6 +23,7 @@ struct Flags {
     bool z = false;
     bool v = false;
     bool c = false;
+    uint8_t priority = 0; // PSW bits 7-5; interrupts at or below are held off
 };
 
 struct CPU {
@@ -25,10 +34,67 @@ struct CPU {
     bool halted = false;
     uint8_t mem_bank = 0; // 0-3
 
-    std::vector<uint8_t> mem;
-    std::function<int()> in_char;
-    std::function<void(uint8_t)> out_char;
-    std::vector<std::unique_ptr<std::fstream>> files;
+    // With yield_on_block set, an input TRAP (2, 5, 9, 10, 21) that finds no
+    // input yet is undone: the PC is left on the TRAP, blocked is set and
+    // run() returns. Running again retries the TRAP. blocked_fd is the
+    // descriptor to wait on, or -1 when the source has none.
+    bool yield_on_block = false;
+    bool blocked = false;
+    int blocked_fd = -1;
+
+    PhysicalMemory mem;        // banks may be host file mappings (TRAP 35)
+    InputChannel console_in;   // defaults to blocking reads of stdin
+    OutputChannel console_out; // flushed by run(), HALT and before input
+
+    // Host file opened by TRAP 20. The position is tracked here and passed to
+    // pread/pwrite rather than kept in the descriptor.
+    struct FileHandle {
+        int fd = -1;
+        uint64_t offset = 0;
+        bool append = false;
+        bool seekable = true; // false for pipes/terminals: plain read/write
+
+        FileHandle() = default;
+        explicit FileHandle(int f) : fd(f) {}
+        FileHandle(FileHandle&& other) noexcept;
+        FileHandle& operator=(FileHandle&& other) noexcept;
+        FileHandle(const FileHandle&) = delete;
+        FileHandle& operator=(const FileHandle&) = delete;
+        ~FileHandle();
+
+        bool is_open() const { return fd >= 0; }
+        bool close();
+        long read_at(uint8_t* data, size_t len);        // -1 on error
+        long write_at(const uint8_t* data, size_t len); // -1 on error
+        // Scatter/gather forms; iov is consumed as data moves.
+        long readv_at(iovec* iov, int count);
+        long writev_at(iovec* iov, int count);
+        bool seek(int64_t off, int whence);             // 0=beg,1=cur,2=end
+    };
+    std::vector<FileHandle> files;
+
+    // DL11 console and KW11-L line clock. Off unless enable_devices() is
+    // called; then their registers (and the PSW at 177776) occupy the top of
+    // the 16-bit data address space. RBUF reads clear DONE from the const
+    // accessors, hence mutable.
+    static constexpr uint16_t kIoPageStart = 0177540;
+    static constexpr uint64_t kDevicePollInterval = 1024; // instructions
+    struct Devices {
+        bool enabled = false;
+        uint32_t clock_hz = 60; // 0 = no clock
+        bool rx_done = false;
+        bool rx_taken = false;  // RBUF read; consume the byte before next step
+        bool rx_ie = false;
+        bool tx_ie = false;
+        bool clock_ie = false;
+        bool clock_monitor = false;
+        bool rx_irq = false;
+        bool tx_irq = false;
+        bool clock_irq = false;
+        bool waiting = false; // in WAIT until an interrupt is taken
+        uint64_t next_poll = 0;
+    };
+    mutable Devices devices;
 
     struct MemWatch {
         bool enabled = false;
@@ -41,13 +107,143 @@ struct CPU {
     bool break_hit = false;
     uint16_t break_addr = 0;
 
+    // Conditional breakpoints stop when the PC matches, the condition holds
+    // and the hit count has passed ignore_count.
+    struct Breakpoint {
+        uint16_t addr = 0;
+        Predicate cond;
+        uint64_t ignore_count = 0;
+        uint64_t hits = 0;
+    };
+
+    // Watchpoints stop after an instruction reads or writes a physical byte
+    // in [start, end] and the condition holds.
+    struct Watchpoint {
+        uint32_t start = 0;
+        uint32_t end = 0;
+        bool on_read = false;
+        bool on_write = true;
+        Predicate cond;
+        uint64_t ignore_count = 0;
+        mutable uint64_t hits = 0;
+    };
+
+    static constexpr uint32_t kWatchPageShift = 8;
+    std::vector<Breakpoint> cond_breaks;
+    std::vector<Watchpoint> watchpoints;
+    mutable bool watch_hit = false;
+    mutable uint32_t watch_addr = 0; // physical
+    mutable bool watch_write = false;
+
+    // One bit per bank-0 word, set when an instruction starting there executes.
+    // Empty unless enable_coverage() was called.
+    static constexpr size_t kCoverageWords = 65536 / 2 / 64;
+    std::vector<uint64_t> coverage;
+
+    // Hit counts for control-flow edges (branches both ways, jumps, calls and
+    // returns), indexed by a hash of the source and target PCs. Owned by the
+    // caller; null disables.
+    static constexpr size_t kEdgeMapSize = 65536;
+    uint8_t* edge_map = nullptr;
+
+    // Non-deterministic inputs (console input blocks, file TRAP results). Recorded
+    // while mode is Record and consumed instead of the host while Replay.
+    // Replay falls back to Record once the log is exhausted.
+    struct EventLog {
+        enum class Mode {
+            Off,
+            Record,
+            Replay
+        };
+        Mode mode = Mode::Off;
+        std::vector<int32_t> values;
+        std::vector<uint8_t> bytes;
+        size_t value_pos = 0;
+        size_t byte_pos = 0;
+        bool quiet = false; // suppress console output while re-executing
+    } events;
+
+    struct Checkpoint {
+        uint64_t icount = 0;
+        uint16_t r[8]{};
+        Flags psw{};
+        bool halted = false;
+        uint8_t mem_bank = 0;
+        std::vector<uint8_t> mem; // file-backed banks are restored by remapping, not from here
+        std::shared_ptr<const PhysicalMemory::FileMapping> mappings[kMemSize / PhysicalMemory::kBankSize];
+        size_t value_pos = 0;
+        size_t byte_pos = 0;
+        std::string input_pending; // console bytes buffered but not consumed
+        Devices devices;
+    };
+
+    uint64_t icount = 0;              // instructions executed
+    uint64_t checkpoint_interval = 0; // 0 disables periodic checkpoints
+    // At most this many are kept (each holds all of memory). When full,
+    // every other one after the first is dropped, so older history thins
+    // out while the first and the most recent stay available.
+    static constexpr size_t kMaxCheckpoints = 64;
+    std::vector<Checkpoint> checkpoints;
+
     CPU();
 
     void reset();
+    // Drops outstanding asynchronous requests (TRAPs 30-32) undelivered,
+    // after the one in progress finishes, and restarts request ids at 1.
+    void cancel_async();
     void load_words(uint16_t address, const std::vector<uint16_t>& words);
     void run(uint64_t max_steps = 1000000);
     void step();
 
+    // Native handlers for TRAP vectors the simulator does not define. The
+    // handler runs in place of the TRAP instruction with the PC already past
+    // it. An empty handler removes the registration; built-in vectors throw.
+    using TrapHandler = std::function<void(CPU&)>;
+    void register_trap(uint8_t vector, TrapHandler handler);
+    static bool builtin_trap(uint8_t vector);
+
+    void enable_devices(uint32_t clock_hz = 60);
+    uint16_t psw_word() const;
+    void set_psw_word(uint16_t value);
+
+    void enable_coverage();
+    bool covered(uint16_t address) const;
+
+    void add_breakpoint(uint16_t address, const std::string& cond = "", uint64_t ignore_count = 0);
+    void add_watchpoint(uint32_t phys_start, uint32_t length, bool on_read, bool on_write,
+                        const std::string& cond = "", uint64_t ignore_count = 0);
+    void clear_breakpoint(uint16_t address);
+    void clear_watchpoint(uint32_t phys_start);
+    // True when run() would stop before executing the instruction at pc.
+    bool breakpoint_at(uint16_t pc);
+
+    Checkpoint save_checkpoint() const;
+    void restore_checkpoint(const Checkpoint& cp);
+
+    // Dirty-page tracking for resetting to one snapshot many times: every
+    // store marks its 256-byte page and restore_dirty() copies back only
+    // marked pages. The marks are relative to the last restore_dirty().
+    static constexpr uint32_t kDirtyPageShift = 8;
+    void track_dirty_pages(bool on);
+    void mark_dirty(uint32_t phys, size_t len) {
+        if (dirty_pages_.empty() || len == 0) {
+            return;
+        }
+        uint32_t last = static_cast<uint32_t>((phys + len - 1) >> kDirtyPageShift);
+        for (uint32_t page = phys >> kDirtyPageShift; page <= last; ++page) {
+            uint32_t pg = page & ((kMemSize >> kDirtyPageShift) - 1);
+            dirty_pages_[pg >> 6] |= uint64_t{1} << (pg & 63);
+        }
+    }
+    // Like restore_checkpoint(), but cp must be the state the marks are
+    // relative to (normally the snapshot taken when tracking started).
+    void restore_dirty(const Checkpoint& cp);
+    // Appends the marked page numbers to pages and clears the marks.
+    void take_dirty_pages(std::vector<uint32_t>& pages);
+    // Re-executes from the nearest earlier checkpoint. Needs a recording.
+    bool rewind_to(uint64_t target_icount);
+    bool step_back();
+
     uint16_t read_word(uint16_t address) const;
     void write_word(uint16_t address, uint16_t value);
     uint16_t read_word_code(uint16_t address) const;
@@ -56,6 +252,148 @@ struct CPU {
     void write_byte(uint16_t address, uint8_t value);
 
 private:
+    std::vector<uint64_t> dirty_pages_;
+    void restore_registers(const Checkpoint& cp);
+    void add_checkpoint();
+    uint8_t restore_mappings(const Checkpoint& cp);
+
+    // Bitmaps consulted before any breakpoint/watchpoint list is searched.
+    std::vector<uint64_t> break_pc_bits_;
+    std::vector<uint64_t> watch_page_bits_;
+
+    void rebuild_debug_bitmaps();
+    void check_watch(uint32_t phys, int size, bool write) const;
+    // False when byte-level logging or watchpoints need the slow accessors.
+    bool bulk_access_ok() const {
+        return !mem_watch.enabled && !mem_watch.trace_all && watch_page_bits_.empty();
+    }
+    // Stores into a read-only mapped bank are dropped by write_byte().
+    bool bulk_write_ok(uint8_t bank) const { return bulk_access_ok() && !mem.read_only(bank); }
+    void note_edge(uint16_t from, uint16_t to) {
+        if (edge_map) {
+            ++edge_map[static_cast<uint16_t>((from >> 1) ^ to)];
+        }
+    }
+    bool watching(uint32_t phys) const {
+        return !watch_page_bits_.empty() &&
+               ((watch_page_bits_[phys >> (kWatchPageShift + 6)] >> ((phys >> kWatchPageShift) & 63)) & 1);
+    }
+
+    std::chrono::steady_clock::time_point next_tick_{};
+    bool io_read(uint16_t address, uint16_t& value) const;
+    bool io_write(uint16_t address, uint16_t value, bool byte);
+    // Polls the host (or the replay log) for clock ticks and console input;
+    // with block set, first sleeps until either could have happened.
+    void poll_devices(bool block);
+    // Runs before each instruction; true when the step was used up taking an
+    // interrupt or idling in WAIT.
+    bool service_devices();
+    void interrupt(uint16_t vector);
+    // False when no enabled source could ever end a WAIT.
+    bool wake_possible() const;
+
+    bool input_ready();
+    int get_char();
+    void write_block(uint16_t address, const uint8_t* data, size_t len);
+
+    struct Span {
+        uint8_t* data;
+        size_t len;
+    };
+    // Splits [address, address + len) in the current data bank into at most
+    // two host spans, breaking where the 16-bit address wraps.
+    int data_spans(uint16_t address, size_t len, Span out[2]);
+    void put_char(uint8_t ch);
+    void put_string(uint16_t address);
+    bool replay_value(int32_t& value);
+    void record_value(int32_t value);
+    std::string read_path(uint16_t address) const;
+    FileHandle* file_at(uint16_t handle);
+    void file_trap(uint8_t vec);
+    bool replay_file_trap(uint8_t vec);
+    void record_file_trap(uint8_t vec);
+    void read_block(uint16_t address, uint8_t* out, size_t len);
+
+    // TRAP dispatch: built-in handlers by vector, shared by all CPUs, then
+    // any registered native handlers (sized to 256 on first registration).
+    using TrapFn = void (CPU::*)(uint8_t vec);
+    using TrapTable = std::array<TrapFn, 256>;
+    static const TrapTable& trap_table();
+    void yielding_trap(TrapFn fn, uint8_t vec);
+    void block_on(int fd);
+    std::vector<TrapHandler> native_traps_;
+    void trap_putc(uint8_t vec);
+    void trap_getc(uint8_t vec);
+    void trap_puts(uint8_t vec);
+    void trap_print_signed(uint8_t vec);
+    void trap_read_line(uint8_t vec);
+    void trap_print_hex(uint8_t vec);
+    void trap_print_unsigned(uint8_t vec);
+    void trap_println(uint8_t vec);
+    void trap_read_signed(uint8_t vec);
+    void trap_read_hex(uint8_t vec);
+    void trap_set_bank(uint8_t vec);
+    void trap_file(uint8_t vec);
+
+    // One (bank, address, length) entry of a TRAP 33/34 descriptor table.
+    struct IoSegment {
+        uint8_t bank;
+        uint16_t addr;
+        uint16_t len;
+    };
+    static constexpr uint16_t kMaxIoSegments = 256;
+    std::vector<IoSegment> io_segments(uint16_t table, uint16_t count);
+    void scatter(const std::vector<IoSegment>& segs, const uint8_t* data, size_t len);
+    void gather(const std::vector<IoSegment>& segs, uint8_t* out, size_t len);
+
+    // Asynchronous file TRAPs 30-32. The worker starts on first submit.
+    // Status words 0xFFFE (error) and 0xFFFF (pending) are never counts.
+    static constexpr uint16_t kAsyncMaxLength = 0xFFFD;
+    std::unique_ptr<AsyncIO> aio_;
+    uint16_t aio_next_id_ = 1;
+    void async_trap(uint8_t vec);
+    void async_submit();
+    void async_complete(const AsyncIO::Request& req);
+    void map_trap(uint8_t vec);
+
+    // Byte access by physical address, for TRAPs whose ranges may cross banks.
+    // Goes through read_byte/write_byte so watchpoints and tracing still apply.
+    uint8_t load_phys(uint32_t phys);
+    void store_phys(uint32_t phys, uint8_t value);
+    // True when [phys, phys + len) can be touched directly in mem.
+    bool bulk_phys_ok(uint32_t phys, size_t len, bool write) const;
+    void mem_trap(uint8_t vec);
+    // Length of the NUL-terminated string at address in the current bank,
+    // wrapping at 64K; 0x10000 when the bank holds no terminator.
+    size_t guest_strlen(uint16_t address);
+    void string_trap(uint8_t vec);
+
+    // A word at an even address is one memory access (see PhysicalMemory);
+    // at an odd one it is two bytes, wrapping at the top of memory.
+    uint16_t word_at(uint32_t p) const {
+        if ((p & 1) == 0) {
+            return mem.load_word(p);
+        }
+        return static_cast<uint16_t>(mem[p] | (mem[(p + 1) & (kMemSize - 1)] << 8));
+    }
+    // Bytes landing in a read-only bank are dropped; an odd word at the top
+    // of a bank puts its high byte in the next one.
+    void set_word_at(uint32_t p, uint16_t value) {
+        if ((p & 1) == 0) {
+            if (!mem.read_only(p >> 16)) {
+                mem.store_word(p, value);
+            }
+            return;
+        }
+        uint32_t q = (p + 1) & (kMemSize - 1);
+        if (!mem.read_only(p >> 16)) {
+            mem[p] = static_cast<uint8_t>(value & 0xFF);
+        }
+        if (!mem.read_only(q >> 16)) {
+            mem[q] = static_cast<uint8_t>((value >> 8) & 0xFF);
+        }
+    }
+
     uint16_t fetch_word();
     void set_nz(uint16_t value);
     void set_nz_byte(uint8_t value);
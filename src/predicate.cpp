@@ -0,0 +1,324 @@
+#include "predicate.h"
+
+#include "pdp11.h"
+
+#include <cctype>
+#include <stdexcept>
+
+namespace pdp11 {
+
+class PredicateParser {
+public:
+    explicit PredicateParser(const std::string& text) : text_(text) {}
+
+    Predicate parse() {
+        Predicate p;
+        p.text_ = text_;
+        skip_ws();
+        if (pos_ == text_.size()) {
+            return p;
+        }
+        parse_or(p);
+        skip_ws();
+        if (pos_ != text_.size()) {
+            fail("unexpected input");
+        }
+        if (max_depth_ > Predicate::kMaxDepth) {
+            fail("expression too deep");
+        }
+        return p;
+    }
+
+private:
+    using Op = Predicate::Op;
+
+    const std::string& text_;
+    size_t pos_ = 0;
+    int depth_ = 0;
+    int max_depth_ = 0;
+
+    [[noreturn]] void fail(const std::string& what) {
+        throw std::runtime_error("Bad condition '" + text_ + "': " + what);
+    }
+
+    void skip_ws() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+    }
+
+    bool accept(const char* tok) {
+        skip_ws();
+        size_t n = std::char_traits<char>::length(tok);
+        if (text_.compare(pos_, n, tok) == 0) {
+            pos_ += n;
+            return true;
+        }
+        return false;
+    }
+
+    void emit(Predicate& p, Op op, int32_t arg = 0) {
+        p.code_.push_back({op, arg});
+        switch (op) {
+            case Op::Const:
+            case Op::Reg:
+            case Op::Flag:
+                ++depth_;
+                break;
+            case Op::LoadWord:
+            case Op::LoadByte:
+            case Op::Not:
+            case Op::Neg:
+            case Op::Inv:
+                break;
+            default:
+                --depth_; // binary ops, incl. banked loads (bank, addr)
+                break;
+        }
+        if (depth_ > max_depth_) {
+            max_depth_ = depth_;
+        }
+    }
+
+    void parse_or(Predicate& p) {
+        parse_and(p);
+        while (accept("||")) {
+            parse_and(p);
+            emit(p, Op::LogOr);
+        }
+    }
+
+    void parse_and(Predicate& p) {
+        parse_cmp(p);
+        while (accept("&&")) {
+            parse_cmp(p);
+            emit(p, Op::LogAnd);
+        }
+    }
+
+    void parse_cmp(Predicate& p) {
+        parse_sum(p);
+        static const struct {
+            const char* tok;
+            Op op;
+        } ops[] = {{"==", Op::Eq}, {"!=", Op::Ne}, {"<=", Op::Le},
+                   {">=", Op::Ge}, {"<", Op::Lt},  {">", Op::Gt}};
+        for (const auto& o : ops) {
+            if (accept(o.tok)) {
+                parse_sum(p);
+                emit(p, o.op);
+                return;
+            }
+        }
+    }
+
+    void parse_sum(Predicate& p) {
+        parse_unary(p);
+        while (true) {
+            skip_ws();
+            if (pos_ >= text_.size()) return;
+            char c = text_[pos_];
+            bool doubled = pos_ + 1 < text_.size() && text_[pos_ + 1] == c;
+            Op op;
+            if (c == '+') op = Op::Add;
+            else if (c == '-') op = Op::Sub;
+            else if (c == '^') op = Op::Xor;
+            else if (c == '&' && !doubled) op = Op::And;
+            else if (c == '|' && !doubled) op = Op::Or;
+            else return;
+            ++pos_;
+            parse_unary(p);
+            emit(p, op);
+        }
+    }
+
+    void parse_unary(Predicate& p) {
+        skip_ws();
+        if (pos_ < text_.size() && text_[pos_] == '!' &&
+            !(pos_ + 1 < text_.size() && text_[pos_ + 1] == '=')) {
+            ++pos_;
+            parse_unary(p);
+            emit(p, Op::Not);
+            return;
+        }
+        if (accept("-")) {
+            parse_unary(p);
+            emit(p, Op::Neg);
+            return;
+        }
+        if (accept("~")) {
+            parse_unary(p);
+            emit(p, Op::Inv);
+            return;
+        }
+        parse_primary(p);
+    }
+
+    void parse_load(Predicate& p, bool byte) {
+        // '[' already consumed
+        size_t save = pos_;
+        skip_ws();
+        size_t start = pos_;
+        while (pos_ < text_.size() && std::isdigit(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+        bool banked = false;
+        if (pos_ > start) {
+            skip_ws();
+            if (pos_ < text_.size() && text_[pos_] == ':') {
+                int bank = std::stoi(text_.substr(start, pos_ - start));
+                if (bank < 0 || bank > 3) {
+                    fail("bank out of range");
+                }
+                ++pos_;
+                emit(p, Op::Const, bank);
+                banked = true;
+            }
+        }
+        if (!banked) {
+            pos_ = save;
+        }
+        parse_or(p);
+        if (!accept("]")) {
+            fail("expected ']'");
+        }
+        if (banked) {
+            emit(p, byte ? Op::LoadByteBank : Op::LoadWordBank);
+        } else {
+            emit(p, byte ? Op::LoadByte : Op::LoadWord);
+        }
+    }
+
+    void parse_primary(Predicate& p) {
+        skip_ws();
+        if (pos_ >= text_.size()) {
+            fail("unexpected end");
+        }
+        if (accept("(")) {
+            parse_or(p);
+            if (!accept(")")) {
+                fail("expected ')'");
+            }
+            return;
+        }
+        if (accept("[")) {
+            parse_load(p, false);
+            return;
+        }
+        if (accept("B[") || accept("b[")) {
+            parse_load(p, true);
+            return;
+        }
+        size_t start = pos_;
+        while (pos_ < text_.size() && std::isalnum(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+        std::string tok = text_.substr(start, pos_ - start);
+        if (tok.empty()) {
+            fail("expected operand");
+        }
+        std::string up = tok;
+        for (char& c : up) {
+            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        }
+        if (up.size() == 2 && up[0] == 'R' && up[1] >= '0' && up[1] <= '7') {
+            emit(p, Op::Reg, up[1] - '0');
+            return;
+        }
+        if (up == "SP") { emit(p, Op::Reg, 6); return; }
+        if (up == "PC") { emit(p, Op::Reg, 7); return; }
+        if (up == "N") { emit(p, Op::Flag, 0); return; }
+        if (up == "Z") { emit(p, Op::Flag, 1); return; }
+        if (up == "V") { emit(p, Op::Flag, 2); return; }
+        if (up == "C") { emit(p, Op::Flag, 3); return; }
+
+        int base = 10;
+        std::string digits = tok;
+        if (up.rfind("0X", 0) == 0) {
+            base = 16;
+            digits = tok.substr(2);
+        } else if (up.rfind("0O", 0) == 0) {
+            base = 8;
+            digits = tok.substr(2);
+        }
+        size_t used = 0;
+        long value = 0;
+        try {
+            value = std::stol(digits, &used, base);
+        } catch (...) {
+            used = 0;
+        }
+        if (digits.empty() || used != digits.size()) {
+            fail("unknown operand " + tok);
+        }
+        emit(p, Op::Const, static_cast<int32_t>(value));
+    }
+};
+
+Predicate Predicate::compile(const std::string& text) {
+    return PredicateParser(text).parse();
+}
+
+bool Predicate::eval(const CPU& cpu) const {
+    if (code_.empty()) {
+        return true;
+    }
+    int32_t stack[kMaxDepth];
+    int sp = 0;
+    for (const auto& in : code_) {
+        switch (in.op) {
+            case Op::Const: stack[sp++] = in.arg; break;
+            case Op::Reg: stack[sp++] = cpu.r[in.arg]; break;
+            case Op::Flag: {
+                bool f = in.arg == 0 ? cpu.psw.n : in.arg == 1 ? cpu.psw.z
+                       : in.arg == 2 ? cpu.psw.v : cpu.psw.c;
+                stack[sp++] = f ? 1 : 0;
+                break;
+            }
+            case Op::LoadWord:
+            case Op::LoadByte:
+            case Op::LoadWordBank:
+            case Op::LoadByteBank: {
+                bool banked = in.op == Op::LoadWordBank || in.op == Op::LoadByteBank;
+                uint16_t addr = static_cast<uint16_t>(stack[--sp]);
+                uint32_t bank = banked ? static_cast<uint32_t>(stack[--sp]) & 0x3 : cpu.mem_bank;
+                uint32_t p = (bank << 16) | addr;
+                int32_t v = cpu.mem[p];
+                if (in.op == Op::LoadWord || in.op == Op::LoadWordBank) {
+                    v |= cpu.mem[(p + 1) & (CPU::kMemSize - 1)] << 8;
+                }
+                stack[sp++] = v;
+                break;
+            }
+            case Op::Not: stack[sp - 1] = !stack[sp - 1]; break;
+            case Op::Neg: stack[sp - 1] = -stack[sp - 1]; break;
+            case Op::Inv: stack[sp - 1] = ~stack[sp - 1]; break;
+            default: {
+                int32_t b = stack[--sp];
+                int32_t a = stack[sp - 1];
+                int32_t v = 0;
+                switch (in.op) {
+                    case Op::Add: v = a + b; break;
+                    case Op::Sub: v = a - b; break;
+                    case Op::And: v = a & b; break;
+                    case Op::Or: v = a | b; break;
+                    case Op::Xor: v = a ^ b; break;
+                    case Op::Eq: v = a == b; break;
+                    case Op::Ne: v = a != b; break;
+                    case Op::Lt: v = a < b; break;
+                    case Op::Le: v = a <= b; break;
+                    case Op::Gt: v = a > b; break;
+                    case Op::Ge: v = a >= b; break;
+                    case Op::LogAnd: v = a && b; break;
+                    case Op::LogOr: v = a || b; break;
+                    default: break;
+                }
+                stack[sp - 1] = v;
+                break;
+            }
+        }
+    }
+    return sp > 0 && stack[sp - 1] != 0;
+}
+
+} // namespace pdp11
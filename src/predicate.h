@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pdp11 {
+
+struct CPU;
+
+// A breakpoint/watchpoint condition compiled to a small stack program.
+//
+// Grammar (C-like precedence, values are 32-bit signed):
+//   expr    := and ('||' and)*
+//   and     := cmp ('&&' cmp)*
+//   cmp     := sum (('=='|'!='|'<'|'<='|'>'|'>=') sum)?
+//   sum     := unary (('+'|'-'|'&'|'|'|'^') unary)*
+//   unary   := ('!'|'-'|'~') unary | primary
+//   primary := number | R0..R7 | SP | PC | N | Z | V | C | '(' expr ')'
+//            | '[' [bank ':'] expr ']'     word in current or given bank
+//            | 'B[' [bank ':'] expr ']'    byte in current or given bank
+class Predicate {
+public:
+    static Predicate compile(const std::string& text);
+
+    bool empty() const { return code_.empty(); }
+    bool eval(const CPU& cpu) const;
+    const std::string& text() const { return text_; }
+
+private:
+    enum class Op : uint8_t {
+        Const,
+        Reg,
+        Flag,
+        LoadWord,
+        LoadByte,
+        LoadWordBank,
+        LoadByteBank,
+        Add,
+        Sub,
+        And,
+        Or,
+        Xor,
+        Eq,
+        Ne,
+        Lt,
+        Le,
+        Gt,
+        Ge,
+        LogAnd,
+        LogOr,
+        Not,
+        Neg,
+        Inv
+    };
+
+    struct Insn {
+        Op op;
+        int32_t arg;
+    };
+
+    static constexpr int kMaxDepth = 32;
+
+    std::vector<Insn> code_;
+    std::string text_;
+
+    friend class PredicateParser;
+};
+
+} // namespace pdp11
@@ -0,0 +1,85 @@
+#include "replay.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace pdp11 {
+
+static const char kMagic[8] = {'P', 'D', 'P', '1', '1', 'L', 'O', 'G'};
+
+static void write_u64(std::ostream& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        out.put(static_cast<char>((v >> (i * 8)) & 0xFF));
+    }
+}
+
+static uint64_t read_u64(std::istream& in) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        int ch = in.get();
+        if (ch == EOF) {
+            throw std::runtime_error("Truncated event log");
+        }
+        v |= static_cast<uint64_t>(ch & 0xFF) << (i * 8);
+    }
+    return v;
+}
+
+void save_event_log(const CPU::EventLog& log, const std::string& path) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Failed to open event log: " + path);
+    }
+    out.write(kMagic, sizeof(kMagic));
+    write_u64(out, log.values.size());
+    for (int32_t v : log.values) {
+        write_u64(out, static_cast<uint64_t>(static_cast<int64_t>(v)));
+    }
+    write_u64(out, log.bytes.size());
+    out.write(reinterpret_cast<const char*>(log.bytes.data()),
+              static_cast<std::streamsize>(log.bytes.size()));
+    if (!out) {
+        throw std::runtime_error("Failed to write event log: " + path);
+    }
+}
+
+CPU::EventLog load_event_log(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Failed to open event log: " + path);
+    }
+    char magic[sizeof(kMagic)] = {};
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("Not an event log: " + path);
+    }
+    // Counts are checked against what is left of the file before anything
+    // is allocated, so a corrupt header cannot ask for gigabytes.
+    in.seekg(0, std::ios::end);
+    uint64_t file_size = static_cast<uint64_t>(in.tellg());
+    in.seekg(sizeof(kMagic));
+    auto remaining = [&]() { return file_size - static_cast<uint64_t>(in.tellg()); };
+    CPU::EventLog log;
+    uint64_t count = read_u64(in);
+    if (count > remaining() / 8) {
+        throw std::runtime_error("Truncated event log");
+    }
+    log.values.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        log.values.push_back(static_cast<int32_t>(static_cast<int64_t>(read_u64(in))));
+    }
+    count = read_u64(in);
+    if (count > remaining()) {
+        throw std::runtime_error("Truncated event log");
+    }
+    log.bytes.resize(count);
+    in.read(reinterpret_cast<char*>(log.bytes.data()), static_cast<std::streamsize>(count));
+    if (static_cast<uint64_t>(in.gcount()) != count) {
+        throw std::runtime_error("Truncated event log");
+    }
+    log.mode = CPU::EventLog::Mode::Replay;
+    return log;
+}
+
+} // namespace pdp11
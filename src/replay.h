@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// Event logs are stored as a small binary file so a recorded run can be
+// replayed deterministically by a later process.
+void save_event_log(const CPU::EventLog& log, const std::string& path);
+CPU::EventLog load_event_log(const std::string& path);
+
+} // namespace pdp11
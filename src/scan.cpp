@@ -0,0 +1,97 @@
+#include "scan.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace pdp11 {
+namespace scan {
+
+namespace {
+
+#if defined(__AVX2__)
+constexpr size_t kStep = 32;
+using Vec = __m256i;
+inline Vec load(const uint8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+inline Vec splat(uint8_t v) { return _mm256_set1_epi8(static_cast<char>(v)); }
+inline Vec eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+inline Vec either(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+inline uint32_t mask(Vec v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+inline uint32_t not_mask(Vec v) { return ~mask(v); }
+#elif defined(__SSE2__)
+constexpr size_t kStep = 16;
+using Vec = __m128i;
+inline Vec load(const uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline Vec splat(uint8_t v) { return _mm_set1_epi8(static_cast<char>(v)); }
+inline Vec eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+inline Vec either(Vec a, Vec b) { return _mm_or_si128(a, b); }
+inline uint32_t mask(Vec v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+inline uint32_t not_mask(Vec v) { return ~mask(v) & 0xFFFF; }
+#endif
+
+} // namespace
+
+size_t find_byte(const uint8_t* data, size_t len, uint8_t value) {
+    size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+    Vec needle = splat(value);
+    for (; i + kStep <= len; i += kStep) {
+        uint32_t m = mask(eq(load(data + i), needle));
+        if (m != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(m));
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        if (data[i] == value) {
+            return i;
+        }
+    }
+    return len;
+}
+
+size_t find_either(const uint8_t* data, size_t len, uint8_t a, uint8_t b) {
+    size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+    Vec va = splat(a);
+    Vec vb = splat(b);
+    for (; i + kStep <= len; i += kStep) {
+        Vec chunk = load(data + i);
+        uint32_t m = mask(either(eq(chunk, va), eq(chunk, vb)));
+        if (m != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(m));
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        if (data[i] == a || data[i] == b) {
+            return i;
+        }
+    }
+    return len;
+}
+
+size_t find_mismatch_or_nul(const uint8_t* lhs, const uint8_t* rhs, size_t len) {
+    size_t i = 0;
+#if defined(__AVX2__) || defined(__SSE2__)
+    Vec zero = splat(0);
+    for (; i + kStep <= len; i += kStep) {
+        Vec l = load(lhs + i);
+        uint32_t m = not_mask(eq(l, load(rhs + i))) | mask(eq(l, zero));
+        if (m != 0) {
+            return i + static_cast<size_t>(__builtin_ctz(m));
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        if (lhs[i] != rhs[i] || lhs[i] == 0) {
+            return i;
+        }
+    }
+    return len;
+}
+
+} // namespace scan
+} // namespace pdp11
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pdp11 {
+
+// Byte scanners used by the string TRAPs. They look at 32 bytes per step with
+// AVX2, 16 with SSE2, otherwise one, and never read past data + len.
+namespace scan {
+
+// Index of the first `value` in data[0, len), or len.
+size_t find_byte(const uint8_t* data, size_t len, uint8_t value);
+// Index of the first byte equal to `a` or `b`, or len.
+size_t find_either(const uint8_t* data, size_t len, uint8_t a, uint8_t b);
+// Index of the first i where lhs[i] != rhs[i] or lhs[i] == 0, or len.
+size_t find_mismatch_or_nul(const uint8_t* lhs, const uint8_t* rhs, size_t len);
+
+} // namespace scan
+} // namespace pdp11
@@ -0,0 +1,97 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <poll.h>
+
+namespace pdp11 {
+
+size_t GuestScheduler::add(CPU& cpu, uint64_t max_steps) {
+    cpu.yield_on_block = true;
+    Guest g;
+    g.cpu = &cpu;
+    g.limit = cpu.icount + max_steps;
+    if (cpu.halted) {
+        g.state = State::Halted;
+    }
+    guests_.push_back(g);
+    return guests_.size() - 1;
+}
+
+void GuestScheduler::wake(size_t id) {
+    if (guests_[id].state == State::Blocked) {
+        guests_[id].state = State::Runnable;
+    }
+}
+
+void GuestScheduler::run_slice(Guest& g) {
+    CPU& cpu = *g.cpu;
+    if (cpu.icount >= g.limit) {
+        g.state = State::Limit;
+        return;
+    }
+    ++stats_.slices;
+    try {
+        cpu.run(std::min(slice_, g.limit - cpu.icount));
+    } catch (const std::exception& ex) {
+        cpu.console_out.flush();
+        g.state = State::Error;
+        g.error = ex.what();
+        return;
+    }
+    if (cpu.halted) {
+        g.state = State::Halted;
+    } else if (cpu.blocked) {
+        g.state = State::Blocked;
+        ++stats_.blocks;
+    } else if (cpu.icount >= g.limit) {
+        g.state = State::Limit;
+    }
+}
+
+bool GuestScheduler::poll_blocked(int timeout_ms) {
+    std::vector<pollfd> fds;
+    std::vector<size_t> ids;
+    for (size_t i = 0; i < guests_.size(); ++i) {
+        const Guest& g = guests_[i];
+        if (g.state == State::Blocked && g.cpu->blocked_fd >= 0) {
+            fds.push_back({g.cpu->blocked_fd, POLLIN, 0});
+            ids.push_back(i);
+        }
+    }
+    if (fds.empty()) {
+        return false;
+    }
+    ++stats_.polls;
+    int ready = ::poll(fds.data(), fds.size(), timeout_ms);
+    if (ready < 0 && errno != EINTR) {
+        throw std::runtime_error("poll failed while waiting for guest input");
+    }
+    for (size_t k = 0; k < fds.size() && ready > 0; ++k) {
+        if (fds[k].revents != 0) {
+            guests_[ids[k]].state = State::Runnable;
+        }
+    }
+    return true;
+}
+
+void GuestScheduler::run() {
+    while (true) {
+        bool ran = false;
+        for (Guest& g : guests_) {
+            if (g.state == State::Runnable) {
+                run_slice(g);
+                ran = true;
+            }
+        }
+        // Between rounds only check for input; with nothing to run, sleep
+        // in poll() until some guest can continue.
+        if (!poll_blocked(ran ? 0 : -1) && !ran) {
+            return;
+        }
+    }
+}
+
+} // namespace pdp11
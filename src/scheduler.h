@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// Multiplexes many guests on the calling thread. Each runnable guest gets a
+// slice of instructions in turn. A guest whose input TRAP finds no input
+// yields (CPU::yield_on_block) and waits until its descriptor is readable,
+// or until wake() for sources without one. Guests stay owned by the caller.
+class GuestScheduler {
+public:
+    enum class State {
+        Runnable,
+        Blocked,
+        Halted,
+        Limit, // used its max_steps
+        Error
+    };
+    struct Stats {
+        uint64_t slices = 0;
+        uint64_t blocks = 0; // times a guest yielded on input
+        uint64_t polls = 0;
+    };
+
+    explicit GuestScheduler(uint64_t slice = 10000) : slice_(slice) {}
+
+    // Sets cpu.yield_on_block and returns the guest's id.
+    size_t add(CPU& cpu, uint64_t max_steps);
+    // Makes a blocked guest runnable, e.g. after feeding a custom source.
+    void wake(size_t id);
+    // Runs until every guest has finished, or every unfinished guest is
+    // blocked on a source with no descriptor (they resume after wake()).
+    void run();
+
+    State state(size_t id) const { return guests_[id].state; }
+    const std::string& error(size_t id) const { return guests_[id].error; }
+    size_t size() const { return guests_.size(); }
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct Guest {
+        CPU* cpu = nullptr;
+        uint64_t limit = 0; // icount at which it stops
+        State state = State::Runnable;
+        std::string error;
+    };
+    uint64_t slice_;
+    std::vector<Guest> guests_;
+    Stats stats_;
+
+    void run_slice(Guest& g);
+    // Wakes blocked guests whose descriptors are readable. Waits up to
+    // timeout_ms (-1 = until one is). False if no blocked guest has one.
+    bool poll_blocked(int timeout_ms);
+};
+
+} // namespace pdp11
@@ -0,0 +1,130 @@
+#include "smp.h"
+
+#include <stdexcept>
+#include <thread>
+
+namespace pdp11 {
+
+namespace {
+
+// Physical address of a word operand in the core's current data bank.
+uint32_t shared_word(CPU& cpu, uint8_t vec) {
+    uint16_t address = cpu.r[0];
+    if (address & 1) {
+        throw std::runtime_error("TRAP " + std::to_string(vec) + ": odd address");
+    }
+    if (cpu.mem.read_only(cpu.mem_bank)) {
+        throw std::runtime_error("TRAP " + std::to_string(vec) + ": read-only bank");
+    }
+    return (static_cast<uint32_t>(cpu.mem_bank) << 16) | address;
+}
+
+} // namespace
+
+SmpMachine::SmpMachine(size_t cores) : memory_(CPU::kMemSize), errors_(cores), mailboxes_(cores) {
+    if (cores == 0 || cores > kMaxCores) {
+        throw std::runtime_error("SMP core count must be 1-" + std::to_string(kMaxCores));
+    }
+    for (size_t id = 0; id < cores; ++id) {
+        auto cpu = std::make_unique<CPU>();
+        cpu->mem = PhysicalMemory::alias(memory_);
+        if (id != 0) {
+            cpu->console_in.source = [](char*, size_t) -> long { return 0; };
+            cpu->console_in.poll_fd = -1;
+        }
+        cores_.push_back(std::move(cpu));
+        register_traps(id);
+    }
+}
+
+void SmpMachine::register_traps(size_t id) {
+    CPU& cpu = *cores_[id];
+    cpu.register_trap(50, [](CPU& c) {
+        uint32_t p = shared_word(c, 50);
+        uint16_t old = c.mem.fetch_or_word(p, 1);
+        c.mark_dirty(p, 2);
+        c.r[0] = old;
+        c.psw.n = (old & 0x8000) != 0;
+        c.psw.z = old == 0;
+        c.psw.v = false;
+        c.psw.c = (old & 1) != 0;
+    });
+    cpu.register_trap(51, [](CPU& c) {
+        uint32_t p = shared_word(c, 51);
+        uint16_t expected = c.r[1];
+        c.psw.z = c.mem.compare_exchange_word(p, expected, c.r[2]);
+        if (c.psw.z) {
+            c.mark_dirty(p, 2);
+        } else {
+            c.r[1] = expected;
+        }
+    });
+    cpu.register_trap(52, [this, id](CPU& c) {
+        c.r[0] = static_cast<uint16_t>(id);
+        c.r[1] = static_cast<uint16_t>(cores_.size());
+    });
+    cpu.register_trap(53, [this, id](CPU& c) {
+        size_t target = c.r[0];
+        c.psw.c = target >= mailboxes_.size();
+        if (c.psw.c) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mu_);
+        mailboxes_[target].push_back({static_cast<uint16_t>(id), c.r[1]});
+        cv_.notify_all();
+    });
+    cpu.register_trap(54, [this, id](CPU&) { receive(id); });
+}
+
+void SmpMachine::receive(size_t id) {
+    CPU& cpu = *cores_[id];
+    cpu.console_out.flush(); // the wait may be long
+    std::unique_lock<std::mutex> lock(mu_);
+    auto& box = mailboxes_[id];
+    ++waiting_;
+    while (box.empty()) {
+        if (waiting_ == running_) {
+            --waiting_;
+            throw std::runtime_error("TRAP 54: every running core is waiting for a message");
+        }
+        cv_.wait(lock);
+    }
+    --waiting_;
+    cpu.r[0] = box.front().value;
+    cpu.r[1] = box.front().from;
+    box.pop_front();
+}
+
+void SmpMachine::load(uint16_t start, const std::vector<uint16_t>& words) {
+    cores_[0]->load_words(start, words);
+    for (size_t id = 0; id < cores_.size(); ++id) {
+        cores_[id]->r[7] = start;
+        cores_[id]->r[6] = static_cast<uint16_t>(0xFFFE - id * kStackSpacing);
+    }
+}
+
+void SmpMachine::run(uint64_t max_steps) {
+    running_ = cores_.size();
+    waiting_ = 0;
+    std::vector<std::thread> threads;
+    for (size_t id = 0; id < cores_.size(); ++id) {
+        threads.emplace_back([this, id, max_steps]() {
+            CPU& cpu = *cores_[id];
+            try {
+                cpu.run(max_steps);
+            } catch (const std::exception& ex) {
+                cpu.console_out.flush();
+                errors_[id] = ex.what();
+            }
+            // Waiters recheck whether anyone is left to send to them.
+            std::lock_guard<std::mutex> lock(mu_);
+            --running_;
+            cv_.notify_all();
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+} // namespace pdp11
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "memory.h"
+#include "pdp11.h"
+
+namespace pdp11 {
+
+// Several CPUs, each run on its own host thread, sharing one physical
+// memory. Word loads and stores at even addresses are atomic; byte stores,
+// odd-address words and read-modify-write instructions are not, so guests
+// synchronise with these TRAPs, registered on every core:
+//   50  test-and-set: R0 = address. Sets bit 0 of the word atomically; R0 =
+//       old value, N/Z from it, C = its bit 0 (clear: the lock was taken).
+//   51  compare-and-swap: R0 = address, R1 = expected, R2 = new. Z set when
+//       the word held R1 and now holds R2; otherwise R1 = current value.
+//   52  R0 = this core's id, R1 = number of cores.
+//   53  send: R1 to core R0's mailbox. C set if there is no such core.
+//   54  receive: waits for a message; R0 = value, R1 = sender's id.
+// Receiving is an error once every running core is waiting on an empty
+// mailbox. File mapping (TRAP 35) is refused on shared memory.
+class SmpMachine {
+public:
+    static constexpr size_t kMaxCores = 16;
+    static constexpr uint16_t kStackSpacing = 0x1000; // core n starts with SP = 0xFFFE - n * this
+
+    explicit SmpMachine(size_t cores);
+
+    size_t size() const { return cores_.size(); }
+    // Core 0 reads the console from stdin; the others start with no input.
+    CPU& core(size_t id) { return *cores_[id]; }
+
+    // Loads the program once and points every core at start.
+    void load(uint16_t start, const std::vector<uint16_t>& words);
+    // Runs every core for up to max_steps instructions and waits for all.
+    void run(uint64_t max_steps);
+    const std::string& error(size_t id) const { return errors_[id]; }
+
+private:
+    struct Message {
+        uint16_t from;
+        uint16_t value;
+    };
+
+    PhysicalMemory memory_; // declared first: outlives the cores' aliases
+    std::vector<std::unique_ptr<CPU>> cores_;
+    std::vector<std::string> errors_;
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::vector<std::deque<Message>> mailboxes_;
+    size_t running_ = 0;
+    size_t waiting_ = 0; // cores blocked in TRAP 54
+
+    void register_traps(size_t id);
+    void receive(size_t id);
+};
+
+} // namespace pdp11
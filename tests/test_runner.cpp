@@ -1,14 +1,34 @@
 #include "assembler.h"
+#include "batch.h"
+#include "cli.h"
+#include "coverage.h"
+#include "daemon.h"
+#include "fork_server.h"
+#include "fuzz.h"
+#include "lockstep.h"
+#include "multi.h"
+#include "scheduler.h"
+#include "smp.h"
+#include "gdb_stub.h"
 #include "pdp11.h"
+#include "replay.h"
 
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 using namespace pdp11;
 
 struct TestCase {
@@ -61,8 +81,17 @@ static CPU run_with_io(const std::string& asm_source,
     AsmResult res = asmblr.assemble(asm_source);
     CPU cpu;
     cpu.reset();
-    cpu.in_char = in_cb;
-    cpu.out_char = out_cb;
+    cpu.console_in.source = [in_cb](char* data, size_t) -> long {
+        int ch = in_cb();
+        if (ch == EOF) return 0;
+        data[0] = static_cast<char>(ch);
+        return 1;
+    };
+    cpu.console_out.sink = [out_cb](const char* data, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            out_cb(static_cast<uint8_t>(data[i]));
+        }
+    };
     cpu.r[7] = res.start;
     cpu.r[6] = 0xFFFE;
     cpu.load_words(res.start, res.words);
@@ -631,6 +660,1733 @@ TEST(BreakpointsStopRun) {
     REQUIRE(!cpu.halted);
 }
 
+TEST(AssemblerRecordsWordLines) {
+    Assembler asmblr;
+    AsmResult res = asmblr.assemble(R"(.ORIG 0
+MOV #5, R0
+HALT
+data:
+.WORD 7
+)");
+    REQUIRE(res.word_lines.size() == res.words.size());
+    REQUIRE(res.word_lines[0] == 2);
+    REQUIRE(res.word_lines[1] == 2);
+    REQUIRE(res.word_lines[2] == 3);
+    REQUIRE(res.word_lines[3] == 5);
+    REQUIRE(res.instr_starts[0] && !res.instr_starts[1] && res.instr_starts[2] && !res.instr_starts[3]);
+}
+
+TEST(CoverageLcovExport) {
+    Assembler asmblr;
+    AsmResult res = asmblr.assemble(R"(.ORIG 0
+MOV #1, R0
+BNE skip
+INC R0
+skip:
+HALT
+)");
+    CPU cpu;
+    cpu.reset();
+    cpu.r[7] = res.start;
+    cpu.r[6] = 0xFFFE;
+    cpu.load_words(res.start, res.words);
+    cpu.enable_coverage();
+    cpu.run(100);
+    REQUIRE(cpu.covered(0));
+    REQUIRE(!cpu.covered(6));
+
+    std::ostringstream out;
+    write_lcov(out, "prog.asm", res, cpu);
+    std::string info = out.str();
+    REQUIRE(info.find("SF:prog.asm\n") != std::string::npos);
+    REQUIRE(info.find("DA:2,1\n") != std::string::npos);
+    REQUIRE(info.find("DA:3,1\n") != std::string::npos);
+    REQUIRE(info.find("DA:4,0\n") != std::string::npos);
+    REQUIRE(info.find("DA:6,1\n") != std::string::npos);
+    REQUIRE(info.find("LF:4\nLH:3\n") != std::string::npos);
+}
+
+static const char* kSumInput = R"(
+    .ORIG 0
+    MOV #0, R1
+loop:
+    TRAP #2
+    BEQ done
+    ADD R0, R1
+    BR loop
+done:
+    HALT
+)";
+
+TEST(RecordReplayStepBack) {
+    Assembler asmblr;
+    AsmResult res = asmblr.assemble(kSumInput);
+    std::string input = "abc";
+    size_t idx = 0;
+    CPU cpu;
+    cpu.reset();
+    cpu.console_in.source = [&](char* data, size_t) -> long {
+        if (idx >= input.size()) return 0;
+        data[0] = input[idx++];
+        return 1;
+    };
+    cpu.r[7] = res.start;
+    cpu.r[6] = 0xFFFE;
+    cpu.load_words(res.start, res.words);
+    cpu.events.mode = CPU::EventLog::Mode::Record;
+    cpu.checkpoint_interval = 4;
+
+    std::vector<uint16_t> r1_trace{cpu.r[1]};
+    while (!cpu.halted) {
+        cpu.step();
+        r1_trace.push_back(cpu.r[1]);
+    }
+    REQUIRE(cpu.r[1] == 'a' + 'b' + 'c');
+    uint64_t end = cpu.icount;
+
+    REQUIRE(cpu.step_back());
+    REQUIRE(cpu.icount == end - 1);
+    REQUIRE(!cpu.halted);
+    REQUIRE(cpu.rewind_to(5));
+    REQUIRE(cpu.r[1] == r1_trace[5]);
+    REQUIRE(cpu.rewind_to(2));
+    REQUIRE(cpu.r[1] == r1_trace[2]);
+
+    // Running forward again consumes the log, not the (exhausted) host input.
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[1] == 'a' + 'b' + 'c');
+    REQUIRE(cpu.icount == end);
+}
+
+TEST(ReplayLogInFreshCPU) {
+    std::string input = "xy";
+    size_t idx = 0;
+    Assembler asmblr;
+    AsmResult res = asmblr.assemble(kSumInput);
+    CPU rec;
+    rec.reset();
+    rec.console_in.source = [&](char* data, size_t) -> long {
+        if (idx >= input.size()) return 0;
+        data[0] = input[idx++];
+        return 1;
+    };
+    rec.r[7] = res.start;
+    rec.r[6] = 0xFFFE;
+    rec.load_words(res.start, res.words);
+    rec.events.mode = CPU::EventLog::Mode::Record;
+    rec.run(1000);
+
+    CPU play;
+    play.reset();
+    play.console_in.source = [](char* data, size_t) -> long {
+        data[0] = 'z';
+        return 1;
+    };
+    play.r[7] = res.start;
+    play.r[6] = 0xFFFE;
+    play.load_words(res.start, res.words);
+    play.events = rec.events;
+    play.events.mode = CPU::EventLog::Mode::Replay;
+    play.run(1000);
+    REQUIRE(play.halted);
+    REQUIRE(play.r[1] == rec.r[1]);
+}
+
+static CPU load(const std::string& asm_source, AsmResult* out = nullptr) {
+    Assembler asmblr;
+    AsmResult res = asmblr.assemble(asm_source);
+    CPU cpu;
+    cpu.reset();
+    cpu.r[7] = res.start;
+    cpu.r[6] = 0xFFFE;
+    cpu.load_words(res.start, res.words);
+    if (out) {
+        *out = res;
+    }
+    return cpu;
+}
+
+TEST(PredicateEval) {
+    CPU cpu;
+    cpu.reset();
+    cpu.r[0] = 5;
+    cpu.r[1] = 0x100;
+    cpu.psw.z = true;
+    cpu.mem[0x100] = 0x34;
+    cpu.mem[0x101] = 0x12;
+    cpu.mem[0x20100] = 7;
+    REQUIRE(Predicate::compile("").eval(cpu));
+    REQUIRE(Predicate::compile("R0 == 5 && Z").eval(cpu));
+    REQUIRE(!Predicate::compile("R0 != 5 || N").eval(cpu));
+    REQUIRE(Predicate::compile("[R1] == 0x1234").eval(cpu));
+    REQUIRE(Predicate::compile("B[R1+1] == 0x12").eval(cpu));
+    REQUIRE(Predicate::compile("[2:0x100] == 7").eval(cpu));
+    REQUIRE(Predicate::compile("(R0 & 4) != 0 && !C").eval(cpu));
+    REQUIRE(Predicate::compile("-R0 < 0").eval(cpu));
+    bool threw = false;
+    try {
+        Predicate::compile("R0 ==");
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    REQUIRE(threw);
+}
+
+TEST(ConditionalBreakpointWithIgnoreCount) {
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #10, R0
+    loop:
+        DEC R0
+        BNE loop
+        HALT
+    )", &res);
+    uint16_t loop = res.symbols.at("LOOP");
+    cpu.add_breakpoint(loop, "R0 < 8", 1);
+    cpu.run(1000);
+    REQUIRE(cpu.break_hit);
+    REQUIRE(cpu.break_addr == loop);
+    REQUIRE(cpu.r[0] == 6);
+}
+
+TEST(WatchpointStopsOnWriteInOtherBank) {
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x0200, R1
+        MOV #1, (R1)
+        MOV #2, R0
+        TRAP #26
+        MOV (R1), R2
+        MOV #3, (R1)
+        MOV #4, R3
+        HALT
+    )");
+    cpu.add_watchpoint(0x20200, 2, false, true);
+    cpu.run(1000);
+    REQUIRE(cpu.watch_hit);
+    REQUIRE(cpu.watch_write);
+    REQUIRE(cpu.watch_addr == 0x20200);
+    REQUIRE(cpu.r[3] == 0);
+    REQUIRE(!cpu.halted);
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[3] == 4);
+}
+
+TEST(WatchpointOnReadWithCondition) {
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x0300, R1
+        MOV #0, R4
+    loop:
+        MOV (R1), R2
+        INC R4
+        CMP #5, R4
+        BNE loop
+        HALT
+    )");
+    cpu.add_watchpoint(0x0300, 1, true, false, "R4 == 3");
+    cpu.run(1000);
+    REQUIRE(cpu.watch_hit);
+    REQUIRE(!cpu.watch_write);
+    REQUIRE(cpu.r[4] == 3);
+}
+
+static std::string gdb_frame(const std::string& payload) {
+    uint8_t sum = 0;
+    for (char c : payload) sum = static_cast<uint8_t>(sum + static_cast<uint8_t>(c));
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "#%02x", sum);
+    return "$" + payload + buf;
+}
+
+static std::string gdb_read_reply(int fd) {
+    std::string reply;
+    char c = 0;
+    bool in_packet = false;
+    while (::read(fd, &c, 1) == 1) {
+        if (!in_packet) {
+            if (c == '$') in_packet = true;
+            continue;
+        }
+        if (c == '#') {
+            char sum[2];
+            REQUIRE(::read(fd, sum, 2) == 2);
+            return reply;
+        }
+        reply.push_back(c);
+    }
+    throw std::runtime_error("gdb stub closed connection");
+}
+
+static std::string gdb_exchange(int fd, const std::string& payload) {
+    std::string frame = gdb_frame(payload);
+    REQUIRE(::write(fd, frame.data(), frame.size()) == static_cast<ssize_t>(frame.size()));
+    return gdb_read_reply(fd);
+}
+
+TEST(GdbStubSession) {
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #7, R0
+    mark:
+        MOV #0x0100, R1
+        MOV #0xBEEF, (R1)
+        HALT
+    )", &res);
+    int fds[2];
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    GdbStub::Outcome outcome = GdbStub::Outcome::Disconnected;
+    std::thread server([&]() {
+        GdbStub stub(cpu, fds[1]);
+        outcome = stub.serve();
+    });
+
+    REQUIRE(gdb_exchange(fds[0], "QStartNoAckMode") == "OK");
+    REQUIRE(gdb_exchange(fds[0], "qSupported:swbreak+").find("PacketSize") != std::string::npos);
+    REQUIRE(gdb_exchange(fds[0], "?") == "S05");
+    char z0[32];
+    std::snprintf(z0, sizeof(z0), "Z0,%x,2", res.symbols.at("MARK"));
+    REQUIRE(gdb_exchange(fds[0], z0) == "OK");
+    REQUIRE(gdb_exchange(fds[0], "c") == "T05swbreak:;");
+    std::string regs = gdb_exchange(fds[0], "g");
+    REQUIRE(regs.substr(0, 4) == "0700");
+    REQUIRE(gdb_exchange(fds[0], "p7") == "0400");
+    REQUIRE(gdb_exchange(fds[0], "Z2,100,2") == "OK");
+    REQUIRE(gdb_exchange(fds[0], "c") == "T05watch:100;");
+    REQUIRE(gdb_exchange(fds[0], "m100,2") == "efbe");
+    REQUIRE(gdb_exchange(fds[0], "M200,2:3412") == "OK");
+    REQUIRE(cpu.mem[0x200] == 0x34 && cpu.mem[0x201] == 0x12);
+    REQUIRE(gdb_exchange(fds[0], "P0=0500") == "OK");
+    REQUIRE(gdb_exchange(fds[0], "s") == "W00");
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[0] == 5);
+    REQUIRE(gdb_exchange(fds[0], "D") == "OK");
+    server.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+    REQUIRE(outcome == GdbStub::Outcome::Detached);
+}
+
+TEST(ConsoleOutputIsBuffered) {
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #3, R2
+    loop:
+        MOV #msg, R0
+        TRAP #8
+        MOV # -32768, R0
+        TRAP #4
+        MOV #0xBEEF, R0
+        TRAP #6
+        TRAP #7
+        DEC R2
+        BNE loop
+        HALT
+    msg:
+        .WORD 0x6948
+        .WORD 0x0000
+    )");
+    std::string out;
+    int writes = 0;
+    cpu.console_out.sink = [&](const char* data, size_t len) {
+        ++writes;
+        out.append(data, len);
+    };
+    cpu.run(1000);
+    REQUIRE(writes == 1);
+    REQUIRE(out == "Hi\n-327680xbeef48879Hi\n-327680xbeef48879Hi\n-327680xbeef48879");
+}
+
+TEST(ConsoleStringWrapsWithinBank) {
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #1, R0
+        TRAP #26
+        MOV #0xFFFE, R0
+        TRAP #3
+        HALT
+    )");
+    cpu.mem[0x1FFFE] = 'a';
+    cpu.mem[0x1FFFF] = 'b';
+    cpu.mem[0x10000] = 'c';
+    cpu.mem[0x10001] = 0;
+    std::string out;
+    cpu.console_out.sink = [&](const char* data, size_t len) { out.append(data, len); };
+    cpu.run(100);
+    REQUIRE(out == "abc");
+}
+
+TEST(ConsoleInputBlockReads) {
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #buf, R0
+        MOV #6, R1
+        TRAP #5
+        MOV R0, R2
+        MOV #buf, R0
+        MOV #32, R1
+        TRAP #5
+        MOV R0, R3
+        TRAP #9
+        MOV R0, R4
+        TRAP #10
+        MOV R0, R5
+        TRAP #2
+        HALT
+    buf:
+        .WORD 0
+    )", &res);
+    std::string input = "hello world\n  -17 0xbeef!";
+    int calls = 0;
+    cpu.console_in.source = [&](char* data, size_t len) -> long {
+        ++calls;
+        size_t n = std::min(len, input.size());
+        std::memcpy(data, input.data(), n);
+        input.erase(0, n);
+        return static_cast<long>(n);
+    };
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[2] == 5);
+    REQUIRE(cpu.r[3] == 6);
+    REQUIRE(cpu.mem[res.symbols.at("BUF")] == ' ');
+    REQUIRE(static_cast<int16_t>(cpu.r[4]) == -17);
+    REQUIRE(cpu.r[5] == 0xBEEF);
+    REQUIRE(cpu.psw.z);
+    REQUIRE(calls == 2);
+}
+
+static void put_guest_string(CPU& cpu, uint32_t phys, const std::string& s) {
+    for (size_t i = 0; i < s.size(); ++i) {
+        cpu.mem[phys + i] = static_cast<uint8_t>(s[i]);
+    }
+    cpu.mem[phys + s.size()] = 0;
+}
+
+TEST(FileTrapsCopyAcrossBankWrap) {
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #1, R0
+        TRAP #26
+        MOV #0x4000, R0
+        MOV #1, R1
+        TRAP #20
+        MOV R0, R4
+        MOV #0xFFFC, R1
+        MOV #8, R2
+        TRAP #22
+        MOV R0, R5
+        MOV R4, R0
+        TRAP #23
+        MOV #0x4000, R0
+        MOV #0, R1
+        TRAP #20
+        MOV R0, R4
+        MOV #0xFFFE, R1
+        MOV #100, R2
+        TRAP #21
+        MOV R0, R3
+        MOV R4, R0
+        TRAP #23
+        HALT
+    )");
+    put_guest_string(cpu, 0x14000, "/tmp/pdp11_zero_copy.bin");
+    const char* src = "ABCDEFGH";
+    for (int i = 0; i < 4; ++i) cpu.mem[0x1FFFC + i] = static_cast<uint8_t>(src[i]);
+    for (int i = 0; i < 4; ++i) cpu.mem[0x10000 + i] = static_cast<uint8_t>(src[4 + i]);
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[5] == 8);
+    REQUIRE(cpu.r[3] == 8);
+    REQUIRE(cpu.mem[0x1FFFE] == 'A' && cpu.mem[0x1FFFF] == 'B');
+    REQUIRE(cpu.mem[0x10000] == 'C' && cpu.mem[0x10005] == 'H');
+    REQUIRE(cpu.mem[0x0FFFE] == 0 && cpu.mem[0x20000] == 0);
+}
+
+TEST(FileSeekTell32) {
+    const char* path = "/tmp/pdp11_seek32.bin";
+    {
+        std::ofstream f(path, std::ios::binary);
+        std::string data(70000, '.');
+        data[0x10005] = 'X';
+        data[0x10006] = 'Y';
+        f << data;
+    }
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #path, R0
+        MOV #0, R1
+        TRAP #20
+        MOV R0, R4
+        MOV #1, R1
+        MOV #5, R2
+        MOV #0, R3
+        TRAP #27
+        MOV R1, R5
+        MOV R4, R0
+        MOV #buf, R1
+        MOV #2, R2
+        TRAP #21
+        MOV R4, R0
+        TRAP #28
+        MOV R0, R2
+        MOV R1, R3
+        MOV R4, R0
+        TRAP #25
+        HALT
+    buf:
+        .WORD 0
+    path:
+        .WORD 0
+    )", &res);
+    put_guest_string(cpu, res.symbols.at("PATH"), path);
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[5] == 1);
+    uint16_t buf = res.symbols.at("BUF");
+    REQUIRE(cpu.mem[buf] == 'X' && cpu.mem[buf + 1] == 'Y');
+    REQUIRE(cpu.r[2] == 1);
+    REQUIRE(cpu.r[3] == 7);
+    REQUIRE(cpu.r[0] == 7); // TRAP 25 keeps the low 16 bits
+}
+
+TEST(AsyncFileTraps) {
+    const char* in_path = "/tmp/pdp11_async_in.bin";
+    const char* out_path = "/tmp/pdp11_async_out.bin";
+    {
+        std::ofstream f(in_path, std::ios::binary);
+        std::string data(0x12000, '.');
+        data.replace(0x11000, 4, "WXYZ");
+        data.replace(3, 3, "abc");
+        f << data;
+    }
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #0, R1
+        TRAP #20
+        MOV #0x3100, R0
+        MOV #1, R1
+        TRAP #20
+        MOV #0x2000, R0
+        TRAP #30
+        MOV R0, R4
+        MOV #0x2010, R0
+        TRAP #30
+        MOV R0, R5
+        MOV R4, R0
+        TRAP #32
+        MOV #0x2020, R0
+        TRAP #30
+        MOV #0xFFFF, R0
+        TRAP #32
+        MOV R0, R3
+        TRAP #31
+        HALT
+    )", &res);
+    put_guest_string(cpu, 0x3000, in_path);
+    put_guest_string(cpu, 0x3100, out_path);
+    auto block = [&](uint16_t at, std::vector<uint16_t> words) {
+        for (size_t i = 0; i < words.size(); ++i) {
+            cpu.write_word(static_cast<uint16_t>(at + i * 2), words[i]);
+        }
+    };
+    block(0x2000, {0, 0, 0x4000, 4, 1, 0x1000, 0x1234}); // read 4 @ 0x11000
+    block(0x2010, {0, 0, 0x4010, 3, 0, 3, 0x1234});      // read 3 @ 3
+    block(0x2020, {1, 1, 0x4000, 4, 0, 2, 0x1234});      // write "WXYZ" @ 2
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[4] != 0xFFFF && cpu.r[5] != 0xFFFF && cpu.r[4] != cpu.r[5]);
+    REQUIRE(cpu.r[3] == 0);
+    REQUIRE(cpu.r[0] == 0 && cpu.psw.z);
+    REQUIRE(cpu.read_word(0x200C) == 4);
+    REQUIRE(cpu.read_word(0x201C) == 3);
+    REQUIRE(cpu.read_word(0x202C) == 4);
+    REQUIRE(std::memcmp(&cpu.mem[0x4010], "abc", 3) == 0);
+    cpu.reset(); // closes handles so the write is visible
+    std::ifstream f(out_path, std::ios::binary);
+    std::string written((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    REQUIRE(written.size() == 6 && written.substr(2) == "WXYZ");
+}
+
+TEST(ScatterGatherFileTraps) {
+    const char* path = "/tmp/pdp11_iov.bin";
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #1, R1
+        TRAP #20
+        MOV R0, R4
+        MOV #0x2000, R1
+        MOV #3, R2
+        TRAP #34
+        MOV R0, R5
+        MOV R4, R0
+        TRAP #23
+        MOV #0x3000, R0
+        MOV #0, R1
+        TRAP #20
+        MOV R0, R4
+        MOV #0x2020, R1
+        MOV #2, R2
+        TRAP #33
+        MOV R0, R3
+        MOV R4, R0
+        TRAP #23
+        HALT
+    )");
+    put_guest_string(cpu, 0x3000, path);
+    auto table = [&](uint16_t at, std::vector<uint16_t> words) {
+        for (size_t i = 0; i < words.size(); ++i) {
+            cpu.write_word(static_cast<uint16_t>(at + i * 2), words[i]);
+        }
+    };
+    std::memcpy(&cpu.mem[0x4000], "HDR:", 4);
+    std::memcpy(&cpu.mem[0x1FFFE], "bo", 2); // body wraps within bank 1
+    std::memcpy(&cpu.mem[0x10000], "dy", 2);
+    std::memcpy(&cpu.mem[0x4100], "!", 1);
+    table(0x2000, {0, 0x4000, 4, 1, 0xFFFE, 4, 0, 0x4100, 1});
+    table(0x2020, {2, 0x0000, 5, 0, 0x5000, 100});
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[5] == 9);
+    REQUIRE(cpu.r[3] == 9);
+    REQUIRE(std::memcmp(&cpu.mem[0x20000], "HDR:b", 5) == 0);
+    REQUIRE(std::memcmp(&cpu.mem[0x5000], "ody!", 4) == 0);
+}
+
+TEST(MapFileIntoBank) {
+    const char* path = "/tmp/pdp11_map.bin";
+    {
+        std::ofstream f(path, std::ios::binary);
+        std::string data(0x11000, '.');
+        data.replace(0x10010, 2, "RO");
+        data.replace(0x20, 2, "ab");
+        f << data;
+    }
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #2, R1
+        MOV #0, R2
+        MOV #1, R3
+        TRAP #35
+        MOV R0, R4
+        MOV #0x3000, R0
+        MOV #1, R1
+        MOV #1, R2
+        MOV #0, R3
+        TRAP #35
+        MOV #2, R0
+        TRAP #26
+        MOV @#0x10, R5
+        MOV #0x4F4F, @#0x10
+        MOV #1, R0
+        TRAP #26
+        MOV #0x5958, @#0x20
+        MOV #1, R0
+        TRAP #36
+        MOV R0, R3
+        HALT
+    )");
+    put_guest_string(cpu, 0x3000, path);
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[4] == 0);
+    REQUIRE(cpu.r[5] == 0x4F52);            // "RO" read through the mapping
+    REQUIRE(cpu.mem[0x20010] == 'R');       // store to the read-only bank dropped
+    REQUIRE(cpu.r[3] == 0 && cpu.mem[0x10020] == 0);
+    std::ifstream f(path, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    REQUIRE(data.size() == 0x11000 && data.substr(0x20, 2) == "XY");
+}
+
+TEST(BulkMemoryTraps) {
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x1000, R0
+        MOV #0xFFFC, R1
+        MOV #8, R2
+        MOV #0x0100, R3
+        TRAP #40
+        MOV #0x1008, R0
+        MOV #0x2A, R1
+        MOV #3, R2
+        MOV #0, R3
+        TRAP #41
+        MOV #0x1000, R0
+        MOV #0xFFFC, R1
+        MOV #8, R2
+        MOV #0x0100, R3
+        TRAP #42
+        MOV R0, R4
+        MOV #0x1000, R0
+        MOV #0x1004, R1
+        MOV #4, R2
+        MOV #0, R3
+        TRAP #42
+        MOV R0, R5
+        MOV #0xFFF0, R0
+        MOV #0x47, R1
+        MOV #0x100, R2
+        MOV #1, R3
+        TRAP #43
+        HALT
+    )");
+    std::memcpy(&cpu.mem[0x1FFFC], "ABCDEFGH", 8); // runs on into bank 2
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(std::memcmp(&cpu.mem[0x1000], "ABCDEFGH***", 11) == 0);
+    REQUIRE(cpu.r[4] == 0);
+    REQUIRE(cpu.r[5] == 0xFFFF); // "ABCD" < "EFGH"
+    REQUIRE(cpu.r[0] == 0x0002 && cpu.r[1] == 2 && !cpu.psw.z);
+}
+
+TEST(StringTraps) {
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #1, R0
+        TRAP #26
+        MOV #0x4000, R0
+        TRAP #44
+        MOV R0, R4
+        MOV #0x4000, R0
+        MOV #0x4100, R1
+        TRAP #45
+        MOV R0, R5
+        MOV #0x4000, R0
+        MOV #0x4000, R1
+        TRAP #45
+        MOV R0, R3
+        MOV #0x4000, R0
+        MOV #0x7A, R1
+        TRAP #46
+        MOV R0, R2
+        MOV #0xFFF8, R0
+        MOV #0x4000, R1
+        TRAP #47
+        MOV #0xFFF8, R0
+        TRAP #8
+        HALT
+    )", &res);
+    // 40 bytes so the SIMD loops and their tails are both exercised.
+    const char* text = "the quick brown fox jumps over a lazy dog";
+    std::memcpy(&cpu.mem[0x14000], text, std::strlen(text) + 1);
+    std::memcpy(&cpu.mem[0x14100], "the quick brown fox jumps over a lazy cat", 42);
+    std::string output;
+    cpu.console_out.sink = [&](const char* data, size_t len) { output.append(data, len); };
+    cpu.run(1000);
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[4] == std::strlen(text));
+    REQUIRE(cpu.r[5] == 1);
+    REQUIRE(cpu.r[3] == 0);
+    REQUIRE(cpu.r[2] == 0x4000 + 35);
+    REQUIRE(cpu.mem[0x1FFF9] == 'h' && cpu.mem[0x10000] == 'k'); // copy wrapped
+    REQUIRE(output == std::string(text) + "\n");
+}
+
+TEST(InterruptDrivenConsoleEcho) {
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0x200
+        MOV #0o100, @#0o177560
+    idle:
+        WAIT
+        CMP R5, #113
+        BNE idle
+        HALT
+    rxisr:
+        MOVB @#0o177562, R5
+        MOVB R5, @#0o177566
+        INC R4
+        RTI
+    )", &res);
+    cpu.enable_devices(0);
+    cpu.r[6] = 0x8000;
+    cpu.write_word_code(060, res.symbols.at("RXISR"));
+    cpu.write_word_code(062, 0200); // handler runs at priority 4
+    std::string input = "hi\nq";
+    size_t pos = 0;
+    cpu.console_in.poll_fd = -1;
+    cpu.console_in.source = [&](char* data, size_t len) -> long {
+        if (pos >= input.size()) return 0;
+        data[0] = input[pos++]; // one byte per read, like a terminal
+        (void)len;
+        return 1;
+    };
+    std::string output;
+    cpu.console_out.sink = [&](const char* data, size_t len) { output.append(data, len); };
+    cpu.run(100000);
+    REQUIRE(cpu.halted);
+    REQUIRE(output == input);
+    REQUIRE(cpu.r[4] == 4);
+    REQUIRE(cpu.r[6] == 0x8000);
+    REQUIRE(cpu.psw.priority == 0);
+}
+
+TEST(WaitSleepsUntilClockTick) {
+    AsmResult res;
+    auto cpu = load(R"(
+        .ORIG 0x200
+        MOV #0o100, @#0o177546
+    idle:
+        WAIT
+        CMP R4, #3
+        BNE idle
+        MOV #0o340, @#0o177776
+        HALT
+    clock:
+        INC R4
+        RTI
+    )", &res);
+    cpu.enable_devices(200);
+    cpu.r[6] = 0x8000;
+    cpu.write_word_code(0100, res.symbols.at("CLOCK"));
+    cpu.write_word_code(0102, 0300);
+    auto start = std::chrono::steady_clock::now();
+    cpu.run(100000);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(cpu.halted);
+    REQUIRE(cpu.r[4] == 3);
+    REQUIRE(cpu.psw.priority == 7);
+    // Three 5 ms ticks; an idle loop would have used up the step budget first.
+    REQUIRE(elapsed >= std::chrono::milliseconds(9));
+    REQUIRE(cpu.icount < 100);
+}
+
+TEST(NativeTrapHandlers) {
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x4000, R0
+        MOV #5, R1
+        TRAP #100
+        MOV R0, R4
+        TRAP #101
+        HALT
+    )");
+    std::memcpy(&cpu.mem[0x4000], "\x01\x02\x03\x04\x05", 5);
+    cpu.register_trap(100, [](CPU& c) { // byte checksum of R1 bytes at R0
+        uint16_t sum = 0;
+        for (uint16_t i = 0; i < c.r[1]; ++i) {
+            sum = static_cast<uint16_t>(sum + c.read_byte(static_cast<uint16_t>(c.r[0] + i)));
+        }
+        c.r[0] = sum;
+    });
+    bool threw = false;
+    try {
+        cpu.register_trap(21, [](CPU&) {});
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    REQUIRE(threw);
+    REQUIRE(CPU::builtin_trap(21) && !CPU::builtin_trap(100));
+    threw = false;
+    try {
+        cpu.run(100);
+    } catch (const std::exception&) {
+        threw = true; // TRAP 101 has no handler
+    }
+    REQUIRE(threw);
+    REQUIRE(cpu.r[4] == 15);
+}
+
+TEST(BatchRunnerManifest) {
+    {
+        std::ofstream echo("/tmp/pdp11_batch_echo.asm");
+        echo << R"(
+            .ORIG 0
+        loop:
+            TRAP #2
+            BEQ done
+            TRAP #1
+            BR loop
+        done:
+            HALT
+        )";
+        std::ofstream spin("/tmp/pdp11_batch_spin.asm");
+        spin << ".ORIG 0\nloop:\n BR loop\n";
+    }
+    std::ostringstream manifest;
+    manifest << "# echo jobs\n";
+    for (int i = 0; i < 8; ++i) {
+        std::string input = "/tmp/pdp11_batch_in" + std::to_string(i) + ".txt";
+        std::ofstream(input) << "job" << i;
+        manifest << "pdp11_batch_echo.asm " << input << "\n";
+    }
+    manifest << "\npdp11_batch_spin.asm - 500\n";
+    manifest << "pdp11_batch_missing.asm\n";
+    std::istringstream in(manifest.str());
+    auto jobs = parse_manifest(in, "/tmp");
+    REQUIRE(jobs.size() == 10);
+    REQUIRE(jobs[8].input_path.empty() && jobs[8].max_steps == 500);
+
+    auto results = run_batch(jobs, 3);
+    REQUIRE(results.size() == 10);
+    for (int i = 0; i < 8; ++i) {
+        REQUIRE(results[i].error.empty() && results[i].halted);
+        REQUIRE(results[i].output == "job" + std::to_string(i));
+    }
+    REQUIRE(!results[8].halted && results[8].instructions == 500);
+    REQUIRE(!results[9].error.empty());
+}
+
+TEST(ForkServerRestoresDirtyPages) {
+    AsmResult res;
+    CPU cpu = load(R"(
+        .ORIG 0
+        MOV #100, @#count
+        MOV #1, R5
+    entry:
+        MOV #buf, R1
+        MOV #count, R3
+    loop:
+        TRAP #2
+        BEQ done
+        MOVB R0, (R1)+
+        INC (R3)
+        INC R5
+        BR loop
+    done:
+        MOV @#count, R0
+        TRAP #4
+        MOV R5, R0
+        TRAP #4
+        HALT
+    count:
+        .WORD 0
+    buf:
+        .WORD 0
+        .WORD 0
+        .WORD 0
+        .WORD 0
+    )", &res);
+    std::string startup;
+    cpu.console_out.sink = [&](const char* data, size_t len) { startup.append(data, len); };
+    ForkServer server(cpu, res.symbols.at("ENTRY"), 1000);
+    REQUIRE(cpu.mem[res.symbols.at("COUNT")] == 100);
+
+    auto a = server.run("abc", 1000);
+    REQUIRE(a.halted && a.error.empty());
+    REQUIRE(a.output == "1034");
+    auto b = server.run("abc", 1000);
+    REQUIRE(b.output == a.output && b.instructions == a.instructions);
+    auto c = server.run("xy", 1000);
+    REQUIRE(c.output == "1023");
+    uint16_t buf = res.symbols.at("BUF");
+    REQUIRE(cpu.mem[buf] == 'x' && cpu.mem[buf + 2] == 0);
+
+    auto d = server.run("abcdefgh", 20);
+    REQUIRE(!d.halted && d.instructions == 20);
+    REQUIRE(startup.empty());
+}
+
+TEST(FuzzerFindsNestedCrash) {
+    AsmResult res;
+    CPU cpu = load(R"(
+        .ORIG 0
+    entry:
+        TRAP #2
+        BEQ done
+        CMP R0, #70
+        BNE done
+        TRAP #2
+        CMP R0, #85
+        BNE done
+        TRAP #2
+        CMP R0, #90
+        BNE done
+        .WORD 0o177777
+    done:
+        HALT
+    )", &res);
+    ForkServer server(cpu, res.symbols.at("ENTRY"), 1000);
+    FuzzOptions options;
+    options.max_steps = 1000;
+    options.max_len = 16;
+    Fuzzer fuzzer(server, cpu, options);
+    fuzzer.add_seed("");
+    REQUIRE(fuzzer.corpus().size() == 1 && fuzzer.stats().edges > 0);
+    REQUIRE(!fuzzer.add_seed("")); // same path again
+
+    for (int i = 0; i < 500000 && fuzzer.crashes().empty(); ++i) {
+        fuzzer.fuzz_one();
+    }
+    REQUIRE(fuzzer.crashes().size() == 1);
+    REQUIRE(fuzzer.crashes()[0].input.compare(0, 3, "FUZ") == 0);
+    REQUIRE(fuzzer.corpus().size() >= 3); // "F", "FU" paths were kept on the way
+}
+
+namespace {
+
+// Steps normally but corrupts one byte of memory at a chosen icount.
+class CorruptingEngine : public Engine {
+public:
+    CorruptingEngine(CPU& cpu, uint64_t at, uint32_t phys) : cpu_(cpu), at_(at), phys_(phys) {}
+    const char* name() const override { return "corrupting"; }
+    CPU& cpu() override { return cpu_; }
+    void advance() override {
+        cpu_.step();
+        if (cpu_.icount == at_) {
+            cpu_.mem[phys_] ^= 0xFF;
+            cpu_.mark_dirty(phys_, 1);
+        }
+    }
+
+private:
+    CPU& cpu_;
+    uint64_t at_;
+    uint32_t phys_;
+};
+
+const char* kLockstepProgram = R"(
+    .ORIG 0
+    MOV #0o1000, R1
+loop:
+    TRAP #2
+    BEQ done
+    MOVB R0, (R1)+
+    TRAP #1
+    BR loop
+done:
+    MOV R1, R0
+    TRAP #4
+    HALT
+)";
+
+} // namespace
+
+TEST(LockstepRunMatchesStep) {
+    CPU ref = load(kLockstepProgram);
+    CPU cand = load(kLockstepProgram);
+    StepEngine step(ref);
+    RunEngine run(cand, 7);
+    LockstepReport report = run_lockstep(step, run, "hello", 1000);
+    REQUIRE(!report.diverged && report.halted && report.error.empty());
+    REQUIRE(report.output == "hello517");
+    REQUIRE(report.instructions == ref.icount && cand.icount == ref.icount);
+}
+
+TEST(LockstepReportsFirstDivergence) {
+    CPU ref = load(kLockstepProgram);
+    CPU cand = load(kLockstepProgram);
+    StepEngine step(ref);
+    CorruptingEngine bad(cand, 9, 01001);
+    LockstepReport report = run_lockstep(step, bad, "hello", 1000);
+    REQUIRE(report.diverged && !report.halted);
+    REQUIRE(report.instructions == 9);
+    REQUIRE(report.message.find("after 9 instructions") != std::string::npos);
+    REQUIRE(report.message.find("mem[0x201]") != std::string::npos);
+    REQUIRE(report.message.find("MOVB") != std::string::npos);
+}
+
+TEST(MultiCPUMatchesScalarPerLane) {
+    // Sum 1..n with data-dependent trip counts; n == 13 hits an
+    // unimplemented instruction, n < 0 takes a different path.
+    const char* source = R"(
+        .ORIG 0
+        TRAP #9
+        MOV R0, R1
+        CMP R0, #13
+        BNE ok
+        .WORD 0o177777
+    ok:
+        CLR R2
+        TST R1
+        BEQ done
+        ASL R1
+        ASR R1
+    loop:
+        ADD R1, R2
+        DEC R1
+        BNE loop
+    done:
+        MOV R2, R0
+        TRAP #4
+        HALT
+    )";
+    Assembler asmblr;
+    AsmResult res = asmblr.assemble(source);
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 37; ++i) {
+        inputs.push_back(std::to_string(i % 20));
+    }
+    inputs.push_back("-3");
+    MultiCPU multi(inputs.size());
+    multi.load(res.start, res.words);
+    for (size_t lane = 0; lane < inputs.size(); ++lane) {
+        multi.set_input(lane, inputs[lane]);
+    }
+    multi.run(5000);
+
+    for (size_t lane = 0; lane < inputs.size(); ++lane) {
+        CPU cpu = load(source);
+        std::string out;
+        cpu.console_out.sink = [&](const char* data, size_t len) { out.append(data, len); };
+        cpu.console_in.poll_fd = -1;
+        size_t pos = 0;
+        const std::string& in = inputs[lane];
+        cpu.console_in.source = [&](char* data, size_t len) -> long {
+            size_t n = std::min(len, in.size() - pos);
+            std::memcpy(data, in.data() + pos, n);
+            pos += n;
+            return static_cast<long>(n);
+        };
+        std::string error;
+        try {
+            cpu.run(5000);
+        } catch (const std::exception& ex) {
+            error = ex.what();
+        }
+        REQUIRE(multi.error(lane) == error);
+        REQUIRE(multi.halted(lane) == cpu.halted);
+        REQUIRE(multi.output(lane) == out);
+        REQUIRE(multi.instructions(lane) == cpu.icount);
+        for (int r = 0; r < 8; ++r) {
+            REQUIRE(multi.reg(lane, r) == cpu.r[r]);
+        }
+        Flags f = multi.flags(lane);
+        REQUIRE(f.n == cpu.psw.n && f.z == cpu.psw.z && f.v == cpu.psw.v && f.c == cpu.psw.c);
+    }
+    REQUIRE(multi.output(19) == "190");
+    REQUIRE(!multi.error(13).empty());
+    REQUIRE(multi.stats().vector_steps > 0);
+    // The loop body runs vectorized; only TRAP/HALT-like steps fall back.
+    REQUIRE(multi.stats().scalar_steps < multi.stats().vector_steps * inputs.size());
+}
+
+TEST(YieldingTrapRetriesPartialInput) {
+    CPU cpu = load(R"(
+        .ORIG 0
+        TRAP #9
+        TRAP #4
+        MOV #0o1000, R0
+        MOV #32, R1
+        TRAP #5
+        MOV #0o1000, R0
+        TRAP #3
+        HALT
+    )");
+    std::string pending;
+    bool closed = false;
+    std::string out;
+    cpu.console_out.sink = [&](const char* data, size_t len) { out.append(data, len); };
+    cpu.console_in.poll_fd = -1;
+    cpu.console_in.source = [&](char* data, size_t len) -> long {
+        if (pending.empty()) {
+            return closed ? 0 : InputChannel::kWouldBlock;
+        }
+        size_t n = std::min(len, pending.size());
+        std::memcpy(data, pending.data(), n);
+        pending.erase(0, n);
+        return static_cast<long>(n);
+    };
+    GuestScheduler sched;
+    size_t id = sched.add(cpu, 1000);
+    sched.run();
+    REQUIRE(sched.state(id) == GuestScheduler::State::Blocked);
+    REQUIRE(cpu.r[7] == 0 && cpu.icount == 0 && cpu.blocked_fd == -1);
+
+    pending = "  -1"; // number not finished yet
+    sched.wake(id);
+    sched.run();
+    REQUIRE(sched.state(id) == GuestScheduler::State::Blocked && cpu.r[7] == 0);
+    pending = "23 hel";
+    sched.wake(id);
+    sched.run();
+    REQUIRE(out == "-123");
+    REQUIRE(sched.state(id) == GuestScheduler::State::Blocked);
+    pending = "lo\nrest";
+    sched.wake(id);
+    sched.run();
+    REQUIRE(sched.state(id) == GuestScheduler::State::Halted);
+    REQUIRE(out == "-123hello"); // TRAP 9 consumed the space
+    REQUIRE(cpu.icount == 8);
+}
+
+TEST(SchedulerMultiplexesPipeGuests) {
+    const char* source = R"(
+        .ORIG 0
+        TRAP #9
+        MOV R0, R1
+        TRAP #9
+        ADD R1, R0
+        TRAP #4
+        HALT
+    )";
+    constexpr int kGuests = 200;
+    std::vector<CPU> cpus;
+    std::vector<std::string> outs(kGuests);
+    std::vector<int> writers;
+    GuestScheduler sched(100);
+    cpus.reserve(kGuests);
+    for (int i = 0; i < kGuests; ++i) {
+        int fds[2];
+        REQUIRE(::pipe(fds) == 0);
+        writers.push_back(fds[1]);
+        cpus.push_back(load(source));
+        CPU& cpu = cpus.back();
+        cpu.console_in.read_nonblocking(fds[0]);
+        cpu.console_out.sink = [&outs, i](const char* data, size_t len) { outs[i].append(data, len); };
+        sched.add(cpu, 1000);
+    }
+    std::thread writer([&]() {
+        // Each guest gets its first number, then its second, in reverse order.
+        for (int i = 0; i < kGuests; ++i) {
+            std::string a = std::to_string(i) + " ";
+            REQUIRE(::write(writers[i], a.data(), a.size()) == static_cast<ssize_t>(a.size()));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        for (int i = kGuests - 1; i >= 0; --i) {
+            REQUIRE(::write(writers[i], "1000\n", 5) == 5);
+            ::close(writers[i]);
+        }
+    });
+    sched.run();
+    writer.join();
+    for (int i = 0; i < kGuests; ++i) {
+        REQUIRE(sched.state(i) == GuestScheduler::State::Halted);
+        REQUIRE(outs[i] == std::to_string(1000 + i));
+        ::close(cpus[i].console_in.poll_fd);
+    }
+    REQUIRE(sched.stats().blocks >= kGuests);
+}
+
+TEST(SimServerRunsCachedProgramsOverSocket) {
+    std::string path = "/tmp/pdp11d_test_" + std::to_string(::getpid()) + ".sock";
+    SimServer server(4);
+    int lfd = SimServer::listen_unix(path);
+    std::thread([&server, lfd]() {
+        int fd = ::accept(lfd, nullptr, nullptr);
+        server.serve_connection(fd);
+        ::close(lfd);
+    }).detach();
+
+    // R4 picks up whatever a previous job left below the stack.
+    const std::string source = R"(
+        .ORIG 0o1000
+        MOV @#65532, R4
+        MOV #7, -(R6)
+        CLR R5
+    loop:
+        TRAP #2
+        BEQ done
+        INC R5
+        TRAP #1
+        BR loop
+    done:
+        MOV R5, R0
+        TRAP #4
+        HALT
+    )";
+    SimClient client(path);
+    uint64_t hash = client.load(source);
+    REQUIRE(hash == program_hash(source));
+    REQUIRE(client.load(source) == hash);
+
+    RunReply a = client.run(hash, "abc", 1000);
+    REQUIRE(a.status == RunReply::Halted);
+    REQUIRE(a.data == "abc3");
+    REQUIRE(a.r[5] == 3 && a.r[4] == 0);
+    RunReply b = client.run(hash, "xy", 1000);
+    REQUIRE(b.status == RunReply::Halted && b.data == "xy2");
+    REQUIRE(b.r[4] == 0);
+    REQUIRE(b.instructions < a.instructions);
+
+    RunReply limit = client.run(hash, "abcdef", 10);
+    REQUIRE(limit.status == RunReply::Limit && limit.instructions == 10);
+    RunReply unknown = client.run(hash + 1, "", 10);
+    REQUIRE(unknown.status == RunReply::UnknownProgram);
+
+    bool threw = false;
+    try {
+        client.load("BOGUS R0\n");
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    REQUIRE(threw);
+    ::unlink(path.c_str());
+}
+
+TEST(SmpCoresShareMemoryAndMailboxes) {
+    Assembler as;
+    AsmResult res = as.assemble(R"(
+        .ORIG 0o1000
+        TRAP #52
+        MOV R0, R4
+        MOV #500, R5
+    loop:
+        MOV #lock, R0
+        TRAP #50
+        BNE loop
+        MOV #plain, R2
+        INC (R2)
+        MOV #lock, R2
+        CLR (R2)
+    cas:
+        MOV #casc, R0
+        MOV (R0), R1
+        MOV R1, R2
+        INC R2
+        TRAP #51
+        BNE cas
+        DEC R5
+        BNE loop
+        TST R4
+        BEQ collect
+        CLR R0
+        MOV R4, R1
+        TRAP #53
+        HALT
+    collect:
+        TRAP #52
+        MOV R1, R3
+        DEC R3
+    wait:
+        TRAP #54
+        ADD R0, R5
+        DEC R3
+        BNE wait
+        MOV #plain, R2
+        MOV (R2), R0
+        TRAP #4
+        MOV #32, R0
+        TRAP #1
+        MOV #casc, R2
+        MOV (R2), R0
+        TRAP #4
+        HALT
+    lock:
+        .WORD 0
+    plain:
+        .WORD 0
+    casc:
+        .WORD 0
+    )");
+    SmpMachine smp(4);
+    smp.load(res.start, res.words);
+    std::string out;
+    smp.core(0).console_out.sink = [&](const char* data, size_t len) { out.append(data, len); };
+    smp.run(1000000);
+    for (size_t id = 0; id < smp.size(); ++id) {
+        REQUIRE(smp.error(id).empty());
+        REQUIRE(smp.core(id).halted);
+    }
+    REQUIRE(out == "2000 2000");
+    REQUIRE(smp.core(0).r[5] == 1 + 2 + 3);
+    REQUIRE(smp.core(3).r[6] == 0xFFFE - 3 * SmpMachine::kStackSpacing);
+
+    // Nobody left to send: both receivers fail instead of hanging.
+    AsmResult stuck = as.assemble(R"(
+        .ORIG 0o1000
+        TRAP #54
+        HALT
+    )");
+    SmpMachine idle(2);
+    idle.load(stuck.start, stuck.words);
+    idle.run(1000);
+    REQUIRE(!idle.error(0).empty() && !idle.error(1).empty());
+}
+
+TEST(ProcessBatchSurvivesDeadWorker) {
+    {
+        std::ofstream echo("/tmp/pdp11_pbatch_echo.asm");
+        echo << ".ORIG 0\nloop:\n TRAP #2\n BEQ done\n TRAP #1\n BR loop\ndone:\n HALT\n";
+        std::ofstream spin("/tmp/pdp11_pbatch_spin.asm");
+        spin << ".ORIG 0\nloop:\n BR loop\n";
+    }
+    std::ostringstream manifest;
+    for (int i = 0; i < 6; ++i) {
+        std::string input = "/tmp/pdp11_pbatch_in" + std::to_string(i) + ".txt";
+        std::ofstream(input) << "out" << i;
+        manifest << "pdp11_pbatch_echo.asm " << input << "\n";
+        if (i == 1) {
+            manifest << "pdp11_pbatch_spin.asm - 1000000000000\n"; // only the timeout stops it
+        }
+    }
+    manifest << "pdp11_pbatch_missing.asm\n";
+    std::istringstream in(manifest.str());
+    auto jobs = parse_manifest(in, "/tmp");
+    REQUIRE(jobs.size() == 8);
+
+    ProcessBatchOptions options;
+    options.workers = 1; // the jobs after the spin need a replacement worker
+    options.job_timeout_ms = 200;
+    auto results = run_batch_processes(jobs, options);
+    REQUIRE(results.size() == 8);
+    for (size_t i : {0, 1, 3, 4, 5, 6}) {
+        REQUIRE(results[i].error.empty() && results[i].halted);
+        REQUIRE(results[i].output == "out" + std::to_string(i < 2 ? i : i - 1));
+    }
+    REQUIRE(results[2].error.find("Worker died: signal") == 0);
+    REQUIRE(results[7].error.find("Failed to open") != std::string::npos);
+}
+
+TEST(AssemblerPatchesForwardReferences) {
+    Assembler as;
+    AsmResult res = as.assemble(R"(
+        .ORIG 0o1000
+        MOV #data, R1       ; immediate
+        MOV @#data, R2      ; absolute
+        MOV data, R3        ; PC-relative
+        MOV 2(R1), R4
+        BEQ done
+        JSR R5, sub
+    done:
+        HALT
+    sub:
+        RTS R5
+    data:
+        .WORD done
+        .WORD 7
+    )");
+    uint16_t data = res.symbols.at("DATA");
+    uint16_t done = res.symbols.at("DONE");
+    REQUIRE(data == 01032 && done == 01026);
+    REQUIRE(res.words[1] == data && res.words[3] == data);
+    REQUIRE(res.words[5] == static_cast<uint16_t>(data - (01010 + 4)));
+    REQUIRE(res.words[8] == (0001400 | 2)); // BEQ skips the JSR
+    REQUIRE(res.words[10] == static_cast<uint16_t>(01030 - (01022 + 4)));
+    REQUIRE(res.words[13] == done);
+    REQUIRE(res.word_lines[5] == 5 && res.instr_starts[4] && !res.instr_starts[5]);
+
+    CPU cpu;
+    cpu.reset();
+    cpu.r[7] = res.start;
+    cpu.r[6] = 0xFFFE;
+    cpu.load_words(res.start, res.words);
+    cpu.run(100);
+    REQUIRE(cpu.halted && cpu.r[3] == done && cpu.r[4] == 7);
+
+    auto error_of = [&](const std::string& source) {
+        try {
+            as.assemble(source);
+        } catch (const std::runtime_error& ex) {
+            return std::string(ex.what());
+        }
+        return std::string();
+    };
+    REQUIRE(error_of(".ORIG 0\nMOV #later, R0\nMOV #Missing, R1\nlater: HALT\n") == "Undefined symbol: Missing");
+    std::string far = ".ORIG 0\nBR far\n";
+    for (int i = 0; i < 200; ++i) {
+        far += "HALT\n";
+    }
+    REQUIRE(error_of(far + "far: HALT\n") == "Branch out of range on line 2");
+}
+
+TEST(OddWordStoreSkipsReadOnlyNextBank) {
+    const char* path = "/tmp/pdp11_map_ro.bin";
+    std::ofstream(path, std::ios::binary) << std::string(0x10000, 'x');
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #1, R1
+        MOV #0, R2
+        MOV #0, R3
+        TRAP #35
+        MOV R0, R4
+        MOV #0x1234, @#0xFFFF
+        HALT
+    )");
+    put_guest_string(cpu, 0x3000, path);
+    cpu.run(100);
+    REQUIRE(cpu.halted && cpu.r[4] == 0);
+    REQUIRE(cpu.mem[0xFFFF] == 0x34);    // low byte stays in bank 0
+    REQUIRE(cpu.mem[0x10000] == 'x');    // high byte dropped, not faulted
+}
+
+TEST(MapFileZeroesBankPastEndOfFile) {
+    const char* path = "/tmp/pdp11_map_short.bin";
+    std::ofstream(path, std::ios::binary) << std::string(100, 'f');
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #1, R1
+        MOV #0, R2
+        MOV #0, R3
+        TRAP #35
+        HALT
+    )");
+    put_guest_string(cpu, 0x3000, path);
+    cpu.mem[0x18000] = 0xAA;
+    cpu.run(100);
+    REQUIRE(cpu.halted && cpu.r[0] == 0);
+    REQUIRE(cpu.mem[0x10063] == 'f');
+    REQUIRE(cpu.mem[0x10064] == 0 && cpu.mem[0x18000] == 0);
+}
+
+TEST(AsyncLargeTransferStatusAndReplay) {
+    const char* path = "/tmp/pdp11_async_big.bin";
+    std::ofstream(path, std::ios::binary) << std::string(0x10000, 'q');
+    const char* source = R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #0, R1
+        TRAP #20
+        MOV #1, R0
+        TRAP #26
+        MOV #0x2000, R0
+        TRAP #30
+        MOV #0xFFFF, R0
+        TRAP #32
+        HALT
+    )";
+    auto setup = [&](CPU& cpu) {
+        put_guest_string(cpu, 0x3000, path);
+        const uint16_t block[] = {0, 0, 0x4000, 0xFFFF, 0, 0, 0x1234}; // asks for more than the cap
+        for (size_t i = 0; i < 7; ++i) {
+            cpu.mem[0x12000 + i * 2] = static_cast<uint8_t>(block[i]);
+            cpu.mem[0x12001 + i * 2] = static_cast<uint8_t>(block[i] >> 8);
+        }
+    };
+    auto status = [](const CPU& cpu) { return static_cast<uint16_t>(cpu.mem[0x1200C] | (cpu.mem[0x1200D] << 8)); };
+
+    auto rec = load(source);
+    setup(rec);
+    rec.events.mode = CPU::EventLog::Mode::Record;
+    rec.run(1000);
+    REQUIRE(rec.halted && status(rec) == 0xFFFD);
+    REQUIRE(rec.mem[0x13FFC] == 'q' && rec.mem[0x13FFD] == 0); // wrapped read stops short of 0x3FFD
+
+    auto play = load(source);
+    setup(play);
+    play.events = rec.events;
+    play.events.mode = CPU::EventLog::Mode::Replay;
+    play.run(1000);
+    REQUIRE(play.halted && status(play) == 0xFFFD);
+    REQUIRE(play.mem[0x18000] == 'q');
+}
+
+TEST(CheckpointRestoresFileMappings) {
+    const char* path = "/tmp/pdp11_map_cp.bin";
+    std::ofstream(path, std::ios::binary) << std::string(0x100, 'a');
+    auto cpu = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #1, R1
+        MOV #1, R2
+        MOV #0, R3
+        TRAP #35
+        HALT
+    )");
+    put_guest_string(cpu, 0x3000, path);
+    cpu.mem[0x10000] = 'z';
+    auto before = cpu.save_checkpoint();
+    cpu.run(100);
+    REQUIRE(cpu.halted && cpu.r[0] == 0 && cpu.mem.mapped(1));
+    auto mapped = cpu.save_checkpoint();
+    cpu.mem[0x10000] = 'b'; // reaches the file
+
+    cpu.restore_checkpoint(before); // unmaps, then the saved bytes come back
+    REQUIRE(!cpu.mem.mapped(1) && cpu.mem[0x10000] == 'z');
+    cpu.restore_checkpoint(mapped); // maps the file again and leaves it alone
+    REQUIRE(cpu.mem.mapped(1) && cpu.mem[0x10000] == 'b');
+    std::ifstream f(path, std::ios::binary);
+    REQUIRE(f.get() == 'b');
+
+    auto rec = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #1, R1
+        MOV #1, R2
+        MOV #0, R3
+        TRAP #35
+        HALT
+    )");
+    put_guest_string(rec, 0x3000, path);
+    rec.events.mode = CPU::EventLog::Mode::Record;
+    rec.run(100);
+    REQUIRE(rec.halted && rec.r[0] == 0xFFFF && !rec.mem.mapped(1)); // refused while recording
+}
+
+TEST(ForkServerDropsInFlightAsyncRequests) {
+    const char* path = "/tmp/pdp11_fork_async.bin";
+    std::ofstream(path, std::ios::binary) << std::string(16, 'q');
+    AsmResult res;
+    CPU cpu = load(R"(
+        .ORIG 0
+        MOV #0x3000, R0
+        MOV #0, R1
+        TRAP #20
+    entry:
+        TRAP #2
+        BEQ wait
+        MOV #0x2000, R0
+        TRAP #30
+        MOV R0, R4
+        HALT
+    wait:
+        MOV #0xFFFF, R0
+        TRAP #32
+        MOV R0, R4
+        HALT
+    )", &res);
+    put_guest_string(cpu, 0x3000, path);
+    const uint16_t block[] = {0, 0, 0x4000, 16, 0, 0, 0};
+    for (size_t i = 0; i < 7; ++i) {
+        cpu.write_word(static_cast<uint16_t>(0x2000 + i * 2), block[i]);
+    }
+    ForkServer server(cpu, res.symbols.at("ENTRY"), 1000);
+
+    auto a = server.run("a", 1000); // submits a read and halts without waiting
+    REQUIRE(a.halted && a.error.empty());
+    uint16_t first_id = cpu.r[4];
+    auto b = server.run("", 1000); // waits for everything: nothing is outstanding
+    REQUIRE(b.halted && b.error.empty());
+    REQUIRE(cpu.r[4] == 0 && cpu.mem[0x4000] == 0 && cpu.read_word(0x200C) == 0);
+    auto c = server.run("a", 1000);
+    REQUIRE(c.halted && cpu.r[4] == first_id);
+}
+
+TEST(CheckpointsThinOutAndLogCountsAreChecked) {
+    auto cpu = load(R"(
+        .ORIG 0
+    loop:
+        INC R1
+        BR loop
+    )");
+    cpu.events.mode = CPU::EventLog::Mode::Record;
+    cpu.checkpoint_interval = 10;
+    cpu.run(5000);
+    REQUIRE(cpu.checkpoints.size() <= CPU::kMaxCheckpoints);
+    REQUIRE(cpu.checkpoints.front().icount == 0);
+    REQUIRE(cpu.checkpoints.back().icount == 4990);
+    REQUIRE(cpu.rewind_to(7) && cpu.r[1] == 4); // only the first checkpoint is that early
+    REQUIRE(cpu.rewind_to(4995) && cpu.r[1] == 2498);
+
+    const char* path = "/tmp/pdp11_bad.log";
+    {
+        std::ofstream f(path, std::ios::binary);
+        f.write("PDP11LOG", 8);
+        f.write("\xff\xff\xff\xff\xff\xff\x00\x00", 8); // 2^48 values in a 16-byte file
+    }
+    bool threw = false;
+    try {
+        load_event_log(path);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    REQUIRE(threw);
+}
+
+TEST(SimServerDropsOversizedRequest) {
+    SimServer server(1);
+    int fds[2];
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::thread worker([&]() { server.serve_connection(fds[1]); });
+    const char request[] = {'L', '\xff', '\xff', '\xff', '\xff'}; // 4 GB of source
+    REQUIRE(::write(fds[0], request, sizeof(request)) == static_cast<ssize_t>(sizeof(request)));
+    char reply = 0;
+    REQUIRE(::read(fds[0], &reply, 1) == 0); // closed without allocating
+    worker.join();
+    ::close(fds[0]);
+}
+
+TEST(BatchJobWithMissingInputReportsNoInstructions) {
+    std::ofstream("/tmp/pdp11_batch_spin2.asm") << ".ORIG 0\nloop:\n BR loop\n";
+    std::vector<BatchJob> jobs(2);
+    jobs[0].program = "/tmp/pdp11_batch_spin2.asm";
+    jobs[0].input_path = "/tmp/pdp11_batch_no_such_input.txt";
+    jobs[1].program = jobs[0].program;
+    jobs[1].max_steps = 500;
+    // One worker takes from the back of its queue, so job 0 reuses the CPU
+    // job 1 ran on.
+    auto results = run_batch(jobs, 1);
+    REQUIRE(results[1].instructions == 500);
+    REQUIRE(!results[0].error.empty() && results[0].instructions == 0);
+}
+
+TEST(GdbStubStopSignals) {
+    auto cpu = load(R"(
+        .ORIG 0
+    loop:
+        MOV R0, R0
+        BEQ loop
+        TRAP #101
+    )");
+    int fds[2];
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::thread server([&]() {
+        GdbStub stub(cpu, fds[1]);
+        stub.serve();
+    });
+    REQUIRE(gdb_exchange(fds[0], "QStartNoAckMode") == "OK");
+    std::string cont = gdb_frame("c") + "\x03"; // Ctrl-C while running
+    REQUIRE(::write(fds[0], cont.data(), cont.size()) == static_cast<ssize_t>(cont.size()));
+    REQUIRE(gdb_read_reply(fds[0]) == "S02");
+    REQUIRE(gdb_exchange(fds[0], "?") == "S02");
+    REQUIRE(gdb_exchange(fds[0], "P0=0100") == "OK");
+    REQUIRE(gdb_exchange(fds[0], "c") == "S04"); // TRAP 101 has no handler
+    REQUIRE(gdb_exchange(fds[0], "D") == "OK");
+    server.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST(WaitWithoutDevicesIsAnError) {
+    auto cpu = load(R"(
+        .ORIG 0
+        INC R0
+        WAIT
+        HALT
+    )");
+    bool threw = false;
+    try {
+        cpu.run(100);
+    } catch (const std::runtime_error& ex) {
+        threw = std::string(ex.what()).find("WAIT") != std::string::npos;
+    }
+    REQUIRE(threw && !cpu.halted && cpu.r[0] == 1);
+}
+
+TEST(ProcessBatchLeavesOtherChildrenAlone) {
+    std::ofstream("/tmp/pdp11_pbatch_halt.asm") << ".ORIG 0\n HALT\n";
+    std::fflush(nullptr);
+    pid_t other = ::fork();
+    REQUIRE(other >= 0);
+    if (other == 0) {
+        ::_exit(7);
+    }
+    std::vector<BatchJob> jobs(4);
+    for (auto& job : jobs) {
+        job.program = "/tmp/pdp11_pbatch_halt.asm";
+    }
+    ProcessBatchOptions options;
+    options.workers = 2;
+    auto results = run_batch_processes(jobs, options);
+    for (const auto& result : results) {
+        REQUIRE(result.error.empty() && result.halted);
+    }
+    int status = 0;
+    REQUIRE(::waitpid(other, &status, 0) == other); // still ours to reap
+    REQUIRE(WIFEXITED(status) && WEXITSTATUS(status) == 7);
+}
+
+TEST(CliResolvesAddressesAndEntryPoints) {
+    Assembler as;
+    AsmResult res = as.assemble(".ORIG 0o1000\n HALT\nentry:\n HALT\n");
+    REQUIRE(resolve_address("entry", res, "breakpoint") == 01002);
+    REQUIRE(resolve_address("0x10", res, "breakpoint") == 0x10 && parse_u16("0o17") == 017);
+    REQUIRE(resolve_entry("", res) == 01002 && resolve_entry("512", res) == 512);
+    REQUIRE(resolve_entry("", as.assemble(".ORIG 0o1000\n HALT\n")) == 01000);
+    int errors = 0;
+    for (const char* bad : {"0x10000", "12abc", "nowhere"}) {
+        try {
+            resolve_address(bad, res, "breakpoint");
+        } catch (const std::runtime_error&) {
+            ++errors;
+        }
+    }
+    REQUIRE(errors == 3);
+}
+
 int main() {
     int passed = 0;
     int failed = 0;